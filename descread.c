@@ -0,0 +1,433 @@
+#include "descread.h"
+
+/*
+ * A reader of batches of files. On Linux the files of a batch are opened, read
+ * and closed by io_uring, every file as a chain of three linked requests that
+ * uses a direct descriptor, so a batch costs one system call to submit and a
+ * few to wait for. Elsewhere, or if the kernel does not support it, a pool of
+ * NREADERS threads reads the files.
+ */
+struct descread {
+  dr_file_t *files; /* the current batch */
+  size_t n;
+#ifdef __linux__
+  int ring; /* io_uring descriptor, -1 if the threads are used */
+  unsigned *sqtail;
+  unsigned *sqmask;
+  unsigned *sqarray;
+  unsigned *cqhead;
+  unsigned *cqtail;
+  unsigned *cqmask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sqmap;
+  void *cqmap;
+  size_t sqmaplen;
+  size_t cqmaplen;
+  size_t sqeslen;
+  size_t pending; /* number of reads and closes that are not completed yet */
+#endif
+  pthread_t threads[NREADERS];
+  int nthreads;
+  size_t next; /* the next file to read by a thread */
+  size_t done; /* number of files read by the threads */
+  int quit;
+  pthread_mutex_t mtx; /* protects files, n, next, done and quit */
+  pthread_cond_t work; /* signals the threads that there is a new batch */
+  pthread_cond_t idle; /* signals dr_wait() that the batch is read */
+};
+
+static void read_file(dr_file_t *f);
+static void *worker(void *arg);
+#ifdef __linux__
+static int uring_open(descread_t *dr);
+static void uring_close(descread_t *dr);
+static void uring_start(descread_t *dr);
+static void uring_wait(descread_t *dr);
+#endif
+
+/*
+ * Open a reader, with io_uring if possible and threads otherwise.
+ *
+ * Return a pointer to the new reader on success, or NULL on error.
+ */
+descread_t *
+dr_open(void)
+{
+  descread_t *dr;
+  int i;
+
+  if ((dr = calloc(1, sizeof(*dr))) == NULL) {
+    log_warnx("%s: calloc", __func__);
+    return NULL;
+  }
+
+#ifdef __linux__
+  if (uring_open(dr) == 0)
+    return dr;
+  dr->ring = -1;
+#endif
+
+  if ((errno = pthread_mutex_init(&dr->mtx, NULL)) != 0)
+    err(1, "%s: pthread_mutex_init", __func__);
+  if ((errno = pthread_cond_init(&dr->work, NULL)) != 0)
+    err(1, "%s: pthread_cond_init", __func__);
+  if ((errno = pthread_cond_init(&dr->idle, NULL)) != 0)
+    err(1, "%s: pthread_cond_init", __func__);
+
+  for (i = 0; i < NREADERS; i++)
+    if ((errno = pthread_create(&dr->threads[i], NULL, worker, dr)) != 0)
+      err(1, "%s: pthread_create", __func__);
+  dr->nthreads = NREADERS;
+
+  return dr;
+}
+
+/*
+ * Start reading a batch of at most DRMAXBATCH files. Only one batch can be
+ * read at a time, the batch is read once dr_wait() returns. Exit if a file
+ * can't be read.
+ */
+void
+dr_start(descread_t *dr, dr_file_t *files, size_t n)
+{
+  if (n > DRMAXBATCH)
+    errx(1, "%s: batch too big: %zu", __func__, n);
+
+#ifdef __linux__
+  if (dr->ring != -1) {
+    dr->files = files;
+    dr->n = n;
+    uring_start(dr);
+    return;
+  }
+#endif
+
+  if ((errno = pthread_mutex_lock(&dr->mtx)) != 0)
+    err(1, "%s: pthread_mutex_lock", __func__);
+  dr->files = files;
+  dr->n = n;
+  dr->next = 0;
+  dr->done = 0;
+  if ((errno = pthread_cond_broadcast(&dr->work)) != 0)
+    err(1, "%s: pthread_cond_broadcast", __func__);
+  if ((errno = pthread_mutex_unlock(&dr->mtx)) != 0)
+    err(1, "%s: pthread_mutex_unlock", __func__);
+}
+
+/* wait until all files of the batch of dr_start() are read */
+void
+dr_wait(descread_t *dr)
+{
+#ifdef __linux__
+  if (dr->ring != -1) {
+    uring_wait(dr);
+    return;
+  }
+#endif
+
+  if ((errno = pthread_mutex_lock(&dr->mtx)) != 0)
+    err(1, "%s: pthread_mutex_lock", __func__);
+  while (dr->done < dr->n)
+    if ((errno = pthread_cond_wait(&dr->idle, &dr->mtx)) != 0)
+      err(1, "%s: pthread_cond_wait", __func__);
+  if ((errno = pthread_mutex_unlock(&dr->mtx)) != 0)
+    err(1, "%s: pthread_mutex_unlock", __func__);
+}
+
+/* return how the files are read */
+const char *
+dr_method(const descread_t *dr)
+{
+#ifdef __linux__
+  if (dr->ring != -1)
+    return "io_uring";
+#endif
+
+  return "threads";
+}
+
+/*
+ * Close a reader. Any batch must be waited for first.
+ */
+void
+dr_close(descread_t *dr)
+{
+  int i;
+
+#ifdef __linux__
+  if (dr->ring != -1) {
+    uring_close(dr);
+    free(dr);
+    return;
+  }
+#endif
+
+  if ((errno = pthread_mutex_lock(&dr->mtx)) != 0)
+    err(1, "%s: pthread_mutex_lock", __func__);
+  dr->quit = 1;
+  if ((errno = pthread_cond_broadcast(&dr->work)) != 0)
+    err(1, "%s: pthread_cond_broadcast", __func__);
+  if ((errno = pthread_mutex_unlock(&dr->mtx)) != 0)
+    err(1, "%s: pthread_mutex_unlock", __func__);
+
+  for (i = 0; i < dr->nthreads; i++)
+    if ((errno = pthread_join(dr->threads[i], NULL)) != 0)
+      err(1, "%s: pthread_join", __func__);
+
+  if ((errno = pthread_cond_destroy(&dr->idle)) != 0)
+    err(1, "%s: pthread_cond_destroy", __func__);
+  if ((errno = pthread_cond_destroy(&dr->work)) != 0)
+    err(1, "%s: pthread_cond_destroy", __func__);
+  if ((errno = pthread_mutex_destroy(&dr->mtx)) != 0)
+    err(1, "%s: pthread_mutex_destroy", __func__);
+
+  free(dr);
+}
+
+/* read one file with plain system calls */
+static void
+read_file(dr_file_t *f)
+{
+  ssize_t n;
+  int fd;
+
+  if ((fd = openat(f->dirfd, f->name, O_RDONLY)) == -1)
+    err(1, "%s: openat: %s", __func__, f->name);
+  if ((n = read(fd, f->buf, f->size - 1)) == -1)
+    err(1, "%s: read: %s", __func__, f->name);
+  if (close(fd) == -1)
+    err(1, "%s: close", __func__);
+
+  f->buf[n] = '\0';
+  f->len = n;
+}
+
+/* read the files of every batch until the reader is closed, run by each thread */
+static void *
+worker(void *arg)
+{
+  descread_t *dr = arg;
+  dr_file_t *f;
+
+  for (;;) {
+    if ((errno = pthread_mutex_lock(&dr->mtx)) != 0)
+      err(1, "%s: pthread_mutex_lock", __func__);
+    while (!dr->quit && dr->next >= dr->n)
+      if ((errno = pthread_cond_wait(&dr->work, &dr->mtx)) != 0)
+        err(1, "%s: pthread_cond_wait", __func__);
+    if (dr->next >= dr->n) {
+      if ((errno = pthread_mutex_unlock(&dr->mtx)) != 0)
+        err(1, "%s: pthread_mutex_unlock", __func__);
+      break;
+    }
+    f = &dr->files[dr->next++];
+    if ((errno = pthread_mutex_unlock(&dr->mtx)) != 0)
+      err(1, "%s: pthread_mutex_unlock", __func__);
+
+    read_file(f);
+
+    if ((errno = pthread_mutex_lock(&dr->mtx)) != 0)
+      err(1, "%s: pthread_mutex_lock", __func__);
+    if (++dr->done == dr->n)
+      if ((errno = pthread_cond_signal(&dr->idle)) != 0)
+        err(1, "%s: pthread_cond_signal", __func__);
+    if ((errno = pthread_mutex_unlock(&dr->mtx)) != 0)
+      err(1, "%s: pthread_mutex_unlock", __func__);
+  }
+
+  return NULL;
+}
+
+#ifdef __linux__
+/*
+ * Set up an io_uring with a table of DRMAXBATCH direct descriptors. Requires
+ * skipping successful completions, which came after direct descriptors could
+ * be opened and closed.
+ *
+ * Return 0 on success, -1 if io_uring can't be used.
+ */
+static int
+uring_open(descread_t *dr)
+{
+  struct io_uring_params p;
+  unsigned workers[2];
+  int fds[DRMAXBATCH];
+  size_t i;
+
+  memset(&p, 0, sizeof(p));
+  if ((dr->ring = syscall(__NR_io_uring_setup, 4 * DRMAXBATCH, &p)) == -1) {
+    log_warn("%s: io_uring_setup", __func__);
+    return -1;
+  }
+
+  if (!(p.features & IORING_FEAT_CQE_SKIP) || !(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    log_warnx("%s: io_uring lacks features: %x", __func__, p.features);
+    close(dr->ring);
+    return -1;
+  }
+
+  /* with a single mmap the completion ring shares the map of the submissions */
+  dr->sqmaplen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  dr->cqmaplen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (dr->cqmaplen > dr->sqmaplen)
+    dr->sqmaplen = dr->cqmaplen;
+  dr->sqeslen = p.sq_entries * sizeof(struct io_uring_sqe);
+
+  dr->sqmap = mmap(NULL, dr->sqmaplen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, dr->ring, IORING_OFF_SQ_RING);
+  if (dr->sqmap == MAP_FAILED)
+    err(1, "%s: mmap", __func__);
+  dr->cqmap = dr->sqmap;
+  dr->sqes = mmap(NULL, dr->sqeslen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, dr->ring, IORING_OFF_SQES);
+  if (dr->sqes == MAP_FAILED)
+    err(1, "%s: mmap", __func__);
+
+  dr->sqtail = (unsigned *)((char *)dr->sqmap + p.sq_off.tail);
+  dr->sqmask = (unsigned *)((char *)dr->sqmap + p.sq_off.ring_mask);
+  dr->sqarray = (unsigned *)((char *)dr->sqmap + p.sq_off.array);
+  dr->cqhead = (unsigned *)((char *)dr->cqmap + p.cq_off.head);
+  dr->cqtail = (unsigned *)((char *)dr->cqmap + p.cq_off.tail);
+  dr->cqmask = (unsigned *)((char *)dr->cqmap + p.cq_off.ring_mask);
+  dr->cqes = (struct io_uring_cqe *)((char *)dr->cqmap + p.cq_off.cqes);
+
+  /* an empty table, every file of a batch gets its own slot */
+  for (i = 0; i < DRMAXBATCH; i++)
+    fds[i] = -1;
+  if (syscall(__NR_io_uring_register, dr->ring, IORING_REGISTER_FILES, fds, DRMAXBATCH) == -1) {
+    log_warn("%s: io_uring_register", __func__);
+    uring_close(dr);
+    return -1;
+  }
+
+  /* opening files that are not cached blocks, more workers read more at once */
+  workers[0] = DRWORKERS;
+  workers[1] = 0;
+  if (syscall(__NR_io_uring_register, dr->ring, IORING_REGISTER_IOWQ_MAX_WORKERS, workers, 2) == -1)
+    log_warn("%s: io_uring_register workers", __func__);
+
+  return 0;
+}
+
+static void
+uring_close(descread_t *dr)
+{
+  if (munmap(dr->sqes, dr->sqeslen) == -1)
+    err(1, "%s: munmap", __func__);
+  if (munmap(dr->sqmap, dr->sqmaplen) == -1)
+    err(1, "%s: munmap", __func__);
+  if (close(dr->ring) == -1)
+    err(1, "%s: close", __func__);
+}
+
+/*
+ * Submit an open, read and close of every file of the batch. The reads and
+ * closes post a completion, an open only if it fails, which cancels the rest
+ * of its chain. The slot of a file can only be reused once its close is
+ * completed.
+ */
+static void
+uring_start(descread_t *dr)
+{
+  struct io_uring_sqe *sqe;
+  dr_file_t *f;
+  unsigned tail, mask;
+  size_t i;
+  long r;
+
+  tail = *dr->sqtail;
+  mask = *dr->sqmask;
+
+  for (i = 0; i < dr->n; i++) {
+    f = &dr->files[i];
+
+    sqe = &dr->sqes[tail & mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+    sqe->fd = f->dirfd;
+    sqe->addr = (unsigned long)f->name;
+    sqe->open_flags = O_RDONLY;
+    sqe->file_index = i + 1;
+    sqe->user_data = 2 * i;
+    dr->sqarray[tail & mask] = tail & mask;
+    tail++;
+
+    sqe = &dr->sqes[tail & mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->flags = IOSQE_IO_HARDLINK | IOSQE_FIXED_FILE; /* a short read would break a normal link */
+    sqe->fd = i;
+    sqe->addr = (unsigned long)f->buf;
+    sqe->len = f->size - 1;
+    sqe->off = 0;
+    sqe->user_data = 2 * i;
+    dr->sqarray[tail & mask] = tail & mask;
+    tail++;
+
+    sqe = &dr->sqes[tail & mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = i + 1;
+    sqe->user_data = 2 * i + 1;
+    dr->sqarray[tail & mask] = tail & mask;
+    tail++;
+  }
+
+  /* the kernel may see the new entries once the tail moves */
+  __atomic_store_n(dr->sqtail, tail, __ATOMIC_RELEASE);
+
+  dr->pending = 2 * dr->n;
+
+  for (i = 0; i < 3 * dr->n; i += r) {
+    if ((r = syscall(__NR_io_uring_enter, dr->ring, 3 * dr->n - i, 0, 0, NULL, 0)) == -1) {
+      if (errno == EINTR) {
+        r = 0;
+        continue;
+      }
+      err(1, "%s: io_uring_enter", __func__);
+    }
+  }
+}
+
+/* collect a completion for every read and close of the batch */
+static void
+uring_wait(descread_t *dr)
+{
+  struct io_uring_cqe *cqe;
+  dr_file_t *f;
+  unsigned head, tail;
+
+  while (dr->pending > 0) {
+    head = *dr->cqhead;
+    tail = __atomic_load_n(dr->cqtail, __ATOMIC_ACQUIRE);
+
+    if (head == tail) {
+      if (syscall(__NR_io_uring_enter, dr->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) == -1)
+        if (errno != EINTR)
+          err(1, "%s: io_uring_enter", __func__);
+      continue;
+    }
+
+    for (; head != tail; head++) {
+      cqe = &dr->cqes[head & *dr->cqmask];
+      if (cqe->user_data >= 2 * dr->n)
+        errx(1, "%s: illegal completion", __func__);
+      f = &dr->files[cqe->user_data / 2];
+
+      if (cqe->res < 0) {
+        errno = -cqe->res;
+        err(1, "%s: %s", __func__, f->name);
+      }
+
+      /* user_data is odd for a close */
+      if (cqe->user_data % 2 == 0) {
+        f->buf[cqe->res] = '\0';
+        f->len = cqe->res;
+      }
+      dr->pending--;
+    }
+
+    __atomic_store_n(dr->cqhead, head, __ATOMIC_RELEASE);
+  }
+}
+#endif
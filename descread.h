@@ -0,0 +1,49 @@
+#ifndef DESCREAD_H
+#define DESCREAD_H
+
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+/* maximum number of files in one batch */
+#define DRMAXBATCH 1024
+
+/* number of threads that read files if io_uring is not available */
+#define NREADERS 4
+
+/* maximum number of kernel threads that io_uring may block on files */
+#define DRWORKERS 16
+
+/* a file to read, see dr_start() */
+typedef struct {
+  int dirfd; /* open descriptor of the directory of the file */
+  const char *name;
+  char *buf; /* receives the contents, null terminated */
+  size_t size; /* size of buf, at most size - 1 bytes are read */
+  size_t len; /* number of bytes read */
+} dr_file_t;
+
+/* a reader of batches of files, see dr_open() */
+typedef struct descread descread_t;
+
+descread_t *dr_open(void);
+void dr_start(descread_t *dr, dr_file_t *files, size_t n);
+void dr_wait(descread_t *dr);
+const char *dr_method(const descread_t *dr);
+void dr_close(descread_t *dr);
+
+#endif
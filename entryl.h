@@ -31,6 +31,7 @@ typedef struct {
 
 enum lprompt { LERROR = -1, LSAVE, LCANCEL, LDELETE };
 
+int entryl_date(WINDOW *w, time_t *res, const char *label, time_t def);
 int entryl(entryl_t *el, size_t line, const char *proj, const char **tab_proj, const time_t start, const time_t end, const char *dataroot, const char *fname, int proj_opt);
 
 #endif
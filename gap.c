@@ -0,0 +1,262 @@
+#include "gap.h"
+
+/*
+ * State of a running report, only used via gap_report(). Each entry is only
+ * compared with the end of the previously seen entries so a report runs in
+ * constant memory.
+ */
+struct report {
+  FILE *fp;
+  time_t from;    /* start of the reported range */
+  time_t to;      /* end of the reported range */
+  time_t covered; /* everything before this time is tracked or reported */
+  time_t day;     /* local midnight of the day that is being summed */
+  time_t daymin;  /* untracked minutes on day */
+  time_t total;   /* untracked minutes in the whole range */
+};
+
+static time_t day_at(const time_t day, const int min);
+static time_t work_minutes(time_t a, time_t b);
+static void flush_days(struct report *rep, const time_t upto);
+static void add_gap(struct report *rep, time_t a, time_t b);
+
+/* working hours in minutes since local midnight */
+static int wstart = WORKSTART, wend = WORKEND;
+
+/*
+ * Set working hours from a string in the form hh:mm-hh:mm.
+ *
+ * Return 0 on success, -1 on error.
+ */
+int
+gap_set_hours(const char *spec)
+{
+  int sh, sm, eh, em;
+  char c;
+
+  if (sscanf(spec, "%2d:%2d-%2d:%2d%c", &sh, &sm, &eh, &em, &c) != 4)
+    return -1;
+
+  if (sh < 0 || sh > 24 || sm < 0 || sm > 59)
+    return -1;
+  if (eh < 0 || eh > 24 || em < 0 || em > 59)
+    return -1;
+  if (sh * 60 + sm >= eh * 60 + em || eh * 60 + em > 24 * 60)
+    return -1;
+
+  wstart = sh * 60 + sm;
+  wend = eh * 60 + em;
+
+  return 0;
+}
+
+/*
+ * Report all gaps within working hours between consecutive entries that start
+ * in the range [from, to) in one pass over the D index. Each gap is printed on
+ * its own line, followed by the number of untracked minutes per day and a
+ * grand total that is labelled with the first and the last day of the range.
+ *
+ * Return 0 on success, -1 on error.
+ */
+int
+gap_report(idx_t *idx, FILE *fp, time_t from, time_t to)
+{
+  struct report rep;
+  idx_cursor_t cur;
+  idx_entry_t ents[IDXBATCH];
+  char sdout[64], edout[64];
+  time_t last;
+  int i, n;
+
+  if (from >= to)
+    return -1;
+
+  rep.fp = fp;
+  rep.from = from;
+  rep.to = to;
+  rep.covered = from;
+  rep.day = day_start(from, 0);
+  rep.daymin = 0;
+  rep.total = 0;
+
+  /* entries that are active at the start of the range cover the first part */
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    0, /* time_t maxstart; */
+    1, /* int includemin; */
+    0, /* int includemax; */
+    0, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    NULL, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    from, /* time_t at; */
+    NULL /* char **projs; */
+  };
+
+  if (idx_cursor_open(idx, &cur, &opts) != 0)
+    return -1;
+  while ((n = idx_cursor_next(&cur, ents, IDXBATCH)) > 0)
+    for (i = 0; i < n; i++)
+      rep.covered = max(rep.covered, ents[i].end);
+  idx_cursor_close(&cur);
+  if (n == -1)
+    return -1;
+
+  /* then walk all entries that start within the range */
+  opts.minstart = from;
+  opts.maxstart = to;
+  opts.at = 0;
+
+  if (idx_cursor_open(idx, &cur, &opts) != 0)
+    return -1;
+  while ((n = idx_cursor_next(&cur, ents, IDXBATCH)) > 0) {
+    for (i = 0; i < n; i++) {
+      if (ents[i].start > rep.covered)
+        add_gap(&rep, rep.covered, ents[i].start);
+      rep.covered = max(rep.covered, ents[i].end);
+    }
+  }
+  idx_cursor_close(&cur);
+  if (n == -1)
+    return -1;
+
+  add_gap(&rep, rep.covered, to);
+  flush_days(&rep, to);
+
+  /* the total is labelled with the first and the last day of the range */
+  last = to - 1;
+  if (strftime(sdout, sizeof sdout, "%a %e %b %Y", localtime(&from)) == 0)
+    errx(1, "%s: strftime", __func__);
+  if (strftime(edout, sizeof edout, "%a %e %b %Y", localtime(&last)) == 0)
+    errx(1, "%s: strftime", __func__);
+  if (fprintf(fp, "%s - %s  total untracked %3ld:%02ld\n", sdout, edout, rep.total / 60, rep.total % 60) < 0)
+    err(1, "%s: fprintf", __func__);
+
+  return 0;
+}
+
+/*
+ * Find the first key that follows a gap within working hours. Iteration
+ * starts at the given options, normally with an offset that is set to the key
+ * under the cursor.
+ *
+ * Return a copy of the key that ends the gap, or NULL if there is no gap.
+ */
+DBT *
+gap_next(idx_t *idx, const idx_itopts_t *opts)
+{
+  idx_cursor_t cur;
+  idx_entry_t ents[IDXBATCH];
+  DBT *found;
+  time_t covered;
+  int i, n;
+
+  if (idx_cursor_open(idx, &cur, opts) != 0)
+    return NULL;
+
+  /* stop at the first entry that starts after all previous entries ended */
+  covered = 0;
+  found = NULL;
+  while (found == NULL && (n = idx_cursor_next(&cur, ents, IDXBATCH)) > 0) {
+    for (i = 0; i < n; i++) {
+      if (covered && ents[i].start > covered && work_minutes(covered, ents[i].start) > 0) {
+        found = idx_cursor_key(&cur, &ents[i]);
+        break;
+      }
+      covered = max(covered, ents[i].end);
+    }
+  }
+  idx_cursor_close(&cur);
+
+  return found;
+}
+
+/*
+ * Print the part of [a, b) that lies within working hours and within the
+ * reported range, split per day.
+ */
+static void
+add_gap(struct report *rep, time_t a, time_t b)
+{
+  time_t day, ws, we;
+  char sdout[64], wsout[8], weout[8];
+
+  a = max(a, rep->from);
+  b = min(b, rep->to);
+
+  for (day = day_start(a, 0); day < b; day = day_start(day, 1)) {
+    flush_days(rep, day);
+
+    ws = max(a, day_at(day, wstart));
+    we = min(b, day_at(day, wend));
+    if (we - ws < 60)
+      continue;
+
+    if (strftime(sdout, sizeof sdout, "%a %e %b %Y", localtime(&day)) == 0)
+      errx(1, "%s: strftime day", __func__);
+    if (strftime(wsout, sizeof wsout, "%R", localtime(&ws)) == 0)
+      errx(1, "%s: strftime start", __func__);
+    if (strftime(weout, sizeof weout, "%R", localtime(&we)) == 0)
+      errx(1, "%s: strftime end", __func__);
+
+    if (fprintf(rep->fp, "%s  %s - %s     %2ld:%02ld\n", sdout, wsout, weout, (we - ws) / 3600, (we - ws) / 60 % 60) < 0)
+      err(1, "%s: fprintf", __func__);
+
+    rep->daymin += (we - ws) / 60;
+  }
+}
+
+/* print the untracked minutes of every day before upto that is not printed yet */
+static void
+flush_days(struct report *rep, const time_t upto)
+{
+  char sdout[64];
+
+  while (rep->day < upto) {
+    if (strftime(sdout, sizeof sdout, "%a %e %b %Y", localtime(&rep->day)) == 0)
+      errx(1, "%s: strftime", __func__);
+    if (fprintf(rep->fp, "%s  untracked       %3ld:%02ld\n", sdout, rep->daymin / 60, rep->daymin % 60) < 0)
+      err(1, "%s: fprintf", __func__);
+
+    rep->total += rep->daymin;
+    rep->daymin = 0;
+    rep->day = day_start(rep->day, 1);
+  }
+}
+
+/* return the number of minutes in [a, b) that lie within working hours */
+static time_t
+work_minutes(time_t a, time_t b)
+{
+  time_t day, ws, we, mins;
+
+  mins = 0;
+  for (day = day_start(a, 0); day < b; day = day_start(day, 1)) {
+    ws = max(a, day_at(day, wstart));
+    we = min(b, day_at(day, wend));
+    if (we > ws)
+      mins += (we - ws) / 60;
+  }
+
+  return mins;
+}
+
+/* return the time at min minutes after local midnight of day */
+static time_t
+day_at(const time_t day, const int min)
+{
+  struct tm bd;
+
+  if (localtime_r(&day, &bd) == NULL)
+    errx(1, "%s: localtime_r", __func__);
+
+  bd.tm_hour = min / 60;
+  bd.tm_min = min % 60;
+  bd.tm_sec = 0;
+  bd.tm_isdst = -1;
+
+  return mktime(&bd);
+}
@@ -0,0 +1,21 @@
+#ifndef GAP_H
+#define GAP_H
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "index.h"
+#include "status.h"
+
+/* default working hours in minutes since local midnight */
+#define WORKSTART (9 * 60)
+#define WORKEND (17 * 60)
+
+int gap_set_hours(const char *spec);
+int gap_report(idx_t *idx, FILE *fp, time_t from, time_t to);
+DBT *gap_next(idx_t *idx, const idx_itopts_t *opts);
+
+#endif
@@ -1,54 +1,227 @@
 #include "index.h"
 
-static int walk_datadir(char *idxpath, int(*cb)(const char proj[MAXPROJ], char *file, DBT **pkey, DBT **dkey));
+/* a P range of one project that is read in batches, used for merging */
+struct prange {
+  const char *proj;
+  size_t projlen;
+  time_t lo; /* minimum start time, inclusive */
+  time_t hi; /* maximum start time, exclusive, 0 means no maximum */
+  int reverse;
+  char keys[MERGEBUF][MAXKEYSIZE];
+  size_t sizes[MERGEBUF];
+  size_t nkeys; /* number of keys in the buffer */
+  size_t next; /* index of the next key in the buffer */
+  int done; /* whether there are no more keys after the buffer */
+};
+
+/* a term of a search query, see idx_search() */
+struct qterm {
+  char s[MAXDESC + 1]; /* in lower case */
+  size_t len;
+  int substr; /* whether s may occur anywhere, otherwise it must start a word */
+};
+
+/* a project file in the data dir, see walk_datadir() */
+struct dfile {
+  size_t proj; /* index in the project list */
+  char name[30];
+};
+
+/* a dkey and the new place of its description, see store_compact() */
+struct skey {
+  char key[MAXKEYSIZE];
+  size_t size;
+  uint32_t off;
+  uint32_t len;
+};
+
+/* a pack of project files in the data dir, see walk_datadir() */
+struct dpack {
+  size_t proj; /* index in the project list */
+  char name[PACKNAMESIZE];
+};
+
+#ifdef __linux__
+/* a directory entry as returned by getdents64(2) */
+struct dent64 {
+  uint64_t d_ino;
+  int64_t d_off;
+  unsigned short d_reclen;
+  unsigned char d_type;
+  char d_name[];
+};
+#endif
+
+/* a directory that is read in large chunks, see dscan_open() */
+struct dscan {
+#ifdef __linux__
+  int fd;
+  char *buf;
+  size_t len; /* number of bytes in buf */
+  size_t off; /* offset of the next entry in buf */
+#else
+  DIR *dir;
+#endif
+};
+
+static int walk_datadir(idx_t *idx, int(*cb)(idx_t *idx, const char proj[MAXPROJ], char *file, const char *desc, DBT **pkey, DBT **dkey));
+static size_t batch_fill(dr_file_t *batch, char (*paths)[FILEPATH], const struct dfile *files, size_t nfiles, size_t from, char **projs, int dirfd);
+static void dscan_open(struct dscan *ds, int fd);
+static int dscan_next(struct dscan *ds, const char **name, int *type);
+static void dscan_close(struct dscan *ds);
+static int is_entry_name(const char *name);
+static size_t desc_read(idx_t *idx, const char *proj, const char *file, char *desc);
+static const char *packed_get(idx_t *idx, int pfd, const char *proj, const char *file, size_t *size);
+static void drop_pack(idx_t *idx);
+static size_t next_word(const char **s, char *word, size_t wordsize);
+static void words_update(idx_t *idx, const char *desc, const DBT *dkey, int add);
+static void grams_update(idx_t *idx, const char *desc, const DBT *dkey, int add);
+static void grams_flush(idx_t *idx);
+static int gramcmp(const void *a, const void *b);
+static int filecmp(const void *a, const void *b);
+static size_t gram_split(const uint32_t *starts, size_t n, size_t want);
+static void gkey_make(DBT *key, char *data, const char *tri, const uint32_t first);
+static void block_put(idx_t *idx, const char *tri, const uint32_t *starts, size_t n);
+static uint32_t *block_reserve(idx_t *idx, size_t n);
+static uint32_t *block_decode(idx_t *idx, const DBT *key, const DBT *data, size_t *n);
+static int block_get(idx_t *idx, const char *tri, const uint32_t t, uint32_t **starts, size_t *n);
+static int block_after(idx_t *idx, const char *tri, const uint32_t t, uint32_t **starts, size_t *n);
+static void gram_add(idx_t *idx, const char *tri, const uint32_t start);
+static void gram_del(idx_t *idx, const char *tri, const uint32_t start);
+static int gram_next(idx_t *idx, const char *tri, const uint32_t t, int reverse, uint32_t *res);
+static int term_next(idx_t *idx, const struct qterm *term, const DBT *pos, int incl, int reverse, DBT *res, char *resdata);
+static int substr_next(idx_t *idx, const char *sub, size_t sublen, const DBT *pos, int incl, int reverse, DBT *res, char *resdata);
+static int substr_verify(idx_t *idx, const char *sub, const uint32_t start, const DBT *pos, int incl, int reverse, DBT *res, char *resdata);
+static void lower(char *s, size_t n);
+static int tkey_make(DBT *key, char *data, const size_t datasize, const char *word, const size_t wordlen, const DBT *dkey);
+static int word_next(idx_t *idx, const char *word, size_t wordlen, const DBT *pos, int incl, int reverse, DBT *res, char *resdata);
+static int prefix_next(idx_t *idx, const char *prefix, size_t prefixlen, const DBT *pos, int incl, int reverse, DBT *res, char *resdata);
 static int key_within_bounds(const DBT *key);
 static int is_d(const DBT *key);
 static int is_p(const DBT *key);
+static int is_f(const DBT *key);
+static int key_family(const DBT *key);
 static char *pkey_proj(const DBT *key);
 static time_t pkey_start(const DBT *key);
 static time_t pkey_end(const DBT *key);
 static char *dkey_proj(const DBT *key);
 static time_t dkey_start(const DBT *key);
 static time_t dkey_end(const DBT *key);
+static char *fkey_proj(const DBT *key);
+static time_t fkey_start(const DBT *key);
+static time_t fkey_end(const DBT *key);
 static int in_drange(const DBT *key);
 static int in_prange(const DBT *key);
+static int in_frange(const DBT *key);
 static int timetostr(char *dst, const time_t src, const size_t dstsize);
+static int strtotime(const char *src, time_t *dst);
+static long days_from_civil(long y, int m, int d);
+static void civil_from_days(long days, long *y, int *m, int *d);
 static int prange_start(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t min);
 static int prange_end(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t max);
 static int drange_start(DBT *key, char *data, const size_t datasize, const time_t min);
 static int drange_end(DBT *key, char *data, const size_t datasize, const time_t max);
+static int frange_start(DBT *key, char *data, const size_t datasize, const time_t min);
+static int frange_end(DBT *key, char *data, const size_t datasize, const time_t max);
 static int pkey_make(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t start, const time_t end);
 static int dkey_make(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t start, const time_t end);
+static int fkey_make(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t start, const time_t end);
+static int make_filename(char *dst, const time_t start, const time_t end, size_t dstlen);
 static int dtopkey(DBT *pkey, char *pkeydata, const DBT *dkey, size_t pkeydatalen);
+static int dtofkey(DBT *fkey, char *fkeydata, const DBT *dkey, size_t fkeydatalen);
+static int todkey(DBT *dkey, char *dkeydata, const DBT *key, size_t dkeydatalen);
+static int topkey(DBT *pkey, char *pkeydata, const DBT *key, size_t pkeydatalen);
+static int tofkey(DBT *fkey, char *fkeydata, const DBT *key, size_t fkeydatalen);
 static size_t proj_len(const DBT *key);
-static void free_uniq_proj(void);
-static int idx_put(const char proj[MAXPROJ], char *file, DBT **pkey, DBT **dkey);
-static int idx_del(const DBT *dkey, const DBT *pkey);
-static int project_exists(const char *name);
-static int ensure_project_exists(const char name[MAXPROJ]);
-static void iterate(const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t skip, int reverse, int (*cb)(DBT *), DBT **last_seen);
-
-/* used for global summation of minutes in index */
-static double mtotal;
-/* used for global counting of entries */
-static int ecount;
-
-/* used for finding all uniq project names */
-static char **proj_names = NULL;
-static size_t proj_name_next = 0;
-
-static char p[PATH_MAX] = "";
-static struct {
-  char *str;
-  int len;
-  int fd;
-} datapath = {
-  p,
-  0,
-  -1
-};
+static void free_uniq_proj(idx_t *idx);
+static int idx_put(idx_t *idx, const char proj[MAXPROJ], char *file, const char *desc, DBT **pkey, DBT **dkey);
+static int idx_del(idx_t *idx, const DBT *dkey, const DBT *pkey);
+static int del_by_key(idx_t *idx, const DBT *key);
+static int project_exists(idx_t *idx, const char *name);
+static int ensure_project_exists(idx_t *idx, const char name[MAXPROJ]);
+static int meta_get(idx_t *idx, const char name, uint32_t *val);
+static int meta_put(idx_t *idx, const char name, const uint32_t val);
+static int val_get(idx_t *idx, const DBT *key, uint32_t *val);
+static int val_put(idx_t *idx, const DBT *key, const uint32_t val);
+static void stats_add(idx_t *idx, const char *proj, const size_t projlen, const time_t start, const int delta);
+static void stat_add(idx_t *idx, const DBT *key, const int delta);
+static size_t stat_total(idx_t *idx);
+static size_t stat_proj(idx_t *idx, idx_plan_t *plan, const char *proj);
+static size_t stat_days(idx_t *idx, idx_plan_t *plan, const time_t lo, const time_t hi, const size_t cap);
+static int plan_opts(idx_t *idx, idx_plan_t *plan, const idx_itopts_t *opts);
+static void plan_desc(char *dst, size_t dstsize, const idx_plan_t *plan);
+static void start_window(idx_t *idx, const idx_itopts_t *opts, time_t *lo, time_t *hi);
+static void end_window(idx_t *idx, const idx_itopts_t *opts, time_t *lo, time_t *hi);
+static int open_reader(idx_t *idx, const char *idxpath);
+static void open_writer(idx_t *idx, const char *idxpath, int ensure_new);
+static int store_open(idx_t *idx, const char *idxpath, int flags);
+static void store_map(idx_t *idx, size_t size);
+static void store_put(idx_t *idx, const char *desc, size_t len, DBT *val, char *valdata);
+static const char *store_get(idx_t *idx, const DBT *val, size_t *len);
+static void store_flush(idx_t *idx);
+static void store_dead(idx_t *idx, size_t len);
+static void store_compact(idx_t *idx, const char *idxpath);
+static pid_t lock_writer(idx_t *idx);
+static void lock_byte(idx_t *idx, short type, off_t start);
+static void begin_change(idx_t *idx);
+static void end_change(idx_t *idx);
+static void mtx_lock(idx_t *idx);
+static void mtx_unlock(idx_t *idx);
+static void iterate(idx_t *idx, const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t skip, int reverse, const idx_itopts_t *match, int pkeys, int (*cb)(DBT *), DBT **last_seen);
+static int in_projs(const char *proj, char **projs);
+static int entrycmp(const DBT *key1, const DBT *key2);
+static int merge(idx_t *idx, const idx_itopts_t *opts, int (*cb)(DBT *), DBT **last_seen);
+static int cursor_init(idx_t *idx, idx_cursor_t *cur, const idx_itopts_t *opts, const idx_plan_t *plan);
+static void cursor_free(idx_cursor_t *cur);
+static int cursor_key(DBT *key, char *data, size_t datasize, int fam, const char *proj, time_t start, time_t end);
+static void cursor_entry(idx_cursor_t *cur, size_t i, const DBT *key, idx_entry_t *ent);
+static int cursor_asc(idx_cursor_t *cur, idx_entry_t *ents, size_t n);
+static int cursor_desc(idx_cursor_t *cur, idx_entry_t *ents, size_t n);
+static int cursor_merged(idx_cursor_t *cur, idx_entry_t *ents, size_t n);
+static int lexcmp(const void *a, size_t asize, const void *b, size_t bsize);
+static int key_matches(const DBT *key, const idx_itopts_t *opts);
+static size_t prange_fill(idx_cursor_t *cur, struct prange *pr);
+static int prange_cmp(const struct prange *pr1, const struct prange *pr2);
+static void heap_down(struct prange **heap, size_t n, size_t i);
 
-static DB *idx;
+/*
+ * An open index. The db and everything that is read from it is only accessed
+ * while holding mtx, so a handle can be shared by multiple threads. The data
+ * path does not change after idx_open().
+ */
+struct idx {
+  DB *db;
+  pthread_mutex_t mtx;
+  char datapath[PATH_MAX]; /* always ends with a "/" */
+  int dplen;
+  int dpfd; /* open descriptor of the data dir */
+  int lockfd; /* open descriptor of the lock file */
+  int readonly;
+  uint32_t maxdur; /* the longest duration of any entry, bounds "active at" and overlap scans */
+  idx_plan_t plan; /* the access path of the last iteration */
+  char plandesc[200]; /* description of plan, see idx_last_plan() */
+  char rebuilddesc[200]; /* description of the last rebuild, see idx_last_rebuild() */
+  char **proj_names; /* all uniq project names, see idx_uniq_proj() */
+  size_t proj_name_next;
+  int bulk; /* whether trigrams are collected in grams instead of written */
+  uint64_t *grams; /* trigram and start time pairs, see grams_flush() */
+  size_t ngrams;
+  size_t gramsize;
+  uint32_t *block; /* start dates of a block of a posting list, see block_decode() */
+  size_t blocksize;
+  unsigned char *blockbuf; /* an encoded block, see block_put() */
+  size_t blockbufsize;
+  pack_t *pack; /* the last read pack, see packed_get() */
+  char packproj[MAXPROJ];
+  char packname[PACKNAMESIZE];
+  int storefd; /* open descriptor of the description store, see store_put() */
+  char *store; /* mapping of the store */
+  size_t storemap; /* size of the mapping */
+  uint32_t storeend; /* offset of the next description in the store */
+  uint32_t storedead; /* number of bytes of removed descriptions */
+  char *storebuf; /* descriptions that are not written yet while bulk is set */
+  size_t storebuflen;
+};
 
 /*
  * Key formats. An uint32be is in network byte order or big endian.
@@ -57,6 +230,12 @@ static DB *idx;
  * subkey   ::=
  *            |  pkey                     Project key, always starts with "P"
  *            |  dkey                     Date key, always starts with "D"
+ *            |  fkey                     Finish key, always starts with "F"
+ *            |  tkey                     Term key, always starts with "T"
+ *            |  gkey                     Trigram key, always starts with "G"
+ *            |  nstat                    Number of entries per project
+ *            |  mstat                    Number of entries per day
+ *            |  meta                     Index metadata
  * pkey     ::=  "\x50" string time time  "P" followed by the project name, then
  *                                        the start date and then the end date.
  *                                        Maps to a unique filename. "P" is in
@@ -65,6 +244,37 @@ static DB *idx;
  *                                        and at last the project name. Maps to
  *                                        a unique filename. "D" is in big
  *                                        endian.
+ * fkey     ::=  "\x46" time time string  "F" followed by an end date, start date
+ *                                        and at last the project name. Maps to
+ *                                        a unique filename. "F" is in big
+ *                                        endian.
+ * tkey     ::=  "\x54" string dkey       "T" followed by a word of the
+ *                                        description of an entry, in lower
+ *                                        case, and the dkey of the entry.
+ * gkey     ::=  "\x47" byte byte byte time
+ *                                        "G" followed by three bytes of the
+ *                                        description of entries, in lower
+ *                                        case, and the start date of the
+ *                                        first entry of the block. Value is a
+ *                                        block of the posting list of the
+ *                                        trigram.
+ * nstat    ::=  "\x4e" [string]          "N" optionally followed by a project
+ *                                        name, value is an uint32be with the
+ *                                        number of entries of the project or
+ *                                        of all projects.
+ * mstat    ::=  "\x4d" uint32be          "M" followed by the number of days
+ *                                        since epoch, value is an uint32be
+ *                                        with the number of entries that
+ *                                        start on that UTC day.
+ * meta     ::=  "\x56"                   "V" the version of the index format,
+ *                                        value is an uint32be.
+ *               "\x57"                   "W" the longest duration of any entry
+ *                                        in seconds, value is an uint32be.
+ *               "\x53"                   "S" the size of the description store
+ *                                        in use, value is an uint32be.
+ *               "\x58"                   "X" the number of bytes in the
+ *                                        description store of removed
+ *                                        descriptions, value is an uint32be.
  * string   ::=  (byte+) "\x00"           String - (byte+) is one or more ASCII
  *                                        encoded characters and must not
  *                                        contain a '\x00' or '\x01' byte.
@@ -78,948 +288,4240 @@ static DB *idx;
  *                                        UTC date and time separated by an
  *                                        underscore, yielding 29 chars. Each
  *                                        file is located in a directory that
- *                                        represents the project name.
+ *                                        represents the project name, or in a
+ *                                        pack in that directory, see
+ *                                        pack_open().
+ *
+ * The pkeys, fkeys and tkeys have no values since all the data is in the keys.
+ * The value of a dkey is the offset and the length of the description of the
+ * entry in the description store, both uint32be. The store is a file next to
+ * the index that holds the first MAXDESC bytes of every description, so that a
+ * description can be read from memory. Descriptions are only appended, the
+ * store is compacted when the writer opens the index and more than half of it
+ * is removed descriptions. The tkeys of a word are in the order of the D index,
+ * see idx_search().
+ * The posting list of a trigram holds the start date of every entry with the
+ * trigram in its description, in ascending order. It is split in blocks of
+ * about GRAMBLOCK start dates, the value of a gkey is the difference of every
+ * start date in the block with the previous one as an unsigned LEB128 number,
+ * starting at the start date in the key. A start date never spans two blocks,
+ * so a block of many entries with the same start date can be larger.
+ * The statistics are used to choose the cheapest index for an iteration.
+ * The index is rebuilt if the stored version differs from IDXVERSION.
+ *
+ * All families are kept in one btree. The D, F and M keys are ordered by time
+ * and the P keys by time within a project, so an iteration over a date range
+ * only reads the pages of that range and the few above it, no matter how many
+ * years the index spans. Splitting the index in segments by year would not make
+ * those iterations cheaper, but every word and trigram lookup would have to be
+ * repeated in each segment.
  *
- * The keys have no values since all the data is in the keys.
+ * Short descriptions are not kept in the value of their dkey either. Reading
+ * one from the store costs no more than reading it from the value, while the
+ * longer values spread the D index over more pages, which every iteration
+ * over a date range reads.
  */
 
 /*
  * Open a new or existing btree and ensure it contains indices for all files.
- * Initializes local copy of a db and datapath. It is ensured that datapath ends
- * with a trailing "/". Furthermore the file is locked for writing.
+ * Initializes a handle with the db and datapath. It is ensured that datapath
+ * ends with a trailing "/".
  *
- * Return 0 on succes, -1 on error.
+ * Access is coordinated with other processes by locks on a lock file next to
+ * the index. There can only be one writer at a time, which only locks out
+ * readers while it opens the index or saves a change. A read-only handle holds
+ * a shared lock until it is closed, so it sees a consistent snapshot but also
+ * delays the changes of a writer, read-only handles should be short lived. If
+ * the index does not exist yet or was created by another version, a reader
+ * builds it as a writer first. If another process is the writer, a reader waits
+ * until it is done opening the index instead, and exits if the index still
+ * needs to be rebuilt.
+ *
+ * Return a pointer to the new handle on success, or NULL on error.
  */
-int
-idx_open(char *dp, char *idxpath, int ensure_new)
+idx_t *
+idx_open(const char *dp, const char *idxpath, int ensure_new, int readonly)
 {
-  int fd, flags;
-  int created = 0;
-  struct flock lock;
+  idx_t *idx;
+  char lockpath[PATH_MAX];
+  pid_t pid;
 
-  flags = 0 | O_RDWR;
-  if (ensure_new)
-    flags |= O_TRUNC;
+  if ((idx = calloc(1, sizeof(*idx))) == NULL) {
+    log_warnx("%s: calloc", __func__);
+    return NULL;
+  }
 
-  if ((datapath.len = strlcpy(datapath.str, dp, PATH_MAX)) > PATH_MAX)
+  if ((errno = pthread_mutex_init(&idx->mtx, NULL)) != 0)
+    err(1, "%s: pthread_mutex_init", __func__);
+
+  idx->storefd = -1;
+
+  if ((idx->dplen = strlcpy(idx->datapath, dp, PATH_MAX)) > PATH_MAX)
     err(1, "%s strlcpy", __func__);
   // ensure trailing "/"
-  if (datapath.str[datapath.len] != '\0')
+  if (idx->datapath[idx->dplen] != '\0')
     errx(1, "%s: expected null-byte in datapath", __func__);
-  if (datapath.str[datapath.len - 1] != '/') {
-    if (datapath.len + 1 >= PATH_MAX)
+  if (idx->datapath[idx->dplen - 1] != '/') {
+    if (idx->dplen + 1 >= PATH_MAX)
       errx(1, "%s: datapath too small for trailing '/'", __func__);
     // append "/"
-    datapath.str[datapath.len++] = '/';
-    datapath.str[datapath.len++] = '\0';
+    idx->datapath[idx->dplen++] = '/';
+    idx->datapath[idx->dplen] = '\0';
   }
 
   /* ensure a data dir exists */
-  if (mkdir(datapath.str, 0700) == -1)
+  if (mkdir(idx->datapath, 0700) == -1)
     if (errno != EEXIST)
       err(1, "%s: mkdir", __func__);
 
   /* save an open descriptor to the datadir */
-  if ((datapath.fd = open(datapath.str, O_RDONLY)) == -1)
+  if ((idx->dpfd = open(idx->datapath, O_RDONLY)) == -1)
     err(1, "%s: open", __func__);
 
-  /* open a btree for writing */
-  if ((idx = dbopen(idxpath, flags, 0600, DB_BTREE, NULL)) == NULL) {
-    if (errno == ENOENT) { /* retry with O_CREAT */
-      if ((idx = dbopen(idxpath, flags | O_CREAT, 0600, DB_BTREE, NULL)) == NULL)
-        err(1, "%s: dbopen: %s", __func__, idxpath);
-      created = 1;
+  if (strlcpy(lockpath, idxpath, sizeof lockpath) >= sizeof lockpath)
+    errx(1, "%s: lock path too long", __func__);
+  if (strlcat(lockpath, LOCKSUFFIX, sizeof lockpath) >= sizeof lockpath)
+    errx(1, "%s: lock path too long", __func__);
+  if ((idx->lockfd = open(lockpath, O_RDWR | O_CREAT, 0600)) == -1)
+    err(1, "%s: open: %s", __func__, lockpath);
+
+  idx->readonly = readonly;
+
+  if (!readonly || ensure_new || open_reader(idx, idxpath) == -1) {
+    if ((pid = lock_writer(idx)) != 0) {
+      if (!readonly)
+        errx(1, "already running: %d", pid);
+
+      /* the data lock is released once the writer has built the index */
+      if (!ensure_new && open_reader(idx, idxpath) == 0)
+        return idx;
+      errx(1, "the index needs a rebuild, quit the running uren first: %d", pid);
+    }
+
+    open_writer(idx, idxpath, ensure_new);
+
+    /* let readers in, a reader keeps a shared lock and lets other writers in */
+    if (readonly) {
+      lock_byte(idx, F_RDLCK, DATALOCK);
+      lock_byte(idx, F_UNLCK, WRITERLOCK);
     } else {
-      err(1, "%s: dbopen: %s", __func__, idxpath);
+      lock_byte(idx, F_UNLCK, DATALOCK);
     }
   }
 
-  /* and lock it */
-  if ((fd = idx->fd(idx)) == -1)
-    err(1, "%s: idx->fd", __func__);
+  return idx;
+}
 
-  lock.l_type = F_WRLCK;
-  lock.l_whence = SEEK_SET;
-  lock.l_start = 0;
-  lock.l_len = 0;
+/*
+ * Open an existing index for reading while holding a shared lock.
+ *
+ * Return 0 on success, -1 if the index must be built first.
+ */
+static int
+open_reader(idx_t *idx, const char *idxpath)
+{
+  uint32_t version;
 
-  if (fcntl(fd, F_GETLK, &lock) == -1)
-    err(1, "%s: fcntl", __func__);
+  lock_byte(idx, F_RDLCK, DATALOCK);
 
-  if (lock.l_type != F_UNLCK)
-    errx(1, "already running: %d", lock.l_pid);
+  if ((idx->db = dbopen(idxpath, O_RDONLY, 0600, DB_BTREE, NULL)) == NULL) {
+    if (errno != ENOENT)
+      log_warnx("%s: dbopen: %s", __func__, idxpath);
+    lock_byte(idx, F_UNLCK, DATALOCK);
+    return -1;
+  }
 
-  lock.l_type = F_WRLCK;
-  if (fcntl(fd, F_SETLK, &lock) == -1)
-    err(1, "%s: fcntl failed to lock db", __func__);
+  if (meta_get(idx, 'V', &version) != 0 || version != IDXVERSION) {
+    if (idx->db->close(idx->db) == -1)
+      err(1, "%s: idx->close", __func__);
+    lock_byte(idx, F_UNLCK, DATALOCK);
+    return -1;
+  }
 
-  if (created)
-    if (walk_datadir(idxpath, idx_put) < 0)
-      errx(1, "%s: can't initialize index", __func__);
+  if (meta_get(idx, 'W', &idx->maxdur) == -1)
+    errx(1, "%s: can't read longest duration", __func__);
+
+  if (store_open(idx, idxpath, O_RDONLY) == -1) {
+    if (idx->db->close(idx->db) == -1)
+      err(1, "%s: idx->close", __func__);
+    lock_byte(idx, F_UNLCK, DATALOCK);
+    return -1;
+  }
 
   return 0;
 }
 
 /*
- * Close a db.
- *
- * Return 0 on success, -1 on error.
+ * Open a new or existing index for writing, and rebuild it if it was created by
+ * another version. The caller must hold the writer lock. On return the caller
+ * also holds an exclusive lock on the data.
  */
-void
-idx_close(void)
+static void
+open_writer(idx_t *idx, const char *idxpath, int ensure_new)
 {
-  if (close(datapath.fd) == -1)
-    err(1, "%s: close", __func__);
-  if (idx->close(idx) == -1)
-    err(1, "%s: idx->close", __func__);
+  int flags;
+  int created = 0;
+  uint32_t version;
+
+  flags = 0 | O_RDWR;
+  if (ensure_new)
+    flags |= O_TRUNC;
+
+  lock_byte(idx, F_WRLCK, DATALOCK);
+
+  /* open a btree for writing */
+  if ((idx->db = dbopen(idxpath, flags, 0600, DB_BTREE, NULL)) == NULL) {
+    if (errno == ENOENT) { /* retry with O_CREAT */
+      if ((idx->db = dbopen(idxpath, flags | O_CREAT, 0600, DB_BTREE, NULL)) == NULL)
+        err(1, "%s: dbopen: %s", __func__, idxpath);
+      created = 1;
+    } else {
+      err(1, "%s: dbopen: %s", __func__, idxpath);
+    }
+  }
+
+  /* start over if the index was created by another version or lost its store */
+  if (!created && (meta_get(idx, 'V', &version) != 0 || version != IDXVERSION || store_open(idx, idxpath, O_RDWR) == -1)) {
+    log_warnx("%s: rebuild index", __func__);
+    if (idx->db->close(idx->db) == -1)
+      err(1, "%s: idx->close", __func__);
+    if ((idx->db = dbopen(idxpath, flags | O_TRUNC, 0600, DB_BTREE, NULL)) == NULL)
+      err(1, "%s: dbopen: %s", __func__, idxpath);
+    created = 1;
+  }
+
+  if (created) {
+    if (store_open(idx, idxpath, O_RDWR | O_CREAT | O_TRUNC) == -1)
+      errx(1, "%s: can't create description store", __func__);
+    if (walk_datadir(idx, idx_put) < 0)
+      errx(1, "%s: can't initialize index", __func__);
+    if (meta_put(idx, 'V', IDXVERSION) != 0)
+      errx(1, "%s: can't set index version", __func__);
+    if (idx->db->sync(idx->db, 0) == -1)
+      err(1, "%s: idx->sync", __func__);
+  }
+
+  if (meta_get(idx, 'W', &idx->maxdur) == -1)
+    errx(1, "%s: can't read longest duration", __func__);
+
+  if (idx->storedead > STORECOMPACT && idx->storedead > idx->storeend / 2)
+    store_compact(idx, idxpath);
 }
 
 /*
- * Try to read every project directory and file in path and create two indices,
- * one by start date for date range queries and one by project + start date for
- * project based date range queries.
+ * Open and map the description store of the index at idxpath with flags for
+ * open(2). A new or truncated store is empty, otherwise it must be at least as
+ * large as the index expects.
  *
- * Return 1 if index is created, 0 if no directory is found or exit on failure.
+ * Return 0 on success, -1 if the store does not exist or does not match.
  */
 static int
-walk_datadir(char *idxpath, int(*cb)(const char proj[MAXPROJ], char *file, DBT **pkey, DBT **dkey))
+store_open(idx_t *idx, const char *idxpath, int flags)
 {
-  DIR *dir, *dir2;
-  struct dirent *direntry, *file;
-  int fd1, fd2;
+  struct stat st;
+  char path[PATH_MAX];
 
-  /* read all dirs in the directory */
-  if ((dir = opendir(datapath.str)) == NULL)
-    err(2, "%s: opendir", __func__);
+  if (strlcpy(path, idxpath, sizeof path) >= sizeof path)
+    errx(1, "%s: store path too long", __func__);
+  if (strlcat(path, STORESUFFIX, sizeof path) >= sizeof path)
+    errx(1, "%s: store path too long", __func__);
 
-  if ((fd1 = dirfd(dir)) == -1)
-    err(1, "%s: dirfd", __func__);
+  if ((idx->storefd = open(path, flags | O_CLOEXEC, 0600)) == -1) {
+    if (errno != ENOENT)
+      err(1, "%s: open: %s", __func__, path);
+    return -1;
+  }
 
-  /* iterate over data dir, expect project directories */
-  while ((direntry = readdir(dir)) != NULL) {
-    /* skip hidden files, . and .. */
-    if (direntry->d_name[0] == '.')
-      continue;
+  if (flags & O_TRUNC) {
+    idx->storeend = 0;
+    idx->storedead = 0;
+    if (meta_put(idx, 'S', 0) != 0 || meta_put(idx, 'X', 0) != 0)
+      errx(1, "%s: meta_put", __func__);
+  } else if (meta_get(idx, 'S', &idx->storeend) != 0 || meta_get(idx, 'X', &idx->storedead) != 0) {
+    log_warnx("%s: no store size: %s", __func__, path);
+    goto mismatch;
+  }
 
-    if ((fd2 = openat(fd1, direntry->d_name, O_RDONLY)) == -1)
-      err(1, "%s: openat %s", __func__, direntry->d_name);
+  if (fstat(idx->storefd, &st) == -1)
+    err(1, "%s: fstat: %s", __func__, path);
+  if (st.st_size < idx->storeend) {
+    log_warnx("%s: store too small: %s", __func__, path);
+    goto mismatch;
+  }
 
-    /* open project directory */
-    if ((dir2 = fdopendir(fd2)) == NULL) {
-      log_warnx("%s: skip %s/%s", __func__, datapath.str, direntry->d_name);
-      continue;
-    }
+  store_map(idx, idx->storeend);
 
-    /* read project file names */
-    while ((file = readdir(dir2)) != NULL) {
-      /* skip hidden files, . and .. */
-      if (file->d_name[0] == '.')
-        continue;
+  return 0;
 
-      /* file name must consist of two ISO8601 dates */
-      if (strlen(file->d_name) != 29) {
-        log_warnx("%s: skip %s/%s/%s", __func__, datapath.str, direntry->d_name, file->d_name);
-        continue;
-      }
+mismatch:
+  if (close(idx->storefd) == -1)
+    err(1, "%s: close", __func__);
+  idx->storefd = -1;
+  return -1;
+}
 
-      /* expect UTC time notation */
-      if (file->d_name[13] != 'Z' || file->d_name[28] != 'Z') {
-        log_warnx("%s: skip %s/%s/%s", __func__, datapath.str, direntry->d_name, file->d_name);
-        continue;
-      }
+/*
+ * Make sure that at least the first size bytes of the store are mapped. The
+ * mapping grows at least twice as large each time, so that appending does not
+ * cause a new mapping for every description. Only the part of the mapping that
+ * is within the file may be read.
+ */
+static void
+store_map(idx_t *idx, size_t size)
+{
+  size_t n;
 
-      /* both dates msut be separated by an '_' */
-      if (file->d_name[14] != '_') {
-        log_warnx("%s: skip %s/%s/%s", __func__, datapath.str, direntry->d_name, file->d_name);
-        continue;
-      }
+  if (size <= idx->storemap)
+    return;
 
-      if (cb(direntry->d_name, file->d_name, NULL, NULL) != 0) {
-        log_warnx("%s: index error %s/%s/%s", __func__, datapath.str, direntry->d_name, file->d_name);
-        continue;
-      }
-    }
+  n = idx->storemap * 2 > size ? idx->storemap * 2 : size;
+  n = (n + STOREBUF - 1) / STOREBUF * STOREBUF;
+
+  if (idx->store != NULL && munmap(idx->store, idx->storemap) == -1)
+    err(1, "%s: munmap", __func__);
+  if ((idx->store = mmap(NULL, n, PROT_READ, MAP_SHARED, idx->storefd, 0)) == MAP_FAILED)
+    err(1, "%s: mmap", __func__);
+  idx->storemap = n;
+}
 
-    if (closedir(dir2) == -1)
-      err(1, "%s: closedir dir2", __func__);
+/*
+ * Append a description of len bytes to the store and set val to the value of
+ * its dkey, valdata must be 2 * sizeof(uint32_t) bytes. While bulk is set, the
+ * descriptions are collected and written at once by store_flush().
+ */
+static void
+store_put(idx_t *idx, const char *desc, size_t len, DBT *val, char *valdata)
+{
+  uint32_t m;
+  ssize_t n;
+
+  if (len > UINT32_MAX - idx->storeend)
+    errx(1, "%s: description store full", __func__);
+
+  m = htonl(idx->storeend);
+  memcpy(valdata, &m, sizeof m);
+  m = htonl(len);
+  memcpy(valdata + sizeof m, &m, sizeof m);
+  val->data = valdata;
+  val->size = 2 * sizeof m;
+
+  if (idx->bulk) {
+    if (idx->storebuflen + len > STOREBUF)
+      store_flush(idx);
+    if (idx->storebuf == NULL && (idx->storebuf = malloc(STOREBUF)) == NULL)
+      err(1, "%s: malloc", __func__);
+    memcpy(idx->storebuf + idx->storebuflen, desc, len);
+    idx->storebuflen += len;
+    idx->storeend += len;
+    return;
   }
 
-  if (closedir(dir) == -1)
-    err(1, "%s: closedir dir", __func__);
+  if ((n = pwrite(idx->storefd, desc, len, idx->storeend)) == -1)
+    err(1, "%s: pwrite", __func__);
+  if ((size_t)n != len)
+    errx(1, "%s: short write", __func__);
 
-  return 0;
+  idx->storeend += len;
+  if (meta_put(idx, 'S', idx->storeend) != 0)
+    errx(1, "%s: meta_put", __func__);
 }
 
 /*
- * Check if the is within bounds. Expect at least a project name of one
- * character.
+ * Look up a description in the store by the value of its dkey.
  *
- * Return -1 if too small, 1 if too big, 0 if within bounds.
+ * Return a pointer to the description, which is not null terminated and valid
+ * until the next call, and store its length in len.
  */
-static int
-key_within_bounds(const DBT *key)
+static const char *
+store_get(idx_t *idx, const DBT *val, size_t *len)
 {
-  if (key->size < 1 + 1 + 1 + sizeof(uint32_t) + sizeof(uint32_t))
-    return -1;
-  if (key->size > MAXKEYSIZE)
-    return 1;
+  uint32_t off, n;
 
-  return 0;
+  if (val->size != 2 * sizeof off)
+    errx(1, "%s: illegal value size: %zu", __func__, val->size);
+
+  memcpy(&off, val->data, sizeof off);
+  memcpy(&n, (char *)val->data + sizeof off, sizeof n);
+  off = ntohl(off);
+  n = ntohl(n);
+
+  if (off > idx->storeend - idx->storebuflen || n > idx->storeend - idx->storebuflen - off)
+    errx(1, "%s: description out of bounds: %u, %u", __func__, off, n);
+
+  *len = n;
+  if (n == 0)
+    return "";
+
+  store_map(idx, off + n);
+
+  return idx->store + off;
 }
 
 /*
- * Check if the key starts with a D.
- *
- * Return > 0 if this is a dkey, or 0 if it is not.
+ * Write the descriptions that are collected while bulk was set and release the
+ * buffer once bulk is cleared.
  */
-static int
-is_d(const DBT *key)
+static void
+store_flush(idx_t *idx)
 {
-  if (key && key->size)
-    return ((char *)key->data)[0] == 'D';
+  ssize_t n;
+
+  if (idx->storebuflen > 0) {
+    if ((n = pwrite(idx->storefd, idx->storebuf, idx->storebuflen, idx->storeend - idx->storebuflen)) == -1)
+      err(1, "%s: pwrite", __func__);
+    if ((size_t)n != idx->storebuflen)
+      errx(1, "%s: short write", __func__);
+    idx->storebuflen = 0;
+  }
 
-  return 0;
+  if (!idx->bulk) {
+    free(idx->storebuf);
+    idx->storebuf = NULL;
+  }
+
+  if (meta_put(idx, 'S', idx->storeend) != 0)
+    errx(1, "%s: meta_put", __func__);
+}
+
+/* account for a description of len bytes that is no longer used */
+static void
+store_dead(idx_t *idx, size_t len)
+{
+  idx->storedead += len;
+  if (meta_put(idx, 'X', idx->storedead) != 0)
+    errx(1, "%s: meta_put", __func__);
 }
 
 /*
- * Check if the key starts with a D or E.
- *
- * Return > 0 if this is a dkey, or 0 if it is not.
+ * Rewrite the store with only the descriptions of the entries in the index, in
+ * the order of the D index. The version of the index is cleared while the store
+ * is rewritten, so that an interrupted compaction causes a rebuild instead of
+ * wrong descriptions.
  */
-static int
-in_drange(const DBT *key)
+static void
+store_compact(idx_t *idx, const char *idxpath)
 {
-  unsigned char c;
+  DBT key, data;
+  struct skey *skeys;
+  char path[PATH_MAX], tmp[PATH_MAX], keydata[MAXKEYSIZE], valdata[2 * sizeof(uint32_t)], *buf;
+  const char *desc;
+  size_t nkeys, keysize, off, len, i;
+  uint32_t dead, m;
+  ssize_t n;
+  int fd, r;
+
+  if (strlcpy(path, idxpath, sizeof path) >= sizeof path)
+    errx(1, "%s: store path too long", __func__);
+  if (strlcat(path, STORESUFFIX, sizeof path) >= sizeof path)
+    errx(1, "%s: store path too long", __func__);
+  if (snprintf(tmp, sizeof tmp, "%s.new", path) >= (int)sizeof tmp)
+    errx(1, "%s: store path too long", __func__);
+
+  if (meta_put(idx, 'V', 0) != 0)
+    errx(1, "%s: meta_put", __func__);
+  if (idx->db->sync(idx->db, 0) == -1)
+    err(1, "%s: idx->sync", __func__);
+
+  if ((buf = malloc(idx->storeend - idx->storedead + 1)) == NULL)
+    err(1, "%s: malloc", __func__);
 
-  if (!key->size)
-    return 0;
+  skeys = NULL;
+  nkeys = 0;
+  keysize = 0;
+  off = 0;
+
+  if (drange_start(&key, keydata, sizeof keydata, 0) == -1)
+    errx(1, "%s: drange_start", __func__);
+
+  for (r = idx->db->seq(idx->db, &key, &data, R_CURSOR); r == 0 && is_d(&key); r = idx->db->seq(idx->db, &key, &data, R_NEXT)) {
+    desc = store_get(idx, &data, &len);
+    if (len > idx->storeend - idx->storedead - off)
+      errx(1, "%s: more descriptions than expected", __func__);
+    if (key.size > MAXKEYSIZE)
+      errx(1, "%s: key too large: %zu", __func__, key.size);
+
+    if (nkeys == keysize) {
+      keysize = keysize ? keysize * 2 : 1024;
+      if ((skeys = reallocarray(skeys, keysize, sizeof(*skeys))) == NULL)
+        err(1, "%s: reallocarray", __func__);
+    }
+    memcpy(skeys[nkeys].key, key.data, key.size);
+    skeys[nkeys].size = key.size;
+    skeys[nkeys].off = off;
+    skeys[nkeys].len = len;
+    nkeys++;
+
+    memcpy(buf + off, desc, len);
+    off += len;
+  }
+  if (r == -1)
+    err(1, "%s: idx->seq", __func__);
+
+  if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+    err(1, "%s: open: %s", __func__, tmp);
+  if ((n = write(fd, buf, off)) == -1)
+    err(1, "%s: write: %s", __func__, tmp);
+  if ((size_t)n != off)
+    errx(1, "%s: short write: %s", __func__, tmp);
+  if (fsync(fd) == -1)
+    err(1, "%s: fsync: %s", __func__, tmp);
+  if (close(fd) == -1)
+    err(1, "%s: close", __func__);
+  if (rename(tmp, path) == -1)
+    err(1, "%s: rename: %s", __func__, tmp);
+
+  /* switch to the new store */
+  if (idx->store != NULL && munmap(idx->store, idx->storemap) == -1)
+    err(1, "%s: munmap", __func__);
+  idx->store = NULL;
+  idx->storemap = 0;
+  if (close(idx->storefd) == -1)
+    err(1, "%s: close", __func__);
+  if ((idx->storefd = open(path, O_RDWR | O_CLOEXEC)) == -1)
+    err(1, "%s: open: %s", __func__, path);
+
+  for (i = 0; i < nkeys; i++) {
+    key.data = skeys[i].key;
+    key.size = skeys[i].size;
+    m = htonl(skeys[i].off);
+    memcpy(valdata, &m, sizeof m);
+    m = htonl(skeys[i].len);
+    memcpy(valdata + sizeof m, &m, sizeof m);
+    data.data = valdata;
+    data.size = sizeof valdata;
+    if (idx->db->put(idx->db, &key, &data, 0) == -1)
+      err(1, "%s: put dk", __func__);
+  }
 
-  c = ((char *)key->data)[0];
+  dead = idx->storedead;
+  idx->storeend = off;
+  idx->storedead = 0;
 
-  if (c == 'D')
-    return 1;
+  if (meta_put(idx, 'S', idx->storeend) != 0 || meta_put(idx, 'X', 0) != 0)
+    errx(1, "%s: meta_put", __func__);
+  if (meta_put(idx, 'V', IDXVERSION) != 0)
+    errx(1, "%s: meta_put", __func__);
+  if (idx->db->sync(idx->db, 0) == -1)
+    err(1, "%s: idx->sync", __func__);
 
-  if (c == 'E' && key->size == 1)
-    return 1;
+  store_map(idx, idx->storeend);
 
-  return 0;
+  log_warnx("%s: %zu descriptions, %u bytes removed", __func__, nkeys, dead);
+
+  free(skeys);
+  free(buf);
 }
 
 /*
- * Check if the key starts with a P or Q.
+ * Take the writer lock if no other process holds it.
  *
- * Return > 0 if this is a pkey, or 0 if it is not.
+ * Return 0 on success, or the pid of the process that holds the lock.
  */
-static int
-in_prange(const DBT *key)
+static pid_t
+lock_writer(idx_t *idx)
 {
-  unsigned char c;
+  struct flock lock;
 
-  if (!key->size)
-    return 0;
+  lock.l_type = F_WRLCK;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = WRITERLOCK;
+  lock.l_len = 1;
 
-  c = ((char *)key->data)[0];
+  if (fcntl(idx->lockfd, F_GETLK, &lock) == -1)
+    err(1, "%s: fcntl", __func__);
 
-  if (c == 'P')
-    return 1;
+  if (lock.l_type != F_UNLCK)
+    return lock.l_pid;
 
-  if (c == 'Q' && key->size == 1)
-    return 1;
+  lock.l_type = F_WRLCK;
+  if (fcntl(idx->lockfd, F_SETLK, &lock) == -1)
+    err(1, "%s: fcntl failed to lock db", __func__);
 
   return 0;
 }
 
 /*
- * Check if the key starts with a P.
+ * Set, change or release the lock on one byte of the lock file. Wait as long as
+ * another process holds a conflicting lock.
+ */
+static void
+lock_byte(idx_t *idx, short type, off_t start)
+{
+  struct flock lock;
+
+  lock.l_type = type;
+  lock.l_whence = SEEK_SET;
+  lock.l_start = start;
+  lock.l_len = 1;
+
+  while (fcntl(idx->lockfd, F_SETLKW, &lock) == -1)
+    if (errno != EINTR)
+      err(1, "%s: fcntl", __func__);
+}
+
+/* serialize all access to the db of a handle */
+static void
+mtx_lock(idx_t *idx)
+{
+  if ((errno = pthread_mutex_lock(&idx->mtx)) != 0)
+    err(1, "%s: pthread_mutex_lock", __func__);
+}
+
+static void
+mtx_unlock(idx_t *idx)
+{
+  if ((errno = pthread_mutex_unlock(&idx->mtx)) != 0)
+    err(1, "%s: pthread_mutex_unlock", __func__);
+}
+
+/*
+ * Read a metadata value.
  *
- * Return > 0 if this is a pkey, or 0 if it is not.
+ * Return 0 on success, 1 if not found, -1 on error.
  */
 static int
-is_p(const DBT *key)
+meta_get(idx_t *idx, const char name, uint32_t *val)
 {
-  if (key && key->size)
-    return ((char *)key->data)[0] == 'P';
+  DBT key;
 
-  return 0;
+  key.data = (void *)&name;
+  key.size = 1;
+
+  return val_get(idx, &key, val);
 }
 
 /*
- * Create a key for the P index that starts at the given project and optionally
- * at the given start time. It is the callers responsibility to properly
- * allocate enough space. proj must be null terminated. projlen must be the
- * number of bytes that precede the first null byte. If proj is the empty
- * string, it is not appended to the key.
- *
- * If min is not 0, projlen must not be 0.
- *
- * Warning: this is not a valid pkey.
+ * Write a metadata value.
  *
  * Return 0 on success, -1 on error.
  */
 static int
-prange_start(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t min)
+meta_put(idx_t *idx, const char name, const uint32_t val)
 {
-  uint32_t m;
-  size_t s;
+  DBT key;
 
-  if (proj[projlen] != '\0') {
+  key.data = (void *)&name;
+  key.size = 1;
+
+  return val_put(idx, &key, val);
+}
+
+/*
+ * Read the uint32be value of a key.
+ *
+ * Return 0 on success, 1 if not found, -1 on error.
+ */
+static int
+val_get(idx_t *idx, const DBT *key, uint32_t *val)
+{
+  DBT data;
+  uint32_t m;
+  int r;
+
+  if ((r = idx->db->get(idx->db, key, &data, 0)) == -1)
+    err(1, "%s: idx->get", __func__);
+  if (r == 1)
+    return 1;
+
+  if (data.size != sizeof m) {
+    log_warnx("%s: illegal value size of %c: %zu", __func__, ((char *)key->data)[0], data.size);
+    return -1;
+  }
+
+  memcpy(&m, data.data, sizeof m);
+  *val = ntohl(m);
+
+  return 0;
+}
+
+/*
+ * Write the value of a key as an uint32be.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+val_put(idx_t *idx, const DBT *key, const uint32_t val)
+{
+  DBT data;
+  uint32_t m;
+
+  m = htonl(val);
+  data.data = &m;
+  data.size = sizeof m;
+
+  if (idx->db->put(idx->db, (DBT *)key, &data, 0) == -1)
+    err(1, "%s: idx->put", __func__);
+
+  return 0;
+}
+
+/*
+ * Add delta to the number of entries of a project, of the day on which an entry
+ * starts and of the whole index.
+ */
+static void
+stats_add(idx_t *idx, const char *proj, const size_t projlen, const time_t start, const int delta)
+{
+  DBT key;
+  char keydata[MAXKEYSIZE];
+  uint32_t m;
+
+  key.data = keydata;
+
+  /* project */
+  keydata[0] = 'N';
+  memcpy(keydata + 1, proj, projlen + 1);
+  key.size = 1 + projlen + 1;
+  stat_add(idx, &key, delta);
+
+  /* total */
+  key.size = 1;
+  stat_add(idx, &key, delta);
+
+  /* day */
+  keydata[0] = 'M';
+  m = htonl(start / SECSPERDAY);
+  memcpy(keydata + 1, &m, sizeof m);
+  key.size = 1 + sizeof m;
+  stat_add(idx, &key, delta);
+}
+
+/*
+ * Add delta to a counter and remove it once it drops to zero.
+ */
+static void
+stat_add(idx_t *idx, const DBT *key, const int delta)
+{
+  uint32_t val;
+  int r;
+
+  if ((r = val_get(idx, key, &val)) == -1)
+    errx(1, "%s: val_get", __func__);
+  if (r == 1)
+    val = 0;
+
+  if (delta < 0 && val < (uint32_t)-delta) {
+    log_warnx("%s: counter %c below zero", __func__, ((char *)key->data)[0]);
+    val = 0;
+  } else {
+    val += delta;
+  }
+
+  if (val > 0) {
+    if (val_put(idx, key, val) != 0)
+      errx(1, "%s: val_put", __func__);
+  } else if (r == 0) {
+    if (idx->db->del(idx->db, key, 0) == -1)
+      err(1, "%s: idx->del", __func__);
+  }
+}
+
+/* return the number of entries in the index */
+static size_t
+stat_total(idx_t *idx)
+{
+  uint32_t val;
+
+  if (meta_get(idx, 'N', &val) != 0)
+    return 0;
+
+  return val;
+}
+
+/* return the number of entries of a project */
+static size_t
+stat_proj(idx_t *idx, idx_plan_t *plan, const char *proj)
+{
+  DBT key;
+  char keydata[MAXKEYSIZE];
+  uint32_t val;
+  size_t projlen;
+
+  projlen = strlen(proj);
+  if (projlen > MAXPROJ)
+    return 0;
+
+  keydata[0] = 'N';
+  memcpy(keydata + 1, proj, projlen + 1);
+  key.data = keydata;
+  key.size = 1 + projlen + 1;
+
+  plan->statkeys++;
+
+  if (val_get(idx, &key, &val) != 0)
+    return 0;
+
+  return val;
+}
+
+/*
+ * Estimate the number of entries that start in the range [lo, hi) by summing
+ * the number of entries of each day in the range. Both lo and hi are optional
+ * and can be 0. Summing stops as soon as cap is reached, so that estimating
+ * the cost of a plan never costs more than the plan it is compared with.
+ *
+ * Return the estimated number of entries, at least cap if capped.
+ */
+static size_t
+stat_days(idx_t *idx, idx_plan_t *plan, const time_t lo, const time_t hi, const size_t cap)
+{
+  DBT key, data;
+  char keydata[1 + sizeof(uint32_t)];
+  uint32_t m, last;
+  size_t sum;
+  int r;
+
+  if (!lo && !hi)
+    return stat_total(idx);
+
+  keydata[0] = 'M';
+  m = htonl(lo / SECSPERDAY);
+  memcpy(keydata + 1, &m, sizeof m);
+  key.data = keydata;
+  key.size = sizeof keydata;
+
+  last = hi ? (hi - 1) / SECSPERDAY : UINT32_MAX;
+
+  sum = 0;
+  for (r = idx->db->seq(idx->db, &key, &data, R_CURSOR); r == 0 && sum < cap; r = idx->db->seq(idx->db, &key, &data, R_NEXT)) {
+    if (key.size != 1 + sizeof m || ((char *)key.data)[0] != 'M')
+      break;
+
+    memcpy(&m, (char *)key.data + 1, sizeof m);
+    if (ntohl(m) > last)
+      break;
+
+    if (data.size != sizeof m)
+      errx(1, "%s: illegal value size: %zu", __func__, data.size);
+
+    memcpy(&m, data.data, sizeof m);
+    sum += ntohl(m);
+    plan->statkeys++;
+  }
+  if (r == -1)
+    err(1, "%s: idx->seq", __func__);
+
+  return sum;
+}
+
+/*
+ * Close a db and free the handle. No other thread may use the handle anymore.
+ */
+void
+idx_close(idx_t *idx)
+{
+  if (close(idx->dpfd) == -1)
+    err(1, "%s: close", __func__);
+  if (idx->db->close(idx->db) == -1)
+    err(1, "%s: idx->close", __func__);
+
+  /* release all locks */
+  if (close(idx->lockfd) == -1)
+    err(1, "%s: close", __func__);
+
+  free_uniq_proj(idx);
+  pack_close(idx->pack);
+  free(idx->block);
+  free(idx->blockbuf);
+
+  if (idx->store != NULL && munmap(idx->store, idx->storemap) == -1)
+    err(1, "%s: munmap", __func__);
+  if (idx->storefd != -1 && close(idx->storefd) == -1)
+    err(1, "%s: close", __func__);
+
+  if ((errno = pthread_mutex_destroy(&idx->mtx)) != 0)
+    err(1, "%s: pthread_mutex_destroy", __func__);
+
+  free(idx);
+}
+
+/*
+ * Try to read every project directory and file in path and create two indices,
+ * one by start date for date range queries and one by project + start date for
+ * project based date range queries.
+ *
+ * The file names are collected first. Then the descriptions are read in
+ * batches of READBATCH files, see dr_open(), and the next batch is read while
+ * the current one is passed to cb. The files are opened by their path relative
+ * to the data dir, so that only one directory is open at a time no matter how
+ * many projects there are. The files in packs follow, see pack_open().
+ * The trigrams are collected in memory and written at once at the end.
+ *
+ * Return 1 if index is created, 0 if no directory is found or exit on failure.
+ */
+static int
+walk_datadir(idx_t *idx, int(*cb)(idx_t *idx, const char proj[MAXPROJ], char *file, const char *desc, DBT **pkey, DBT **dkey))
+{
+  struct dscan dir, dir2;
+  struct dfile *files, *df;
+  struct dpack *packs;
+  struct timespec t0, t1;
+  pack_t *pk;
+  descread_t *dr;
+  dr_file_t batch[2][READBATCH];
+  const char *name, *file, *data;
+  char **projs, *bufs, (*paths)[FILEPATH], pfile[PACKFILELEN + 1];
+  size_t nprojs, nfiles, filesize, npacks, npacked, size, i, j, n, next;
+  int cur, type;
+  double secs;
+  int fd1, fd2;
+
+  projs = NULL;
+  files = NULL;
+  packs = NULL;
+  nprojs = 0;
+  nfiles = 0;
+  filesize = 0;
+  npacks = 0;
+  npacked = 0;
+
+  if (clock_gettime(CLOCK_MONOTONIC, &t0) == -1)
+    err(1, "%s: clock_gettime", __func__);
+
+  /* read all dirs in the directory */
+  if ((fd1 = open(idx->datapath, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    err(2, "%s: open", __func__);
+
+  dscan_open(&dir, fd1);
+
+  /* iterate over data dir, expect project directories */
+  while (dscan_next(&dir, &name, &type)) {
+    /* skip hidden files, . and .. */
+    if (name[0] == '.')
+      continue;
+
+    /* only follow what might be a directory */
+    if (type != DT_DIR && type != DT_LNK && type != DT_UNKNOWN) {
+      log_warnx("%s: skip %s/%s", __func__, idx->datapath, name);
+      continue;
+    }
+
+    /* open project directory */
+    if ((fd2 = openat(fd1, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+      if (errno != ENOTDIR)
+        err(1, "%s: openat %s", __func__, name);
+      log_warnx("%s: skip %s/%s", __func__, idx->datapath, name);
+      continue;
+    }
+
+    if ((projs = reallocarray(projs, nprojs + 1, sizeof(*projs))) == NULL)
+      err(1, "%s: reallocarray", __func__);
+    if ((projs[nprojs] = strdup(name)) == NULL)
+      err(1, "%s: strdup", __func__);
+
+    dscan_open(&dir2, fd2);
+
+    /* read project file names */
+    while (dscan_next(&dir2, &file, &type)) {
+      /* skip hidden files, . and .. */
+      if (file[0] == '.')
+        continue;
+
+      /* the files in a pack are indexed after the others */
+      if (type != DT_DIR && is_pack_name(file)) {
+        if ((packs = reallocarray(packs, npacks + 1, sizeof(*packs))) == NULL)
+          err(1, "%s: reallocarray", __func__);
+        packs[npacks].proj = nprojs;
+        memcpy(packs[npacks].name, file, sizeof(packs[npacks].name));
+        npacks++;
+        continue;
+      }
+
+      /* file name must consist of two ISO8601 dates */
+      if (type == DT_DIR || !is_entry_name(file)) {
+        log_warnx("%s: skip %s/%s/%s", __func__, idx->datapath, name, file);
+        continue;
+      }
+
+      if (nfiles == filesize) {
+        filesize = filesize ? filesize * 2 : 1024;
+        if ((files = reallocarray(files, filesize, sizeof(*files))) == NULL)
+          err(1, "%s: reallocarray", __func__);
+      }
+      df = &files[nfiles++];
+      df->proj = nprojs;
+      memcpy(df->name, file, sizeof(df->name));
+    }
+
+    dscan_close(&dir2);
+
+    if (close(fd2) == -1)
+      err(1, "%s: close", __func__);
+
+    nprojs++;
+  }
+
+  dscan_close(&dir);
+
+  if ((dr = dr_open()) == NULL)
+    errx(1, "%s: dr_open", __func__);
+
+  /* two batches, one is read while the other is indexed */
+  if ((bufs = reallocarray(NULL, 2 * READBATCH, MAXDESC + 1)) == NULL)
+    err(1, "%s: reallocarray", __func__);
+  if ((paths = reallocarray(NULL, 2 * READBATCH, sizeof(*paths))) == NULL)
+    err(1, "%s: reallocarray", __func__);
+  for (i = 0; i < 2 * READBATCH; i++) {
+    batch[i / READBATCH][i % READBATCH].buf = bufs + i * (MAXDESC + 1);
+    batch[i / READBATCH][i % READBATCH].size = MAXDESC + 1;
+  }
+
+  idx->bulk = 1;
+
+  i = 0;
+  cur = 0;
+  if ((n = batch_fill(batch[cur], paths, files, nfiles, i, projs, fd1)) > 0)
+    dr_start(dr, batch[cur], n);
+
+  while (n > 0) {
+    dr_wait(dr);
+
+    /* read the next batch while this one is indexed */
+    if ((next = batch_fill(batch[!cur], paths + !cur * READBATCH, files, nfiles, i + n, projs, fd1)) > 0)
+      dr_start(dr, batch[!cur], next);
+
+    for (j = 0; j < n; j++) {
+      df = &files[i + j];
+      if (cb(idx, projs[df->proj], df->name, batch[cur][j].buf, NULL, NULL) != 0)
+        log_warnx("%s: index error %s/%s/%s", __func__, idx->datapath, projs[df->proj], df->name);
+    }
+
+    i += n;
+    n = next;
+    cur = !cur;
+  }
+
+  /* a pack is read at once, so the descriptions can be passed directly */
+  for (i = 0; i < npacks; i++) {
+    if ((fd2 = openat(fd1, projs[packs[i].proj], O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+      err(1, "%s: openat %s", __func__, projs[packs[i].proj]);
+    if ((pk = pack_open(fd2, packs[i].name)) == NULL)
+      err(1, "%s: pack_open: %s", __func__, packs[i].name);
+    if (close(fd2) == -1)
+      err(1, "%s: close", __func__);
+
+    for (j = 0; j < pack_count(pk); j++) {
+      data = pack_item(pk, j, pfile, &size);
+      if (!is_entry_name(pfile)) {
+        log_warnx("%s: skip %s/%s/%s in %s", __func__, idx->datapath, projs[packs[i].proj], pfile, packs[i].name);
+        continue;
+      }
+      if (size > MAXDESC)
+        size = MAXDESC;
+      memcpy(bufs, data, size);
+      bufs[size] = '\0';
+      if (cb(idx, projs[packs[i].proj], pfile, bufs, NULL, NULL) != 0)
+        log_warnx("%s: index error %s/%s/%s", __func__, idx->datapath, projs[packs[i].proj], pfile);
+      npacked++;
+    }
+
+    pack_close(pk);
+  }
+
+  idx->bulk = 0;
+  grams_flush(idx);
+  store_flush(idx);
+
+  if (clock_gettime(CLOCK_MONOTONIC, &t1) == -1)
+    err(1, "%s: clock_gettime", __func__);
+  secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  snprintf(idx->rebuilddesc, sizeof idx->rebuilddesc, "rebuilt from %zu files and %zu packed files in %.2fs, %.0f files/s, read with %s", nfiles, npacked, secs, secs > 0 ? (nfiles + npacked) / secs : 0, dr_method(dr));
+  log_warnx("%s: %s", __func__, idx->rebuilddesc);
+
+  dr_close(dr);
+  free(bufs);
+  free(paths);
+
+  if (close(fd1) == -1)
+    err(1, "%s: close", __func__);
+
+  for (i = 0; i < nprojs; i++)
+    free(projs[i]);
+  free(projs);
+  free(files);
+  free(packs);
+
+  return 0;
+}
+
+/*
+ * Set up a batch with at most READBATCH files, starting at the file with index
+ * from. The paths of the files relative to the data dir dirfd are written to
+ * paths, which must hold READBATCH paths.
+ *
+ * Return the number of files in the batch.
+ */
+static size_t
+batch_fill(dr_file_t *batch, char (*paths)[FILEPATH], const struct dfile *files, size_t nfiles, size_t from, char **projs, int dirfd)
+{
+  const struct dfile *df;
+  size_t n;
+
+  for (n = 0; n < READBATCH && from + n < nfiles; n++) {
+    df = &files[from + n];
+    if (snprintf(paths[n], FILEPATH, "%s/%s", projs[df->proj], df->name) >= FILEPATH)
+      errx(1, "%s: path too long: %s/%s", __func__, projs[df->proj], df->name);
+    batch[n].dirfd = dirfd;
+    batch[n].name = paths[n];
+  }
+
+  return n;
+}
+
+/*
+ * Start reading the names in the directory fd in chunks of SCANBUF bytes. The
+ * names are returned by dscan_next(). fd is not closed by dscan_close().
+ */
+static void
+dscan_open(struct dscan *ds, int fd)
+{
+#ifdef __linux__
+  if ((ds->buf = malloc(SCANBUF)) == NULL)
+    err(1, "%s: malloc", __func__);
+  ds->fd = fd;
+  ds->len = 0;
+  ds->off = 0;
+#else
+  int fd2;
+
+  /* closedir() closes the descriptor it is given */
+  if ((fd2 = dup(fd)) == -1)
+    err(1, "%s: dup", __func__);
+  if ((ds->dir = fdopendir(fd2)) == NULL)
+    err(1, "%s: fdopendir", __func__);
+#endif
+}
+
+/*
+ * Get the next name in the directory and its type, one of the DT_ constants.
+ * name is valid until the next call.
+ *
+ * Return 1 if a name is found, 0 if there are no more names or exit on failure.
+ */
+static int
+dscan_next(struct dscan *ds, const char **name, int *type)
+{
+#ifdef __linux__
+  struct dent64 *de;
+  long n;
+
+  if (ds->off == ds->len) {
+    if ((n = syscall(SYS_getdents64, ds->fd, ds->buf, SCANBUF)) == -1)
+      err(1, "%s: getdents64", __func__);
+    if (n == 0)
+      return 0;
+    ds->len = n;
+    ds->off = 0;
+  }
+
+  de = (struct dent64 *)(ds->buf + ds->off);
+  ds->off += de->d_reclen;
+  *name = de->d_name;
+  *type = de->d_type;
+#else
+  struct dirent *de;
+
+  errno = 0;
+  if ((de = readdir(ds->dir)) == NULL) {
+    if (errno != 0)
+      err(1, "%s: readdir", __func__);
+    return 0;
+  }
+
+  *name = de->d_name;
+  *type = de->d_type;
+#endif
+
+  return 1;
+}
+
+static void
+dscan_close(struct dscan *ds)
+{
+#ifdef __linux__
+  free(ds->buf);
+#else
+  if (closedir(ds->dir) == -1)
+    err(1, "%s: closedir", __func__);
+#endif
+}
+
+/*
+ * Check if name is the name of an entry file, two UTC times like
+ * "20200131T0900Z_20200131T1730Z". Every character is checked against the
+ * fixed format, see strtotime().
+ *
+ * Return 1 if it is, 0 if not.
+ */
+static int
+is_entry_name(const char *name)
+{
+  time_t t;
+
+  if (strtotime(name, &t) == -1 || name[14] != '_')
+    return 0;
+  if (strtotime(name + 14 + 1, &t) == -1)
+    return 0;
+
+  return name[29] == '\0';
+}
+
+/*
+ * Read the first MAXDESC bytes of the description in file of proj into desc,
+ * which must be MAXDESC + 1 bytes, and null terminate it. If there is no such
+ * file, the description is read from its pack.
+ *
+ * Return the length of the description.
+ */
+static size_t
+desc_read(idx_t *idx, const char *proj, const char *file, char *desc)
+{
+  const char *data;
+  ssize_t n;
+  size_t size;
+  int pfd, fd;
+
+  if ((pfd = openat(idx->dpfd, proj, O_RDONLY)) == -1)
+    err(1, "%s: openat: %s", __func__, proj);
+
+  if ((fd = openat(pfd, file, O_RDONLY)) != -1) {
+    if ((n = read(fd, desc, MAXDESC)) == -1)
+      err(1, "%s: read: %s", __func__, file);
+    if (close(fd) == -1)
+      err(1, "%s: close", __func__);
+  } else if (errno == ENOENT && (data = packed_get(idx, pfd, proj, file, &size)) != NULL) {
+    n = size < MAXDESC ? size : MAXDESC;
+    memcpy(desc, data, n);
+  } else {
+    err(1, "%s: openat: %s/%s", __func__, proj, file);
+  }
+
+  if (close(pfd) == -1)
+    err(1, "%s: close", __func__);
+  desc[n] = '\0';
+
+  return n;
+}
+
+/*
+ * Find a project file in its pack. The last read pack is kept in the handle,
+ * because consecutive lookups are mostly of entries of the same year. pfd is an
+ * open descriptor of the project directory.
+ *
+ * Return a pointer to the contents, valid until the next call or until a pack
+ * changes, and store its size in size. Return NULL if the file is not packed.
+ */
+static const char *
+packed_get(idx_t *idx, int pfd, const char *proj, const char *file, size_t *size)
+{
+  char name[PACKNAMESIZE];
+
+  pack_name(name, file);
+
+  if (idx->pack == NULL || strcmp(idx->packproj, proj) != 0 || strcmp(idx->packname, name) != 0) {
+    drop_pack(idx);
+    if ((idx->pack = pack_open(pfd, name)) == NULL)
+      return NULL;
+    if (strlcpy(idx->packproj, proj, sizeof idx->packproj) >= sizeof idx->packproj)
+      errx(1, "%s: project name too long: %s", __func__, proj);
+    memcpy(idx->packname, name, sizeof idx->packname);
+  }
+
+  return pack_get(idx->pack, file, size);
+}
+
+/* forget the last read pack, must be called when a pack changes */
+static void
+drop_pack(idx_t *idx)
+{
+  pack_close(idx->pack);
+  idx->pack = NULL;
+}
+
+/*
+ * Check if the is within bounds. Expect at least a project name of one
+ * character.
+ *
+ * Return -1 if too small, 1 if too big, 0 if within bounds.
+ */
+static int
+key_within_bounds(const DBT *key)
+{
+  if (key->size < 1 + 1 + 1 + sizeof(uint32_t) + sizeof(uint32_t))
+    return -1;
+  if (key->size > MAXKEYSIZE)
+    return 1;
+
+  return 0;
+}
+
+/*
+ * Check if the key starts with a D.
+ *
+ * Return > 0 if this is a dkey, or 0 if it is not.
+ */
+static int
+is_d(const DBT *key)
+{
+  if (key && key->size)
+    return ((char *)key->data)[0] == 'D';
+
+  return 0;
+}
+
+/*
+ * Check if the key starts with a D or E.
+ *
+ * Return > 0 if this is a dkey, or 0 if it is not.
+ */
+static int
+in_drange(const DBT *key)
+{
+  unsigned char c;
+
+  if (!key->size)
+    return 0;
+
+  c = ((char *)key->data)[0];
+
+  if (c == 'D')
+    return 1;
+
+  if (c == 'E' && key->size == 1)
+    return 1;
+
+  return 0;
+}
+
+/*
+ * Check if the key starts with a P or Q.
+ *
+ * Return > 0 if this is a pkey, or 0 if it is not.
+ */
+static int
+in_prange(const DBT *key)
+{
+  unsigned char c;
+
+  if (!key->size)
+    return 0;
+
+  c = ((char *)key->data)[0];
+
+  if (c == 'P')
+    return 1;
+
+  if (c == 'Q' && key->size == 1)
+    return 1;
+
+  return 0;
+}
+
+/*
+ * Check if the key starts with a F or G.
+ *
+ * Return > 0 if this is a fkey, or 0 if it is not.
+ */
+static int
+in_frange(const DBT *key)
+{
+  unsigned char c;
+
+  if (!key->size)
+    return 0;
+
+  c = ((char *)key->data)[0];
+
+  if (c == 'F')
+    return 1;
+
+  if (c == 'G' && key->size == 1)
+    return 1;
+
+  return 0;
+}
+
+/*
+ * Check if the key starts with a F.
+ *
+ * Return > 0 if this is a fkey, or 0 if it is not.
+ */
+static int
+is_f(const DBT *key)
+{
+  if (key && key->size)
+    return ((char *)key->data)[0] == 'F';
+
+  return 0;
+}
+
+/*
+ * Determine to which index a key or range bound belongs.
+ *
+ * Return 'D', 'F' or 'P', or 0 if the key is not part of any of them.
+ */
+static int
+key_family(const DBT *key)
+{
+  if (in_drange(key))
+    return 'D';
+  if (in_frange(key))
+    return 'F';
+  if (in_prange(key))
+    return 'P';
+
+  return 0;
+}
+
+/*
+ * Check if the key starts with a P.
+ *
+ * Return > 0 if this is a pkey, or 0 if it is not.
+ */
+static int
+is_p(const DBT *key)
+{
+  if (key && key->size)
+    return ((char *)key->data)[0] == 'P';
+
+  return 0;
+}
+
+/*
+ * Create a key for the P index that starts at the given project and optionally
+ * at the given start time. It is the callers responsibility to properly
+ * allocate enough space. proj must be null terminated. projlen must be the
+ * number of bytes that precede the first null byte. If proj is the empty
+ * string, it is not appended to the key.
+ *
+ * If min is not 0, projlen must not be 0.
+ *
+ * Warning: this is not a valid pkey.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+prange_start(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t min)
+{
+  uint32_t m;
+  size_t s;
+
+  if (proj[projlen] != '\0') {
+    log_warnx("%s: illegal project name: %zu", __func__, projlen);
+    return -1;
+  }
+
+  if (min && !projlen) {
+    log_warnx("%s: if min is not 0, projlen must not be 0", __func__);
+    return -1;
+  }
+
+  if (min)
+    s = 1 + projlen + 1 + sizeof(uint32_t);
+  else if (projlen)
+    s = 1 + projlen + 1;
+  else
+    s = 1;
+
+  if (datasize < s) {
+    log_warnx("%s: data size too small: %zu", __func__, datasize);
+    return -1;
+  }
+
+  data[0] = 'P';
+
+  /* only terminate if proj is given */
+  if (projlen) {
+    memcpy(data + 1, proj, projlen + 1);
+
+    if (min) {
+      m = htonl(min);
+      memcpy(data + 1 + projlen + 1, &m, sizeof(m));
+    }
+  }
+
+  key->data = data;
+  key->size = s;
+
+  return 0;
+}
+
+/*
+ * Create a key for the P index that ends at the given project and optionally
+ * at the given end time. It is the callers responsibility to properly allocate
+ * enough space. proj must be null terminated. projlen must be the number of
+ * bytes that precede the first null byte. If proj is the empty string, it is
+ * not appended to the key.
+ *
+ * If max is not 0, projlen must not be 0.
+ *
+ * Warning: this is not a valid pkey.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+prange_end(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t max)
+{
+  uint32_t m;
+  size_t s;
+
+  if (proj[projlen] != '\0') {
+    log_warnx("%s: illegal project name: %zu", __func__, projlen);
+    return -1;
+  }
+
+  if (max && !projlen) {
+    log_warnx("%s: if max is not 0, projlen must not be 0", __func__);
+    return -1;
+  }
+
+  if (max)
+    s = 1 + projlen + 1 + sizeof(uint32_t);
+  else if (projlen)
+    s = 1 + projlen + 1;
+  else
+    s = 1;
+
+  if (datasize < s) {
+    log_warnx("%s: data size too small: %zu", __func__, datasize);
+    return -1;
+  }
+
+  data[0] = 'P';
+
+  /* only terminate if proj is given */
+  if (projlen) {
+    memcpy(data + 1, proj, projlen + 1);
+
+    if (max) {
+      m = htonl(max);
+      memcpy(data + 1 + projlen + 1, &m, sizeof(m));
+    } else {
+      /* set null byte of project name to 0x01 */
+      data[s - 1]++;
+    }
+  } else {
+    /* set Q */
+    data[s - 1]++;
+  }
+
+  key->data = data;
+  key->size = s;
+
+  return 0;
+}
+
+/*
+ * Create a key for the D index that optionally starts at the given start time.
+ * It is the callers responsibility to properly allocate enough space.
+ *
+ * Warning: this is not a valid dkey.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+drange_start(DBT *key, char *data, const size_t datasize, const time_t min)
+{
+  uint32_t m;
+  size_t s;
+
+  if (min)
+    s = 1 + sizeof(uint32_t);
+  else
+    s = 1;
+
+  if (datasize < s) {
+    log_warnx("%s: data size too small: %zu", __func__, datasize);
+    return -1;
+  }
+
+  data[0] = 'D';
+
+  if (min) {
+    m = htonl(min);
+    memcpy(data + 1, &m, sizeof(m));
+  }
+
+  key->data = data;
+  key->size = s;
+
+  return 0;
+}
+
+/*
+ * Create a key for the D index that optionally ends at the given end time. It
+ * is the callers responsibility to properly allocate enough space.
+ *
+ * Warning: this is not a valid dkey.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+drange_end(DBT *key, char *data, const size_t datasize, const time_t max)
+{
+  uint32_t m;
+  size_t s;
+
+  if (max)
+    s = 1 + sizeof(uint32_t);
+  else
+    s = 1;
+
+  if (datasize < s) {
+    log_warnx("%s: data size too small: %zu", __func__, datasize);
+    return -1;
+  }
+
+  data[0] = 'D';
+
+  if (max) {
+    m = htonl(max);
+    memcpy(data + 1, &m, sizeof(m));
+  } else {
+    /* set E */
+    data[s - 1]++;
+  }
+
+  key->data = data;
+  key->size = s;
+
+  return 0;
+}
+
+/*
+ * Create a key for the F index that optionally starts at the given end time.
+ * It is the callers responsibility to properly allocate enough space.
+ *
+ * Warning: this is not a valid fkey.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+frange_start(DBT *key, char *data, const size_t datasize, const time_t min)
+{
+  if (drange_start(key, data, datasize, min) != 0)
+    return -1;
+
+  data[0] = 'F';
+
+  return 0;
+}
+
+/*
+ * Create a key for the F index that optionally ends at the given end time. It
+ * is the callers responsibility to properly allocate enough space.
+ *
+ * Warning: this is not a valid fkey.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+frange_end(DBT *key, char *data, const size_t datasize, const time_t max)
+{
+  if (drange_end(key, data, datasize, max) != 0)
+    return -1;
+
+  /* D becomes F and E becomes G */
+  data[0] += 'F' - 'D';
+
+  return 0;
+}
+
+/*
+ * Create a valid pkey. It is the callers responsibility to properly allocate
+ * enough space. proj must be null terminated. projlen must be the number of
+ * bytes that precede the first null byte.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+pkey_make(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t start, const time_t end)
+{
+  uint32_t m;
+
+  if (proj[projlen] != '\0') {
+    log_warnx("%s: illegal project name: %zu", __func__, projlen);
+    return -1;
+  }
+
+  if (datasize < 1 + projlen + 1 + sizeof(uint32_t) + sizeof(uint32_t)) {
+    log_warnx("%s: data size too small: %zu", __func__, datasize);
+    return -1;
+  }
+
+  data[0] = 'P';
+
+  memcpy(data + 1, proj, projlen + 1);
+
+  m = htonl(start);
+  memcpy(data + 1 + projlen + 1, &m, sizeof(m));
+
+  m = htonl(end);
+  memcpy(data + 1 + projlen + 1 + sizeof(m), &m, sizeof(m));
+
+  key->data = data;
+  key->size = 1 + projlen + 1 + sizeof(m) + sizeof(m);
+
+  return 0;
+}
+
+/*
+ * Create a valid dkey. It is the callers responsibility to properly allocate
+ * enough space. proj must be null terminated. projlen must be the number of
+ * bytes that precede the first null byte.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+dkey_make(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t start, const time_t end)
+{
+  uint32_t m;
+
+  if (proj[projlen] != '\0') {
     log_warnx("%s: illegal project name: %zu", __func__, projlen);
     return -1;
   }
 
-  if (min && !projlen) {
-    log_warnx("%s: if min is not 0, projlen must not be 0", __func__);
-    return -1;
+  if (datasize < 1 + sizeof(uint32_t) + sizeof(uint32_t) + projlen + 1) {
+    log_warnx("%s: data size too small: %zu", __func__, datasize);
+    return -1;
+  }
+
+  data[0] = 'D';
+
+  m = htonl(start);
+  memcpy(data + 1, &m, sizeof(m));
+
+  m = htonl(end);
+  memcpy(data + 1 + sizeof(m), &m, sizeof(m));
+
+  memcpy(data + 1 + sizeof(m) + sizeof(m), proj, projlen + 1);
+
+  key->data = data;
+  key->size = 1 + sizeof(m) + sizeof(m) + projlen + 1;
+
+  return 0;
+}
+
+/*
+ * Create a valid fkey. It is the callers responsibility to properly allocate
+ * enough space. proj must be null terminated. projlen must be the number of
+ * bytes that precede the first null byte.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+fkey_make(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t start, const time_t end)
+{
+  /* same layout as a dkey but with start and end swapped */
+  if (dkey_make(key, data, datasize, proj, projlen, end, start) != 0)
+    return -1;
+
+  data[0] = 'F';
+
+  return 0;
+}
+
+/*
+ * Convert a time to a string.
+ *
+ * On success, dst contains a 14 character ISO8601 UTC date and time like
+ * "20200131T0900Z" and a terminating null. Seconds are truncated. The date is
+ * computed from the number of days since the epoch, without gmtime(3), because
+ * this is done for every file name that is built.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+timetostr(char *dst, const time_t src, const size_t dstsize)
+{
+  long days, secs, y;
+  int m, d, hh, mm;
+
+  if (dstsize <= 14) {
+    log_warnx("%s: dstsize too small: %zu", __func__, dstsize);
+    return -1;
+  }
+
+  days = src / SECSPERDAY;
+  secs = src % SECSPERDAY;
+  if (secs < 0) {
+    secs += SECSPERDAY;
+    days--;
+  }
+
+  civil_from_days(days, &y, &m, &d);
+
+  if (y < 0 || y > 9999) {
+    log_warnx("%s: year out of range: %ld", __func__, y);
+    return -1;
+  }
+
+  hh = secs / 3600;
+  mm = secs % 3600 / 60;
+
+  dst[0] = '0' + y / 1000;
+  dst[1] = '0' + y / 100 % 10;
+  dst[2] = '0' + y / 10 % 10;
+  dst[3] = '0' + y % 10;
+  dst[4] = '0' + m / 10;
+  dst[5] = '0' + m % 10;
+  dst[6] = '0' + d / 10;
+  dst[7] = '0' + d % 10;
+  dst[8] = 'T';
+  dst[9] = '0' + hh / 10;
+  dst[10] = '0' + hh % 10;
+  dst[11] = '0' + mm / 10;
+  dst[12] = '0' + mm % 10;
+  dst[13] = 'Z';
+  dst[14] = '\0';
+
+  return 0;
+}
+
+/*
+ * Convert the first 14 characters of src, an ISO8601 UTC date and time like
+ * "20200131T0900Z", to a time. This is the inverse of timetostr(). Every digit
+ * and field is checked, a day that does not exist in its month is an error.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+strtotime(const char *src, time_t *dst)
+{
+  static const int mdays[] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  static const char pat[] = "ddddddddTddddZ";
+  long y;
+  int i, m, d, hh, mm;
+
+  for (i = 0; i < 14; i++) {
+    if (pat[i] == 'd') {
+      if (src[i] < '0' || src[i] > '9')
+        return -1;
+    } else if (src[i] != pat[i]) {
+      return -1;
+    }
+  }
+
+  y = (src[0] - '0') * 1000 + (src[1] - '0') * 100 + (src[2] - '0') * 10 + (src[3] - '0');
+  m = (src[4] - '0') * 10 + (src[5] - '0');
+  d = (src[6] - '0') * 10 + (src[7] - '0');
+  hh = (src[9] - '0') * 10 + (src[10] - '0');
+  mm = (src[11] - '0') * 10 + (src[12] - '0');
+
+  if (m < 1 || m > 12 || d < 1 || d > mdays[m - 1] || hh > 23 || mm > 59)
+    return -1;
+
+  /* february 29 only in leap years */
+  if (m == 2 && d == 29 && (y % 4 != 0 || (y % 100 == 0 && y % 400 != 0)))
+    return -1;
+
+  *dst = (time_t)days_from_civil(y, m, d) * SECSPERDAY + hh * 3600 + mm * 60;
+
+  return 0;
+}
+
+/*
+ * Return the number of days since 1970-01-01 of the date y-m-d in the
+ * proleptic Gregorian calendar. The year is shifted to start in march, so that
+ * the leap day is the last day of the year, and is counted in eras of 400
+ * years of 146097 days each.
+ */
+static long
+days_from_civil(long y, int m, int d)
+{
+  long era, yoe, doy, doe;
+
+  if (m <= 2)
+    y--;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+  return era * 146097 + doe - 719468;
+}
+
+/*
+ * Convert a number of days since 1970-01-01 to a date in the proleptic
+ * Gregorian calendar. This is the inverse of days_from_civil().
+ */
+static void
+civil_from_days(long days, long *y, int *m, int *d)
+{
+  long era, doe, yoe, doy, mp;
+
+  days += 719468;
+  era = (days >= 0 ? days : days - 146096) / 146097;
+  doe = days - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = yoe + era * 400 + (*m <= 2);
+}
+
+DBT *
+idx_copy_key(const DBT *key)
+{
+  DBT *r;
+  if ((r = malloc(sizeof(DBT))) == NULL)
+    err(1, "%s: malloc", __func__);
+  if ((r->data = malloc(key->size)) == NULL)
+    err(1, "%s: malloc data", __func__);
+  r->size = key->size;
+  memcpy(r->data, key->data, key->size);
+
+  return r;
+}
+
+/* return 0 on success, -1 on error */
+int
+idx_free_key(const DBT **key)
+{
+  if (*key == NULL)
+    return 0;
+
+  free((*key)->data);
+  free((void *)(*key));
+  *key = NULL;
+
+  return 0;
+}
+
+/* return pointer to project name in a key */
+char *
+idx_key_proj(const DBT *key)
+{
+  if (is_d(key))
+    return dkey_proj(key);
+  else if (is_p(key))
+    return pkey_proj(key);
+  else if (is_f(key))
+    return fkey_proj(key);
+
+  errx(1, "%s: illegal key", __func__);
+
+  return NULL;
+}
+
+/* return start date */
+time_t
+idx_key_start(const DBT *key)
+{
+  if (is_d(key))
+    return dkey_start(key);
+  else if (is_p(key))
+    return pkey_start(key);
+  else if (is_f(key))
+    return fkey_start(key);
+
+  errx(1, "%s: illegal key", __func__);
+
+  return 0;
+}
+
+/* return end date */
+time_t
+idx_key_end(const DBT *key)
+{
+  if (is_d(key))
+    return dkey_end(key);
+  else if (is_p(key))
+    return pkey_end(key);
+  else if (is_f(key))
+    return fkey_end(key);
+
+  errx(1, "%s: illegal key", __func__);
+
+  return 0;
+}
+
+/* return pointer to project name in dkey */
+static char *
+pkey_proj(const DBT *key)
+{
+  return &((char *)key->data)[1];
+}
+
+/* return start date */
+static time_t
+pkey_start(const DBT *key)
+{
+  uint32_t t;
+
+  memcpy(&t, key->data + key->size - 2 * sizeof(t), sizeof(t));
+
+  return (time_t)ntohl(t);
+}
+
+/* return end date */
+static time_t
+pkey_end(const DBT *key)
+{
+  uint32_t t;
+
+  memcpy(&t, key->data + key->size - sizeof(t), sizeof(t));
+
+  return (time_t)ntohl(t);
+}
+
+/* return pointer to project name in dkey */
+static char *
+dkey_proj(const DBT *key)
+{
+  return &((char *)key->data)[1 + sizeof(uint32_t) + sizeof(uint32_t)];
+}
+
+/* return start date */
+static time_t
+dkey_start(const DBT *key)
+{
+  uint32_t t;
+
+  memcpy(&t, key->data + 1, sizeof(t));
+
+  return (time_t)ntohl(t);
+}
+
+/* return end date */
+static time_t
+dkey_end(const DBT *key)
+{
+  uint32_t t;
+
+  memcpy(&t, key->data + 1 + sizeof(t), sizeof(t));
+
+  return (time_t)ntohl(t);
+}
+
+/* return pointer to project name in fkey */
+static char *
+fkey_proj(const DBT *key)
+{
+  return dkey_proj(key);
+}
+
+/* return start date */
+static time_t
+fkey_start(const DBT *key)
+{
+  /* the start of a fkey is stored where a dkey stores the end */
+  return dkey_end(key);
+}
+
+/* return end date */
+static time_t
+fkey_end(const DBT *key)
+{
+  return dkey_start(key);
+}
+
+/*
+ * Determine the number of characters that precede the terminating null byte of
+ * the project name.
+ */
+static size_t
+proj_len(const DBT *key)
+{
+  return key->size - sizeof(uint32_t) - sizeof(uint32_t) - 1;
+}
+
+/*
+ * Recalculate all project names in a buffer of the handle. The list is valid
+ * until the next call with the same handle.
+ */
+char **
+idx_uniq_proj(idx_t *idx)
+{
+  int r;
+  DBT key;
+  char keydata[MAXKEYSIZE];
+  char *name;
+
+  mtx_lock(idx);
+
+  free_uniq_proj(idx);
+
+  if (prange_start(&key, keydata, sizeof keydata, "", 0, 0) != 0)
+    errx(1, "%s: prange_start", __func__);
+
+  while ((r = idx->db->seq(idx->db, &key, NULL, R_CURSOR)) == 0) {
+    /* stop at the first key beyond the P index */
+    if (!is_p(&key))
+      break;
+
+    idx->proj_names = realloc(idx->proj_names, (idx->proj_name_next + 1) * sizeof(char *));
+    name = pkey_proj(&key);
+    idx->proj_names[idx->proj_name_next++] = strdup(name);
+
+    if (prange_end(&key, keydata, sizeof keydata, name, strlen(name), 0) != 0)
+      errx(1, "%s: prange_end", __func__);
+  }
+  if (r == -1)
+    err(1, "%s: idx->seq set cursor", __func__);
+
+  idx->proj_names = realloc(idx->proj_names, (idx->proj_name_next + 1) * sizeof(char *));
+  idx->proj_names[idx->proj_name_next] = NULL;
+
+  mtx_unlock(idx);
+
+  return idx->proj_names;
+}
+
+/* free proj_names and reset proj_name_next */
+static void
+free_uniq_proj(idx_t *idx)
+{
+  int i;
+
+  if (idx->proj_names == NULL)
+    return;
+
+  for (i = 0; idx->proj_names[i]; i++) {
+    free(idx->proj_names[i]);
+    idx->proj_names[i] = NULL;
+  }
+
+  free(idx->proj_names);
+  idx->proj_names = NULL;
+  idx->proj_name_next = 0;
+}
+
+/*
+ * Calculate the total number of minutes and number of entries, optionally
+ * filtered by project name, and/or minimum and/or maximum start time.
+ *
+ * count will contain the number of entries found
+ * summ will contain the total number of minutes in all entries
+ *
+ * Return 0 on success, -1 on error.
+ */
+int
+idx_count(idx_t *idx, const idx_itopts_t *opts, int *count, int *summ)
+{
+  idx_cursor_t cur;
+  idx_entry_t ents[IDXBATCH];
+  double mtotal;
+  int i, n, ecount;
+
+  if (idx_cursor_open(idx, &cur, opts) != 0)
+    return -1;
+
+  mtotal = 0.0;
+  ecount = 0;
+  while ((n = idx_cursor_next(&cur, ents, IDXBATCH)) > 0) {
+    for (i = 0; i < n; i++)
+      mtotal += difftime(ents[i].end, ents[i].start) / 60;
+    ecount += n;
+  }
+
+  idx_cursor_close(&cur);
+
+  if (n == -1)
+    return -1;
+
+  *summ = mtotal;
+  *count = ecount;
+
+  return 0;
+}
+
+/*
+ * Count the number of entries that overlap with the range [start, end). If
+ * skip is not NULL, the entry it refers to is not counted. Uses the F index so
+ * only entries that end after start are visited.
+ *
+ * Return the number of overlapping entries.
+ */
+int
+idx_overlaps(idx_t *idx, time_t start, time_t end, const DBT *skip)
+{
+  idx_cursor_t cur;
+  idx_entry_t ents[IDXBATCH];
+  uint32_t maxdur;
+  int i, n, count;
+
+  mtx_lock(idx);
+  maxdur = idx->maxdur;
+  mtx_unlock(idx);
+
+  /* no overlapping entry can end after the longest entry that starts at end */
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    end, /* time_t maxstart; */
+    1, /* int includemin; */
+    0, /* int includemax; */
+    0, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    NULL, /* DBT *offset; */
+    start + 1, /* time_t minend; */
+    end + maxdur, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+
+  if (idx_cursor_open(idx, &cur, &opts) != 0)
+    return 0;
+
+  count = 0;
+  while ((n = idx_cursor_next(&cur, ents, IDXBATCH)) > 0) {
+    for (i = 0; i < n; i++) {
+      if (skip && ents[i].start == idx_key_start(skip) && ents[i].end == idx_key_end(skip) &&
+          strcmp(ents[i].proj, idx_key_proj(skip)) == 0)
+        continue;
+      count++;
+    }
+  }
+
+  idx_cursor_close(&cur);
+
+  return count;
+}
+
+/*
+ * Search the first entry after from, or before from if reverse is set, with a
+ * description that matches every term of query. Only entries that match the
+ * times and projects of opts are considered. If from is NULL, search from the
+ * first or, if reverse is set, from the last entry.
+ *
+ * The terms of the query are separated by white space and case is ignored. A
+ * term of at least three bytes may occur anywhere in the description and is
+ * searched with the trigram index, it never matches if it is longer than
+ * MAXDESC bytes. A shorter term is split in words that must each start a word
+ * of the description and is searched with the word index.
+ * Both yield the entries of a term in the order of the D index, so a match is
+ * found by seeking each term to the last candidate in turn, until they all
+ * agree.
+ *
+ * If found, a copy of the key is stored in found, a pkey if opts has a project
+ * or a list of projects, otherwise a dkey.
+ *
+ * Return 0 if found, 1 if not found, -1 on error.
+ */
+int
+idx_search(idx_t *idx, const char *query, const DBT *from, int reverse, const idx_itopts_t *opts, DBT **found)
+{
+  DBT pos, cand, pkey;
+  struct qterm terms[MAXQUERY];
+  char term[MAXWORD], posdata[MAXKEYSIZE], canddata[MAXKEYSIZE], pkeydata[MAXKEYSIZE];
+  const char *p;
+  size_t nterms, len, i;
+  time_t start;
+  int incl, r;
+
+  for (nterms = 0; nterms < MAXQUERY; query += len) {
+    query += strspn(query, " \t\n");
+    if ((len = strcspn(query, " \t\n")) == 0)
+      break;
+
+    if (len >= 3) {
+      /* only the first MAXDESC bytes of a description are searched */
+      if (len > MAXDESC)
+        return 1;
+      terms[nterms].len = len;
+      memcpy(terms[nterms].s, query, len);
+      terms[nterms].s[terms[nterms].len] = '\0';
+      lower(terms[nterms].s, terms[nterms].len);
+      terms[nterms++].substr = 1;
+      continue;
+    }
+
+    memcpy(term, query, len);
+    term[len] = '\0';
+    for (p = term; nterms < MAXQUERY; nterms++) {
+      if ((terms[nterms].len = next_word(&p, terms[nterms].s, MAXWORD)) == 0)
+        break;
+      terms[nterms].substr = 0;
+    }
+  }
+
+  if (nterms == 0)
+    return 1;
+
+  if (from != NULL && todkey(&pos, posdata, from, sizeof posdata) == -1) {
+    log_warnx("%s: todkey", __func__);
+    return -1;
+  }
+
+  mtx_lock(idx);
+
+  incl = 0;
+  for (;;) {
+    if ((r = term_next(idx, &terms[0], from ? &pos : NULL, incl, reverse, &cand, canddata)) != 0)
+      break;
+
+    /* move on to the first entry that all other terms agree on */
+    for (i = 1; i < nterms; i++) {
+      if ((r = term_next(idx, &terms[i], &cand, 1, reverse, &pos, posdata)) != 0)
+        break;
+      if (entrycmp(&pos, &cand) != 0)
+        break;
+    }
+    if (r != 0)
+      break;
+
+    from = &pos;
+    if (i < nterms) {
+      incl = 1;
+      continue;
+    }
+
+    /* all terms match, check the other options */
+    if (key_matches(&cand, opts))
+      break;
+
+    /* no need to go past the times of opts */
+    start = dkey_start(&cand);
+    if (!reverse && opts->maxstart && start >= opts->maxstart) {
+      r = 1;
+      break;
+    }
+    if (reverse && opts->minstart && start < opts->minstart) {
+      r = 1;
+      break;
+    }
+
+    memcpy(posdata, canddata, cand.size);
+    pos.data = posdata;
+    pos.size = cand.size;
+    incl = 0;
+  }
+
+  mtx_unlock(idx);
+
+  if (r != 0)
+    return r;
+
+  if (opts->projs || (opts->proj && opts->proj[0])) {
+    if (dtopkey(&pkey, pkeydata, &cand, sizeof pkeydata) == -1)
+      errx(1, "%s: dtopkey", __func__);
+    *found = idx_copy_key(&pkey);
+  } else {
+    *found = idx_copy_key(&cand);
+  }
+
+  return 0;
+}
+
+/*
+ * Find the first entry that comes after pos, or before pos if reverse is set,
+ * with a word in its description that starts with prefix. If incl is set, pos
+ * itself is included. If pos is NULL, start at the first or last entry. Every
+ * word that starts with prefix is searched, the closest entry wins.
+ *
+ * NOTE: the handle must be locked.
+ *
+ * Return 0 if found and stored in res as a dkey, 1 if not found.
+ */
+static int
+prefix_next(idx_t *idx, const char *prefix, size_t prefixlen, const DBT *pos, int incl, int reverse, DBT *res, char *resdata)
+{
+  DBT key, data, cand;
+  char keydata[MAXTKEYSIZE], canddata[MAXKEYSIZE];
+  size_t wordlen;
+  int r, found;
+
+  found = 0;
+
+  /* seek to the first word that starts with prefix */
+  keydata[0] = 'T';
+  memcpy(keydata + 1, prefix, prefixlen);
+  key.data = keydata;
+  key.size = 1 + prefixlen;
+
+  for (;;) {
+    if ((r = idx->db->seq(idx->db, &key, &data, R_CURSOR)) == -1)
+      err(1, "%s: idx->seq", __func__);
+    if (r == 1 || key.size < 1 + prefixlen || memcmp(key.data, keydata, 1 + prefixlen) != 0)
+      break;
+
+    wordlen = strnlen((char *)key.data + 1, key.size - 1);
+    if (wordlen >= MAXWORD || 1 + wordlen + 1 >= key.size) {
+      log_warnx("%s: illegal tkey", __func__);
+      break;
+    }
+
+    /* the seek below moves the cursor, so remember the word first */
+    memcpy(keydata + 1, (char *)key.data + 1, wordlen);
+
+    if (word_next(idx, keydata + 1, wordlen, pos, incl, reverse, &cand, canddata) == 0) {
+      if (!found || (reverse ? entrycmp(&cand, res) > 0 : entrycmp(&cand, res) < 0)) {
+        memcpy(resdata, canddata, cand.size);
+        res->data = resdata;
+        res->size = cand.size;
+      }
+      found = 1;
+    }
+
+    /* skip to the next word, "\x01" sorts after the null of this word */
+    keydata[1 + wordlen] = '\x01';
+    key.data = keydata;
+    key.size = 1 + wordlen + 1;
+  }
+
+  return found ? 0 : 1;
+}
+
+/*
+ * Find the first entry that comes after pos, or before pos if reverse is set,
+ * with word in its description. If incl is set, pos itself is included. If pos
+ * is NULL, start at the first or last entry.
+ *
+ * NOTE: the handle must be locked.
+ *
+ * Return 0 if found and stored in res as a dkey, 1 if not found.
+ */
+static int
+word_next(idx_t *idx, const char *word, size_t wordlen, const DBT *pos, int incl, int reverse, DBT *res, char *resdata)
+{
+  DBT key, seek, data;
+  char seekdata[MAXTKEYSIZE];
+  int r;
+
+  if (pos) {
+    if (tkey_make(&seek, seekdata, sizeof seekdata, word, wordlen, pos) == -1)
+      errx(1, "%s: tkey_make", __func__);
+  } else {
+    /* all tkeys of the word are between its null and "\x01" */
+    seekdata[0] = 'T';
+    memcpy(seekdata + 1, word, wordlen);
+    seekdata[1 + wordlen] = reverse ? '\x01' : '\0';
+    seek.data = seekdata;
+    seek.size = 1 + wordlen + 1;
+  }
+
+  /* setting the cursor ascends to the first key that is equal or greater */
+  key = seek;
+  if ((r = idx->db->seq(idx->db, &key, &data, R_CURSOR)) == -1)
+    err(1, "%s: idx->seq", __func__);
+
+  if (reverse) {
+    if (r == 1)
+      r = idx->db->seq(idx->db, &key, &data, R_LAST);
+    else if (!incl || !pos || key.size != seek.size || memcmp(key.data, seek.data, seek.size) != 0)
+      r = idx->db->seq(idx->db, &key, &data, R_PREV);
+  } else if (r == 0 && !incl && pos && key.size == seek.size && memcmp(key.data, seek.data, seek.size) == 0) {
+    r = idx->db->seq(idx->db, &key, &data, R_NEXT);
+  }
+
+  if (r == -1)
+    err(1, "%s: idx->seq", __func__);
+  if (r == 1)
+    return 1;
+
+  /* must be a tkey of the same word */
+  if (key.size <= 1 + wordlen + 1 || memcmp(key.data, seekdata, 1 + wordlen) != 0 || ((char *)key.data)[1 + wordlen] != '\0')
+    return 1;
+
+  res->size = key.size - (1 + wordlen + 1);
+  if (res->size > MAXKEYSIZE)
+    errx(1, "%s: illegal tkey", __func__);
+  memcpy(resdata, (char *)key.data + 1 + wordlen + 1, res->size);
+  res->data = resdata;
+
+  return 0;
+}
+
+/*
+ * Copy the next word of s into word and advance s past it. A word is a sequence
+ * of letters and digits, where every byte of a multibyte character counts as a
+ * letter. The word is converted to lower case and cut to wordsize - 1 bytes.
+ *
+ * Return the length of the word, 0 if there are no more words.
+ */
+static size_t
+next_word(const char **s, char *word, size_t wordsize)
+{
+  const unsigned char *p;
+  size_t n;
+
+  p = (const unsigned char *)*s;
+  while (*p && *p < 0x80 && !isalnum(*p))
+    p++;
+
+  for (n = 0; *p && (*p >= 0x80 || isalnum(*p)); p++)
+    if (n < wordsize - 1)
+      word[n++] = tolower(*p);
+  word[n] = '\0';
+
+  *s = (const char *)p;
+
+  return n;
+}
+
+/*
+ * Add or remove a tkey for every word in the description of an entry. The
+ * handle must be locked for a change.
+ */
+static void
+words_update(idx_t *idx, const char *desc, const DBT *dkey, int add)
+{
+  DBT key, data;
+  char word[MAXWORD], keydata[MAXTKEYSIZE];
+  size_t n;
+
+  data.data = NULL;
+  data.size = 0;
+
+  while ((n = next_word(&desc, word, sizeof word)) > 0) {
+    if (tkey_make(&key, keydata, sizeof keydata, word, n, dkey) == -1)
+      errx(1, "%s: tkey_make", __func__);
+
+    /* a word can occur more than once */
+    if (add) {
+      if (idx->db->put(idx->db, &key, &data, 0) == -1)
+        err(1, "%s: put tk", __func__);
+    } else {
+      if (idx->db->del(idx->db, &key, 0) == -1)
+        err(1, "%s: del tk", __func__);
+    }
+  }
+}
+
+/*
+ * Add or remove the start date of an entry to the posting list of every
+ * trigram in its description. While the index is built the trigrams are only
+ * collected, see grams_flush(). The handle must be locked for a change.
+ */
+static void
+grams_update(idx_t *idx, const char *desc, const DBT *dkey, int add)
+{
+  uint64_t grams[MAXDESC];
+  char low[MAXDESC + 1], tri[3];
+  uint32_t start;
+  size_t len, n, i;
+
+  start = dkey_start(dkey);
+
+  if ((len = strlen(desc)) < 3)
+    return;
+  memcpy(low, desc, len + 1);
+  lower(low, len);
+
+  /* every trigram only once, even if it occurs more than once */
+  for (i = 0; i + 3 <= len; i++)
+    grams[i] = (uint64_t)((unsigned char)low[i] << 16 | (unsigned char)low[i + 1] << 8 | (unsigned char)low[i + 2]) << 32 | start;
+  qsort(grams, i, sizeof(grams[0]), gramcmp);
+
+  for (n = 0, i = 0; i + 3 <= len; i++) {
+    if (n > 0 && grams[i] == grams[n - 1])
+      continue;
+    grams[n++] = grams[i];
+  }
+
+  if (idx->bulk) {
+    if (idx->ngrams + n > idx->gramsize) {
+      while (idx->ngrams + n > idx->gramsize)
+        idx->gramsize = idx->gramsize ? idx->gramsize * 2 : 1 << 16;
+      if ((idx->grams = reallocarray(idx->grams, idx->gramsize, sizeof(*idx->grams))) == NULL)
+        err(1, "%s: reallocarray", __func__);
+    }
+    memcpy(idx->grams + idx->ngrams, grams, n * sizeof(grams[0]));
+    idx->ngrams += n;
+    return;
+  }
+
+  for (i = 0; i < n; i++) {
+    tri[0] = grams[i] >> 48;
+    tri[1] = grams[i] >> 40;
+    tri[2] = grams[i] >> 32;
+    if (add)
+      gram_add(idx, tri, start);
+    else
+      gram_del(idx, tri, start);
+  }
+}
+
+/*
+ * Write the posting lists of all trigrams that are collected while the index
+ * was built, in blocks of GRAMBLOCK start dates.
+ */
+static void
+grams_flush(idx_t *idx)
+{
+  uint32_t *starts;
+  char tri[3];
+  size_t i, j, k, end, n;
+
+  qsort(idx->grams, idx->ngrams, sizeof(*idx->grams), gramcmp);
+
+  for (i = 0; i < idx->ngrams; i = end) {
+    /* all pairs of one trigram */
+    for (end = i + 1; end < idx->ngrams && idx->grams[end] >> 32 == idx->grams[i] >> 32; end++)
+      ;
+
+    tri[0] = idx->grams[i] >> 48;
+    tri[1] = idx->grams[i] >> 40;
+    tri[2] = idx->grams[i] >> 32;
+
+    for (j = i; j < end; j += n) {
+      /* keep all pairs with the same start date in one block */
+      n = end - j < GRAMBLOCK ? end - j : GRAMBLOCK;
+      while (j + n < end && (uint32_t)idx->grams[j + n] == (uint32_t)idx->grams[j + n - 1])
+        n++;
+      starts = block_reserve(idx, n);
+      for (k = 0; k < n; k++)
+        starts[k] = idx->grams[j + k];
+      block_put(idx, tri, starts, n);
+    }
+  }
+
+  free(idx->grams);
+  idx->grams = NULL;
+  idx->ngrams = 0;
+  idx->gramsize = 0;
+}
+
+/* compare two trigram and start date pairs, for qsort */
+static int
+gramcmp(const void *a, const void *b)
+{
+  uint64_t g1 = *(const uint64_t *)a, g2 = *(const uint64_t *)b;
+
+  return g1 < g2 ? -1 : g1 > g2;
+}
+
+/*
+ * Determine where to split n ascending start dates, so that the first part
+ * holds about want start dates and no start date is in both parts.
+ *
+ * Return the number of start dates in the first part, n if it can't be split.
+ */
+static size_t
+gram_split(const uint32_t *starts, size_t n, size_t want)
+{
+  size_t m;
+
+  m = want;
+  while (m > 0 && m < n && starts[m] == starts[m - 1])
+    m++;
+  if (m == n)
+    for (m = n / 2; m > 0 && starts[m] == starts[m - 1]; m--)
+      ;
+
+  return m == 0 ? n : m;
+}
+
+/* create a gkey of a trigram and the first start date of a block */
+static void
+gkey_make(DBT *key, char *data, const char *tri, const uint32_t first)
+{
+  uint32_t t;
+
+  data[0] = 'G';
+  memcpy(data + 1, tri, 3);
+  t = htonl(first);
+  memcpy(data + 1 + 3, &t, sizeof(t));
+
+  key->data = data;
+  key->size = 1 + 3 + sizeof(t);
+}
+
+/* write n ascending start dates as one block of the posting list of tri */
+static void
+block_put(idx_t *idx, const char *tri, const uint32_t *starts, size_t n)
+{
+  DBT key, data;
+  unsigned char *buf;
+  char keydata[1 + 3 + sizeof(uint32_t)];
+  uint32_t prev, d;
+  size_t i, len;
+
+  if (n == 0)
+    errx(1, "%s: illegal block size: %zu", __func__, n);
+
+  /* every difference takes at most five bytes */
+  if (n * 5 > idx->blockbufsize) {
+    idx->blockbufsize = n * 5;
+    if ((idx->blockbuf = realloc(idx->blockbuf, idx->blockbufsize)) == NULL)
+      err(1, "%s: realloc", __func__);
+  }
+  buf = idx->blockbuf;
+
+  gkey_make(&key, keydata, tri, starts[0]);
+
+  for (len = 0, prev = starts[0], i = 0; i < n; i++) {
+    for (d = starts[i] - prev; d >= 0x80; d >>= 7)
+      buf[len++] = d | 0x80;
+    buf[len++] = d;
+    prev = starts[i];
+  }
+
+  data.data = buf;
+  data.size = len;
+
+  if (idx->db->put(idx->db, &key, &data, 0) == -1)
+    err(1, "%s: put gk", __func__);
+}
+
+/*
+ * Make room for at least n start dates in the block buffer of the handle.
+ *
+ * Return the block buffer.
+ */
+static uint32_t *
+block_reserve(idx_t *idx, size_t n)
+{
+  if (n > idx->blocksize) {
+    idx->blocksize = n < 2 * GRAMBLOCK ? 2 * GRAMBLOCK : n;
+    if ((idx->block = reallocarray(idx->block, idx->blocksize, sizeof(*idx->block))) == NULL)
+      err(1, "%s: reallocarray", __func__);
+  }
+
+  return idx->block;
+}
+
+/*
+ * Decode a block of a posting list into the block buffer of the handle, with
+ * room for one more start date. The number of start dates is stored in n.
+ *
+ * Return the block buffer.
+ */
+static uint32_t *
+block_decode(idx_t *idx, const DBT *key, const DBT *data, size_t *n)
+{
+  const unsigned char *p, *end;
+  uint32_t *starts, t, d;
+  size_t i;
+  int shift;
+
+  memcpy(&t, (char *)key->data + 1 + 3, sizeof(t));
+  t = ntohl(t);
+
+  /* every start date takes at least one byte */
+  starts = block_reserve(idx, data->size + 1);
+
+  p = data->data;
+  end = p + data->size;
+  for (i = 0; p < end; i++) {
+    for (d = 0, shift = 0; p < end && *p & 0x80; p++, shift += 7)
+      d |= (uint32_t)(*p & 0x7f) << shift;
+    if (p == end)
+      errx(1, "%s: illegal block", __func__);
+    d |= (uint32_t)*p++ << shift;
+    t += d;
+    starts[i] = t;
+  }
+
+  *n = i;
+
+  return starts;
+}
+
+/*
+ * Read the block of the posting list of tri that contains t, the block with the
+ * greatest first start date that is not after t. The start dates are stored in
+ * starts, see block_decode().
+ *
+ * NOTE: the handle must be locked.
+ *
+ * Return 0 if found, 1 if not found.
+ */
+static int
+block_get(idx_t *idx, const char *tri, const uint32_t t, uint32_t **starts, size_t *n)
+{
+  DBT key, data, seek;
+  char seekdata[1 + 3 + sizeof(uint32_t)];
+  int r;
+
+  gkey_make(&seek, seekdata, tri, t);
+
+  key = seek;
+  if ((r = idx->db->seq(idx->db, &key, &data, R_CURSOR)) == -1)
+    err(1, "%s: idx->seq", __func__);
+
+  if (r == 1)
+    r = idx->db->seq(idx->db, &key, &data, R_LAST);
+  else if (key.size != seek.size || memcmp(key.data, seek.data, seek.size) != 0)
+    r = idx->db->seq(idx->db, &key, &data, R_PREV);
+
+  if (r == -1)
+    err(1, "%s: idx->seq", __func__);
+  if (r == 1 || key.size != seek.size || memcmp(key.data, seek.data, 1 + 3) != 0)
+    return 1;
+
+  *starts = block_decode(idx, &key, &data, n);
+
+  return 0;
+}
+
+/*
+ * Read the first block of the posting list of tri that starts after t. The
+ * start dates are stored in starts, see block_decode().
+ *
+ * NOTE: the handle must be locked.
+ *
+ * Return 0 if found, 1 if not found.
+ */
+static int
+block_after(idx_t *idx, const char *tri, const uint32_t t, uint32_t **starts, size_t *n)
+{
+  DBT key, data;
+  char keydata[1 + 3 + sizeof(uint32_t)];
+  int r;
+
+  if (t == UINT32_MAX)
+    return 1;
+
+  gkey_make(&key, keydata, tri, t + 1);
+
+  if ((r = idx->db->seq(idx->db, &key, &data, R_CURSOR)) == -1)
+    err(1, "%s: idx->seq", __func__);
+  if (r == 1 || key.size != sizeof(keydata) || memcmp(key.data, keydata, 1 + 3) != 0)
+    return 1;
+
+  *starts = block_decode(idx, &key, &data, n);
+
+  return 0;
+}
+
+/*
+ * Add a start date to the posting list of tri. A block that grows beyond
+ * GRAMBLOCK start dates is split in two. The handle must be locked for a
+ * change.
+ */
+static void
+gram_add(idx_t *idx, const char *tri, const uint32_t start)
+{
+  DBT key;
+  char keydata[1 + 3 + sizeof(uint32_t)];
+  uint32_t *starts;
+  size_t n, m, i;
+
+  if (block_get(idx, tri, start, &starts, &n) == 1) {
+    /* an earlier start date than any other is added to the first block */
+    if (block_after(idx, tri, start, &starts, &n) == 1) {
+      starts = block_reserve(idx, 1);
+      n = 0;
+    } else {
+      gkey_make(&key, keydata, tri, starts[0]);
+      if (idx->db->del(idx->db, &key, 0) == -1)
+        err(1, "%s: del gk", __func__);
+    }
+  }
+
+  for (i = n; i > 0 && starts[i - 1] > start; i--)
+    starts[i] = starts[i - 1];
+  starts[i] = start;
+  n++;
+
+  /* appending keeps the block full, otherwise it is split in half */
+  m = n;
+  if (n > GRAMBLOCK)
+    m = gram_split(starts, n, i == n - 1 ? GRAMBLOCK : n / 2);
+  block_put(idx, tri, starts, m);
+  if (m < n)
+    block_put(idx, tri, starts + m, n - m);
+}
+
+/*
+ * Remove a start date from the posting list of tri, a block that becomes empty
+ * is removed. The handle must be locked for a change.
+ */
+static void
+gram_del(idx_t *idx, const char *tri, const uint32_t start)
+{
+  DBT key;
+  char keydata[1 + 3 + sizeof(uint32_t)];
+  uint32_t *starts;
+  size_t n, i;
+
+  if (block_get(idx, tri, start, &starts, &n) == 1) {
+    log_warnx("%s: start date not found", __func__);
+    return;
   }
 
-  if (min)
-    s = 1 + projlen + 1 + sizeof(uint32_t);
-  else if (projlen)
-    s = 1 + projlen + 1;
+  for (i = 0; i < n && starts[i] != start; i++)
+    ;
+  if (i == n) {
+    log_warnx("%s: start date not found", __func__);
+    return;
+  }
+
+  /* the key changes with the first start date */
+  if (i == 0) {
+    gkey_make(&key, keydata, tri, starts[0]);
+    if (idx->db->del(idx->db, &key, 0) == -1)
+      err(1, "%s: del gk", __func__);
+  }
+
+  for (n--; i < n; i++)
+    starts[i] = starts[i + 1];
+
+  if (n > 0)
+    block_put(idx, tri, starts, n);
+}
+
+/*
+ * Find the first start date in the posting list of tri that is not before t, or
+ * not after t if reverse is set.
+ *
+ * NOTE: the handle must be locked.
+ *
+ * Return 0 if found and stored in res, 1 if not found.
+ */
+static int
+gram_next(idx_t *idx, const char *tri, const uint32_t t, int reverse, uint32_t *res)
+{
+  uint32_t *starts;
+  size_t n, i;
+
+  if (block_get(idx, tri, t, &starts, &n) == 0) {
+    /* the first start date of the block is not after t */
+    if (reverse) {
+      for (i = n; starts[i - 1] > t; i--)
+        ;
+      *res = starts[i - 1];
+      return 0;
+    }
+
+    for (i = 0; i < n; i++) {
+      if (starts[i] >= t) {
+        *res = starts[i];
+        return 0;
+      }
+    }
+  }
+
+  if (reverse || block_after(idx, tri, t, &starts, &n) == 1)
+    return 1;
+
+  *res = starts[0];
+
+  return 0;
+}
+
+/*
+ * Find the first entry that comes after pos, or before pos if reverse is set,
+ * that matches a term of a query. If incl is set, pos itself is included. If pos
+ * is NULL, start at the first or last entry.
+ *
+ * NOTE: the handle must be locked.
+ *
+ * Return 0 if found and stored in res as a dkey, 1 if not found.
+ */
+static int
+term_next(idx_t *idx, const struct qterm *term, const DBT *pos, int incl, int reverse, DBT *res, char *resdata)
+{
+  if (term->substr)
+    return substr_next(idx, term->s, term->len, pos, incl, reverse, res, resdata);
+
+  return prefix_next(idx, term->s, term->len, pos, incl, reverse, res, resdata);
+}
+
+/*
+ * Find the first entry that comes after pos, or before pos if reverse is set,
+ * with sub anywhere in its description. If incl is set, pos itself is included.
+ * If pos is NULL, start at the first or last entry. sub must be in lower case
+ * and at least three bytes long.
+ *
+ * The candidates are the start dates that are in the posting lists of all
+ * trigrams of sub. Only the descriptions of those entries are read.
+ *
+ * NOTE: the handle must be locked.
+ *
+ * Return 0 if found and stored in res as a dkey, 1 if not found.
+ */
+static int
+substr_next(idx_t *idx, const char *sub, size_t sublen, const DBT *pos, int incl, int reverse, DBT *res, char *resdata)
+{
+  uint32_t t, cand, next;
+  size_t i;
+
+  if (pos)
+    t = dkey_start(pos);
   else
-    s = 1;
+    t = reverse ? UINT32_MAX : 0;
 
-  if (datasize < s) {
+  for (;;) {
+    /* move on to the first start date that all trigrams agree on */
+    if (gram_next(idx, sub, t, reverse, &cand) != 0)
+      return 1;
+
+    for (i = 1; i + 3 <= sublen; i++) {
+      if (gram_next(idx, sub + i, cand, reverse, &next) != 0)
+        return 1;
+      if (next != cand)
+        break;
+    }
+
+    if (i + 3 <= sublen) {
+      t = next;
+      continue;
+    }
+
+    if (substr_verify(idx, sub, cand, pos, incl, reverse, res, resdata) == 0)
+      return 0;
+
+    if (reverse ? cand == 0 : cand == UINT32_MAX)
+      return 1;
+    t = reverse ? cand - 1 : cand + 1;
+  }
+}
+
+/*
+ * Find the first entry that starts at start and comes after pos, or before pos
+ * if reverse is set, with sub anywhere in its description. If incl is set, pos
+ * itself is included.
+ *
+ * NOTE: the handle must be locked.
+ *
+ * Return 0 if found and stored in res as a dkey, 1 if not found.
+ */
+static int
+substr_verify(idx_t *idx, const char *sub, const uint32_t start, const DBT *pos, int incl, int reverse, DBT *res, char *resdata)
+{
+  DBT key, data;
+  char keydata[MAXKEYSIZE], desc[MAXDESC + 1];
+  const char *s;
+  size_t n;
+  int r, cmp;
+
+  if (drange_start(&key, keydata, sizeof keydata, reverse ? start + 1 : start) == -1)
+    errx(1, "%s: drange_start", __func__);
+
+  if ((r = idx->db->seq(idx->db, &key, &data, R_CURSOR)) == -1)
+    err(1, "%s: idx->seq", __func__);
+  if (reverse)
+    r = idx->db->seq(idx->db, &key, &data, r == 1 ? R_LAST : R_PREV);
+
+  for (; r == 0; r = idx->db->seq(idx->db, &key, &data, reverse ? R_PREV : R_NEXT)) {
+    if (!is_d(&key) || key_within_bounds(&key) != 0 || dkey_start(&key) != start)
+      break;
+
+    if (pos) {
+      cmp = entrycmp(&key, pos);
+      if (reverse)
+        cmp = -cmp;
+      if (cmp < 0 || (cmp == 0 && !incl))
+        continue;
+    }
+
+    s = store_get(idx, &data, &n);
+    memcpy(desc, s, n);
+    desc[n] = '\0';
+
+    lower(desc, n);
+    if (strstr(desc, sub) != NULL) {
+      memcpy(resdata, key.data, key.size);
+      res->data = resdata;
+      res->size = key.size;
+      return 0;
+    }
+  }
+
+  if (r == -1)
+    err(1, "%s: idx->seq", __func__);
+
+  return 1;
+}
+
+/* convert the first n bytes of s to lower case, only ASCII letters change */
+static void
+lower(char *s, size_t n)
+{
+  size_t i;
+
+  for (i = 0; i < n; i++)
+    if (s[i] >= 'A' && s[i] <= 'Z')
+      s[i] += 'a' - 'A';
+}
+
+/*
+ * Create a tkey of a word and a dkey. word does not have to be null terminated.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+tkey_make(DBT *key, char *data, const size_t datasize, const char *word, const size_t wordlen, const DBT *dkey)
+{
+  if (wordlen == 0 || wordlen >= MAXWORD) {
+    log_warnx("%s: illegal word length: %zu", __func__, wordlen);
+    return -1;
+  }
+
+  if (datasize < 1 + wordlen + 1 + dkey->size) {
     log_warnx("%s: data size too small: %zu", __func__, datasize);
     return -1;
   }
 
-  data[0] = 'P';
+  data[0] = 'T';
+  memcpy(data + 1, word, wordlen);
+  data[1 + wordlen] = '\0';
+  memcpy(data + 1 + wordlen + 1, dkey->data, dkey->size);
 
-  /* only terminate if proj is given */
-  if (projlen) {
-    memcpy(data + 1, proj, projlen + 1);
+  key->data = data;
+  key->size = 1 + wordlen + 1 + dkey->size;
+
+  return 0;
+}
+
+/*
+ * Return pointer to string on success, or the empty string on error or if key
+ * is NULL
+ */
+char *
+idx_key_info(const DBT *key)
+{
+  static char dst[100];
+  static char start[15];
+
+  dst[0] = '\0';
+
+  if (key == NULL)
+    return dst;
+
+  if (timetostr(start, idx_key_start(key), sizeof start) != 0)
+    return dst;
+
+  if (snprintf(dst, sizeof dst, "%c%c%c len: %zu, %s, %s", is_d(key) ? 'D' : ' ', is_p(key) ? 'P' : ' ', is_f(key) ? 'F' : ' ', key->size, idx_key_proj(key), start) < 0)
+    return dst;
+
+  return dst;
+}
+
+/*
+ * Iterate, optionally filtered by project name, and/or minimum and/or maximum
+ * start time, and/or minimum and/or maximum end time, or only those entries
+ * that are active at a certain time. Furthermore an offset can be used. See
+ * idx_itopts_t for options.
+ *
+ * If a list of projects is given, the P range of each project is scanned and
+ * all ranges are merged in the order of the D index. If either proj or projs
+ * is set, pkeys are yielded, even if the planner chooses to scan the D or F
+ * index, and an offset may be a key of any index. See idx_last_plan() for the
+ * chosen index.
+ *
+ * NOTE: offset always overrules a min value or, in case reverse is true, a max
+ * value.
+ *
+ * The handle is locked during the iteration, so cb must not use it.
+ *
+ * last_seen is optional and can be null.
+ *
+ * Return 0 on success, -1 on error.
+ */
+int
+idx_iterate(idx_t *idx, const idx_itopts_t *opts, int (*cb)(DBT *), DBT **last_seen)
+{
+  idx_itopts_t mopt;
+  DBT skey, ekey;
+  const DBT *skeyp, *ekeyp;
+  const idx_itopts_t *match;
+  time_t lo, hi;
+  size_t l;
+  int pkeys, r;
+  char sdata[MAXKEYSIZE], edata[MAXKEYSIZE];
+
+  match = NULL;
+
+  /* set default options */
+  idx_itopts_t opt = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    0, /* time_t maxstart; */
+    0, /* int includemin; */
+    0, /* int includemax; */
+    0, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    NULL, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+
+  if (!opts)
+    opts = &opt;
+
+  /*
+   * Check and set upper and lower bounds of the index that is chosen by the
+   * planner. Either the F index, multiple merged P ranges, a single P range or
+   * the D index.
+   */
+  mtx_lock(idx);
+
+  idx->plan.statkeys = 0;
+  idx->plan.visited = 0;
+  idx->plan.fam = plan_opts(idx, &idx->plan, opts);
+
+  if (idx->plan.fam == 'M') {
+    r = merge(idx, opts, cb, last_seen);
+    plan_desc(idx->plandesc, sizeof idx->plandesc, &idx->plan);
+    log_warnx("%s: %s", __func__, idx->plandesc);
+    mtx_unlock(idx);
+    return r;
+  }
+
+  if (idx->plan.fam == 'F') {
+    end_window(idx, opts, &lo, &hi);
+
+    /* create a min key, an offset of another index is converted */
+    skeyp = &skey;
+    if (!opts->reverse && opts->offset) {
+      if (is_f(opts->offset))
+        skeyp = opts->offset;
+      else if (tofkey(&skey, sdata, opts->offset, sizeof sdata) != 0)
+        errx(1, "%s: tofkey", __func__);
+    } else {
+      if (frange_start(&skey, sdata, sizeof sdata, lo) != 0)
+        errx(1, "%s: frange_start", __func__);
+    }
+
+    /* create a max key */
+    ekeyp = &ekey;
+    if (opts->reverse && opts->offset) {
+      if (is_f(opts->offset))
+        ekeyp = opts->offset;
+      else if (tofkey(&ekey, edata, opts->offset, sizeof edata) != 0)
+        errx(1, "%s: tofkey", __func__);
+    } else {
+      if (frange_end(&ekey, edata, sizeof edata, hi) != 0)
+        errx(1, "%s: frange_end", __func__);
+    }
+
+    /* start time and project are not part of the range */
+    match = opts;
+  } else if (idx->plan.fam == 'P') {
+    l = strlen(opts->proj);
+
+    /* create a min key */
+    if (!opts->reverse && opts->offset) {
+      skeyp = opts->offset;
+    } else {
+      skeyp = &skey;
+      if (prange_start(&skey, sdata, sizeof sdata, opts->proj, l, opts->minstart) != 0)
+        errx(1, "%s: prange_start", __func__);
+    }
+
+    /* create a max key */
+    if (opts->reverse && opts->offset) {
+      ekeyp = opts->offset;
+    } else {
+      ekeyp = &ekey;
+      if (prange_end(&ekey, edata, sizeof edata, opts->proj, l, opts->maxstart) != 0)
+        errx(1, "%s: prange_end", __func__);
+    }
+  } else {
+    start_window(idx, opts, &lo, &hi);
+
+    /* create a min key, an offset of another index is converted */
+    skeyp = &skey;
+    if (!opts->reverse && opts->offset) {
+      if (is_d(opts->offset))
+        skeyp = opts->offset;
+      else if (todkey(&skey, sdata, opts->offset, sizeof sdata) != 0)
+        errx(1, "%s: todkey", __func__);
+    } else {
+      if (drange_start(&skey, sdata, sizeof sdata, lo) != 0)
+        errx(1, "%s: drange_start", __func__);
+    }
+
+    /* create a max key */
+    ekeyp = &ekey;
+    if (opts->reverse && opts->offset) {
+      if (is_d(opts->offset))
+        ekeyp = opts->offset;
+      else if (todkey(&ekey, edata, opts->offset, sizeof edata) != 0)
+        errx(1, "%s: todkey", __func__);
+    } else {
+      if (drange_end(&ekey, edata, sizeof edata, hi) != 0)
+        errx(1, "%s: drange_end", __func__);
+    }
 
-    if (min) {
-      m = htonl(min);
-      memcpy(data + 1 + projlen + 1, &m, sizeof(m));
+    /* filter on everything but the start time, which is bound by the range */
+    if (opts->at || opts->minend || opts->maxend || opts->projs || (opts->proj && opts->proj[0])) {
+      mopt = *opts;
+      mopt.minstart = 0;
+      mopt.maxstart = 0;
+      match = &mopt;
     }
   }
 
-  key->data = data;
-  key->size = s;
+  /* project filters yield pkeys, whichever index is scanned */
+  pkeys = idx->plan.fam != 'P' && (opts->projs || (opts->proj && opts->proj[0]));
+
+  iterate(idx, skeyp, opts->includemin, ekeyp, opts->includemax, opts->limit, opts->skip, opts->reverse, match, pkeys, cb, last_seen);
+  plan_desc(idx->plandesc, sizeof idx->plandesc, &idx->plan);
+  log_warnx("%s: %s", __func__, idx->plandesc);
+
+  mtx_unlock(idx);
 
   return 0;
 }
 
 /*
- * Create a key for the P index that ends at the given project and optionally
- * at the given end time. It is the callers responsibility to properly allocate
- * enough space. proj must be null terminated. projlen must be the number of
- * bytes that precede the first null byte. If proj is the empty string, it is
- * not appended to the key.
- *
- * If max is not 0, projlen must not be 0.
- *
- * Warning: this is not a valid pkey.
+ * Describe the index that was chosen for the last iteration or closed cursor,
+ * the estimated number of keys and the number of keys that were actually
+ * visited.
  *
- * Return 0 on success, -1 on error.
+ * Return pointer to a string that is valid until the next iteration or closed
+ * cursor of the handle.
  */
-static int
-prange_end(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t max)
+char *
+idx_last_plan(idx_t *idx)
 {
-  uint32_t m;
-  size_t s;
+  return idx->plandesc;
+}
 
-  if (proj[projlen] != '\0') {
-    log_warnx("%s: illegal project name: %zu", __func__, projlen);
-    return -1;
-  }
+/*
+ * Describe the rebuild of the index when the handle was opened, the number of
+ * files that were read, the time it took and the method that read them.
+ *
+ * Return pointer to a string that is empty if the index was not rebuilt.
+ */
+char *
+idx_last_rebuild(idx_t *idx)
+{
+  return idx->rebuilddesc;
+}
 
-  if (max && !projlen) {
-    log_warnx("%s: if max is not 0, projlen must not be 0", __func__);
-    return -1;
+/*
+ * Describe a plan in dst.
+ */
+static void
+plan_desc(char *dst, size_t dstsize, const idx_plan_t *plan)
+{
+  const char *desc;
+
+  switch (plan->fam) {
+  case 'D':
+    desc = "date index";
+    break;
+  case 'F':
+    desc = "end index";
+    break;
+  case 'M':
+    desc = "merged project ranges";
+    break;
+  case 'P':
+    desc = "project index";
+    break;
+  default:
+    desc = "none";
   }
 
-  if (max)
-    s = 1 + projlen + 1 + sizeof(uint32_t);
-  else if (projlen)
-    s = 1 + projlen + 1;
+  if (plan->est)
+    snprintf(dst, dstsize, "%s, estimated %zu keys, visited %zu keys and %zu statistics", desc, plan->est, plan->visited, plan->statkeys);
   else
-    s = 1;
+    snprintf(dst, dstsize, "%s, visited %zu keys and %zu statistics", desc, plan->visited, plan->statkeys);
+}
 
-  if (datasize < s) {
-    log_warnx("%s: data size too small: %zu", __func__, datasize);
-    return -1;
-  }
+/*
+ * Choose the index that is expected to visit the least number of keys for the
+ * given options, based on the statistics per project and per day. Single P
+ * ranges and the F index are bound by time, so their cost is estimated by the
+ * number of entries of the project or the number of entries per day, scaled by
+ * the number of entries that start within the range of the D index. The
+ * estimate is saved in plan->est.
+ *
+ * Return 'D', 'F' or 'P', or 'M' if multiple P ranges must be merged.
+ */
+static int
+plan_opts(idx_t *idx, idx_plan_t *plan, const idx_itopts_t *opts)
+{
+  time_t lo, hi;
+  size_t n, cost, pcost, dcost, total;
+  int fam;
+
+  plan->est = 0;
+
+  if (opts->at || opts->minend || opts->maxend) {
+    /* an offset is bound to the F index */
+    if (opts->offset)
+      return 'F';
+
+    /* the number of entries per end day is approximated by their start day */
+    end_window(idx, opts, &lo, &hi);
+    cost = stat_days(idx, plan, lo, hi, SIZE_MAX);
+    fam = 'F';
+
+    start_window(idx, opts, &lo, &hi);
+    if ((dcost = stat_days(idx, plan, lo, hi, cost)) < cost) {
+      cost = dcost;
+      fam = 'D';
+    }
+  } else if (opts->projs || (opts->proj && opts->proj[0])) {
+    pcost = 0;
+    if (opts->projs) {
+      for (n = 0; opts->projs[n]; n++)
+        pcost += stat_proj(idx, plan, opts->projs[n]);
+      fam = 'M';
+    } else {
+      n = 1;
+      pcost = stat_proj(idx, plan, opts->proj);
+      fam = 'P';
+    }
 
-  data[0] = 'P';
+    /* a P range visits no more than the number of requested keys */
+    if (opts->limit)
+      pcost = min(pcost, opts->skip + opts->limit);
 
-  /* only terminate if proj is given */
-  if (projlen) {
-    memcpy(data + 1, proj, projlen + 1);
+    /* every P range costs a seek, and so does every batch of merged keys */
+    cost = pcost + SEEKCOST * (n + (fam == 'M' ? pcost / MERGEBUF : 0));
 
-    if (max) {
-      m = htonl(max);
-      memcpy(data + 1 + projlen + 1, &m, sizeof(m));
-    } else {
-      /* set null byte of project name to 0x01 */
-      data[s - 1]++;
+    /* the D index can only be cheaper if it has less keys than all P ranges */
+    start_window(idx, opts, &lo, &hi);
+    if ((dcost = stat_days(idx, plan, lo, hi, cost)) < cost) {
+      /* only part of the P ranges starts within the window */
+      if ((total = stat_total(idx)) && dcost < total) {
+        pcost = (pcost * dcost + total - 1) / total;
+        cost = pcost + SEEKCOST * (n + (fam == 'M' ? pcost / MERGEBUF : 0));
+      }
+
+      if (dcost < cost) {
+        cost = dcost;
+        fam = 'D';
+      }
     }
   } else {
-    /* set Q */
-    data[s - 1]++;
+    return 'D';
   }
 
-  key->data = data;
-  key->size = s;
+  plan->est = cost;
 
-  return 0;
+  return fam;
 }
 
 /*
- * Create a key for the D index that optionally starts at the given start time.
- * It is the callers responsibility to properly allocate enough space.
- *
- * Warning: this is not a valid dkey.
- *
- * Return 0 on success, -1 on error.
+ * Determine the range of start times [lo, hi) of all entries that match the
+ * iterator options. Both lo and hi are 0 if not bound.
  */
-static int
-drange_start(DBT *key, char *data, const size_t datasize, const time_t min)
+static void
+start_window(idx_t *idx, const idx_itopts_t *opts, time_t *lo, time_t *hi)
 {
-  uint32_t m;
-  size_t s;
-
-  if (min)
-    s = 1 + sizeof(uint32_t);
-  else
-    s = 1;
+  *lo = opts->minstart;
+  *hi = opts->maxstart;
 
-  if (datasize < s) {
-    log_warnx("%s: data size too small: %zu", __func__, datasize);
-    return -1;
+  /* an entry starts at most the longest duration before it ends */
+  if (opts->at) {
+    *lo = max(*lo, opts->at - (time_t)idx->maxdur);
+    *hi = *hi ? min(*hi, opts->at + 1) : opts->at + 1;
   }
+  if (opts->minend)
+    *lo = max(*lo, opts->minend - (time_t)idx->maxdur);
+  if (opts->maxend)
+    *hi = *hi ? min(*hi, opts->maxend) : opts->maxend;
 
-  data[0] = 'D';
+  if (*lo < 0)
+    *lo = 0;
+}
 
-  if (min) {
-    m = htonl(min);
-    memcpy(data + 1, &m, sizeof(m));
+/*
+ * Determine the range of end times [lo, hi) of all entries that match the
+ * iterator options. Both lo and hi are 0 if not bound.
+ */
+static void
+end_window(idx_t *idx, const idx_itopts_t *opts, time_t *lo, time_t *hi)
+{
+  /*
+   * An entry that is active at a certain time ends after it, but not later
+   * than the longest entry that starts at it.
+   */
+  if (opts->at) {
+    *lo = max(opts->minend, opts->at + 1);
+    *hi = opts->at + idx->maxdur + 1;
+    if (opts->maxend)
+      *hi = min(opts->maxend, *hi);
+  } else {
+    *lo = opts->minend;
+    *hi = opts->maxend;
   }
-
-  key->data = data;
-  key->size = s;
-
-  return 0;
 }
 
 /*
- * Create a key for the D index that optionally ends at the given end time. It
- * is the callers responsibility to properly allocate enough space.
- *
- * Warning: this is not a valid dkey.
+ * Check if a key matches the times and projects of the given iterator options.
  *
- * Return 0 on success, -1 on error.
+ * Return 1 if the key matches, 0 if not.
  */
 static int
-drange_end(DBT *key, char *data, const size_t datasize, const time_t max)
+key_matches(const DBT *key, const idx_itopts_t *opts)
 {
-  uint32_t m;
-  size_t s;
+  time_t start, end;
 
-  if (max)
-    s = 1 + sizeof(uint32_t);
-  else
-    s = 1;
+  start = idx_key_start(key);
+  end = idx_key_end(key);
 
-  if (datasize < s) {
-    log_warnx("%s: data size too small: %zu", __func__, datasize);
-    return -1;
+  if (opts->at && (start > opts->at || end <= opts->at))
+    return 0;
+  if (opts->minstart && start < opts->minstart)
+    return 0;
+  if (opts->maxstart && start >= opts->maxstart)
+    return 0;
+  if (opts->minend && end < opts->minend)
+    return 0;
+  if (opts->maxend && end >= opts->maxend)
+    return 0;
+  if (opts->projs) {
+    if (!in_projs(idx_key_proj(key), opts->projs))
+      return 0;
+  } else if (opts->proj && opts->proj[0] && strcmp(idx_key_proj(key), opts->proj) != 0) {
+    return 0;
   }
 
-  data[0] = 'D';
-
-  if (max) {
-    m = htonl(max);
-    memcpy(data + 1, &m, sizeof(m));
-  } else {
-    /* set E */
-    data[s - 1]++;
-  }
+  return 1;
+}
 
-  key->data = data;
-  key->size = s;
+/*
+ * Check if a project is in a null terminated list of projects.
+ *
+ * Return 1 if it is, 0 if not.
+ */
+static int
+in_projs(const char *proj, char **projs)
+{
+  for (; *projs; projs++)
+    if (strcmp(proj, *projs) == 0)
+      return 1;
 
   return 0;
 }
 
 /*
- * Create a valid pkey. It is the callers responsibility to properly allocate
- * enough space. proj must be null terminated. projlen must be the number of
- * bytes that precede the first null byte.
+ * Yield the pkey of each entry in opts->projs, in the order of the D index, by
+ * using a merging cursor. Options are interpreted the same as for iterate().
+ * The keys that are visited are counted in the plan of the handle.
+ *
+ * NOTE: should only be used via idx_iterate().
  *
  * Return 0 on success, -1 on error.
  */
 static int
-pkey_make(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t start, const time_t end)
+merge(idx_t *idx, const idx_itopts_t *opts, int (*cb)(DBT *), DBT **last_seen)
 {
-  uint32_t m;
-
-  if (proj[projlen] != '\0') {
-    log_warnx("%s: illegal project name: %zu", __func__, projlen);
-    return -1;
-  }
+  idx_cursor_t cur;
+  idx_entry_t ents[IDXBATCH];
+  DBT key;
+  char keydata[MAXKEYSIZE];
+  size_t skip, cb_called;
+  int i, n, proceed, seen;
 
-  if (datasize < 1 + projlen + 1 + sizeof(uint32_t) + sizeof(uint32_t)) {
-    log_warnx("%s: data size too small: %zu", __func__, datasize);
+  if (cursor_init(idx, &cur, opts, &idx->plan) != 0)
     return -1;
-  }
 
-  data[0] = 'P';
+  skip = opts->skip;
+  cb_called = 0;
+  proceed = 1;
+  seen = 0;
+  n = 0;
+  while (proceed == 1 && (n = cursor_merged(&cur, ents, IDXBATCH)) > 0) {
+    for (i = 0; i < n; i++) {
+      if (pkey_make(&key, keydata, sizeof keydata, ents[i].proj, strlen(ents[i].proj), ents[i].start, ents[i].end) != 0)
+        errx(1, "%s: pkey_make", __func__);
+      seen = 1;
+
+      if (skip > 0) {
+        skip--;
+      } else {
+        proceed = cb(&key);
+        cb_called++;
+        if (proceed != 1 || opts->limit == cb_called)
+          break;
+      }
+    }
 
-  memcpy(data + 1, proj, projlen + 1);
+    if (opts->limit && opts->limit == cb_called)
+      break;
+  }
+  if (proceed == -1)
+    err(1, "%s: cb log_error", __func__);
 
-  m = htonl(start);
-  memcpy(data + 1 + projlen + 1, &m, sizeof(m));
+  if (seen && last_seen != NULL)
+    *last_seen = idx_copy_key(&key);
 
-  m = htonl(end);
-  memcpy(data + 1 + projlen + 1 + sizeof(m), &m, sizeof(m));
+  idx->plan.visited = cur.plan.visited;
+  cursor_free(&cur);
 
-  key->data = data;
-  key->size = 1 + projlen + 1 + sizeof(m) + sizeof(m);
+  if (n == -1) {
+    log_warnx("%s: cursor_merged", __func__);
+    return -1;
+  }
 
   return 0;
 }
 
 /*
- * Create a valid dkey. It is the callers responsibility to properly allocate
- * enough space. proj must be null terminated. projlen must be the number of
- * bytes that precede the first null byte.
+ * Open a cursor that yields the entries that match the given options, see
+ * idx_itopts_t. The planner chooses which index is scanned and, unlike
+ * idx_iterate(), the cursor yields decoded entries so the scanned index is
+ * transparent to the caller. limit and skip are ignored.
+ *
+ * The cursor is positioned at the start of the range, or at the end if reverse
+ * is set. If an offset is given, the cursor is positioned right before it, or
+ * right after it if it should not be included. The strings in opts must stay
+ * valid until the cursor is closed.
+ *
+ * The handle is only locked during each call on the cursor, so multiple cursors
+ * can be used at the same time, but each cursor by one thread only.
  *
  * Return 0 on success, -1 on error.
  */
-static int
-dkey_make(DBT *key, char *data, const size_t datasize, const char *proj, const size_t projlen, const time_t start, const time_t end)
+int
+idx_cursor_open(idx_t *idx, idx_cursor_t *cur, const idx_itopts_t *opts)
 {
-  uint32_t m;
+  idx_plan_t plan;
+  int r;
 
-  if (proj[projlen] != '\0') {
-    log_warnx("%s: illegal project name: %zu", __func__, projlen);
-    return -1;
-  }
+  /* set default options */
+  idx_itopts_t opt = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    0, /* time_t maxstart; */
+    0, /* int includemin; */
+    0, /* int includemax; */
+    0, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    NULL, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
 
-  if (datasize < 1 + sizeof(uint32_t) + sizeof(uint32_t) + projlen + 1) {
-    log_warnx("%s: data size too small: %zu", __func__, datasize);
-    return -1;
-  }
+  if (!opts)
+    opts = &opt;
 
-  data[0] = 'D';
+  plan.statkeys = 0;
+  plan.visited = 0;
 
-  m = htonl(start);
-  memcpy(data + 1, &m, sizeof(m));
+  mtx_lock(idx);
+  plan.fam = plan_opts(idx, &plan, opts);
+  r = cursor_init(idx, cur, opts, &plan);
+  mtx_unlock(idx);
 
-  m = htonl(end);
-  memcpy(data + 1 + sizeof(m), &m, sizeof(m));
+  return r;
+}
 
-  memcpy(data + 1 + sizeof(m) + sizeof(m), proj, projlen + 1);
+/*
+ * Read at most n, but never more than IDXBATCH, entries in the direction of the
+ * cursor and move past them. The project names in ents are valid until the
+ * next call on the cursor.
+ *
+ * Return the number of entries read, 0 if there are no more, or -1 on error.
+ */
+int
+idx_cursor_next(idx_cursor_t *cur, idx_entry_t *ents, size_t n)
+{
+  int r;
 
-  key->data = data;
-  key->size = 1 + sizeof(m) + sizeof(m) + projlen + 1;
+  mtx_lock(cur->idx);
+  if (cur->fam == 'M')
+    r = cursor_merged(cur, ents, n);
+  else
+    r = cur->opts.reverse ? cursor_desc(cur, ents, n) : cursor_asc(cur, ents, n);
+  mtx_unlock(cur->idx);
 
-  return 0;
+  return r;
 }
 
 /*
- * Convert a time to a string.
+ * Read at most n, but never more than IDXBATCH, entries in the opposite
+ * direction of the cursor and move past them. Not supported by a cursor that
+ * merges multiple P ranges.
  *
- * On success, dst contains a 14 character ISO8601 UTC date and time.
+ * Return the number of entries read, 0 if there are no more, or -1 on error.
+ */
+int
+idx_cursor_prev(idx_cursor_t *cur, idx_entry_t *ents, size_t n)
+{
+  int r;
+
+  if (cur->fam == 'M') {
+    log_warnx("%s: a merging cursor can not move back", __func__);
+    return -1;
+  }
+
+  mtx_lock(cur->idx);
+  r = cur->opts.reverse ? cursor_asc(cur, ents, n) : cursor_desc(cur, ents, n);
+  mtx_unlock(cur->idx);
+
+  return r;
+}
+
+/*
+ * Position the cursor right before the given entry, whether it exists or not,
+ * in the order of the scanned index. The project of the entry is ignored by a
+ * cursor on the P index of one project.
  *
  * Return 0 on success, -1 on error.
  */
-static int
-timetostr(char *dst, const time_t src, const size_t dstsize)
+int
+idx_cursor_seek(idx_cursor_t *cur, const idx_entry_t *ent)
 {
-  struct tm *bd;
+  DBT key;
+  const char *proj;
+  size_t i;
 
-  if (dstsize <= 14) {
-    log_warnx("%s: dstsize too small: %zu", __func__, dstsize);
+  proj = ent->proj ? ent->proj : "";
+  if (cur->fam == 'P')
+    proj = cur->opts.proj;
+
+  if (cursor_key(&key, cur->pos, sizeof cur->pos, cur->fam, proj, ent->start, ent->end) != 0)
     return -1;
+  cur->possize = key.size;
+
+  if (cur->fam != 'M')
+    return 0;
+
+  /* restart every P range at the start time of the entry */
+  mtx_lock(cur->idx);
+  cur->nheap = 0;
+  for (i = 0; cur->opts.projs[i]; i++) {
+    cur->prs[i].nkeys = 0;
+    cur->prs[i].done = 0;
+    if (cur->opts.reverse)
+      cur->prs[i].hi = ent->start + 1;
+    else
+      cur->prs[i].lo = ent->start;
+    if (prange_fill(cur, &cur->prs[i]) > 0)
+      cur->heap[cur->nheap++] = &cur->prs[i];
   }
+  mtx_unlock(cur->idx);
 
-  if ((bd = gmtime(&src)) == NULL)
-    err(1, "%s: gmtime %lu", __func__, src);
+  for (i = cur->nheap / 2; i > 0; i--)
+    heap_down(cur->heap, cur->nheap, i - 1);
 
-  if (strftime(dst, dstsize, "%Y%m%dT%H%MZ", bd) == 0)
-    errx(1, "%s: strftime: %zu, src %lu", __func__, dstsize, src);
+  cur->skipto = 1;
+  cur->include = 1;
 
   return 0;
 }
 
+/*
+ * Return a copy of the key of an entry that was yielded by the cursor, from the
+ * index that idx_iterate() yields keys of for the same options. The copy must
+ * be freed with idx_free_key().
+ */
 DBT *
-idx_copy_key(const DBT *key)
+idx_cursor_key(const idx_cursor_t *cur, const idx_entry_t *ent)
 {
-  DBT *r;
-  if ((r = malloc(sizeof(DBT))) == NULL)
-    err(1, "%s: malloc", __func__);
-  if ((r->data = malloc(key->size)) == NULL)
-    err(1, "%s: malloc data", __func__);
-  r->size = key->size;
-  memcpy(r->data, key->data, key->size);
+  DBT key;
+  char keydata[MAXKEYSIZE];
+  int fam;
 
-  return r;
+  /* idx_iterate() yields pkeys under a project filter, whichever index is scanned */
+  fam = cur->fam;
+  if (cur->opts.projs || (cur->opts.proj && cur->opts.proj[0]))
+    fam = 'P';
+
+  if (cursor_key(&key, keydata, sizeof keydata, fam, ent->proj, ent->start, ent->end) != 0)
+    errx(1, "%s: cursor_key", __func__);
+
+  return idx_copy_key(&key);
 }
 
-/* return 0 on success, -1 on error */
-int
-idx_free_key(const DBT **key)
+/*
+ * Close a cursor and free all resources. The plan of the cursor becomes the last
+ * plan of the handle.
+ */
+void
+idx_cursor_close(idx_cursor_t *cur)
 {
-  if (*key == NULL)
-    return 0;
+  mtx_lock(cur->idx);
+  cur->idx->plan = cur->plan;
+  plan_desc(cur->idx->plandesc, sizeof cur->idx->plandesc, &cur->plan);
+  log_warnx("%s: %s", __func__, cur->idx->plandesc);
+  mtx_unlock(cur->idx);
 
-  free((*key)->data);
-  free((void *)(*key));
-  *key = NULL;
+  cursor_free(cur);
+}
 
-  return 0;
+/*
+ * Free the merged P ranges of a cursor.
+ */
+static void
+cursor_free(idx_cursor_t *cur)
+{
+  free(cur->heap);
+  free(cur->prs);
+  cur->heap = NULL;
+  cur->prs = NULL;
+  cur->nheap = 0;
 }
 
-/* return pointer to project name in a key */
-char *
-idx_key_proj(const DBT *key)
+/*
+ * Initialize a cursor on the index that is chosen by plan, which is one of 'D',
+ * 'F', 'P', or 'M' to merge multiple P ranges. The plan is copied to the cursor.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+cursor_init(idx_t *idx, idx_cursor_t *cur, const idx_itopts_t *opts, const idx_plan_t *plan)
 {
-  if (is_d(key))
-    return dkey_proj(key);
-  else if (is_p(key))
-    return pkey_proj(key);
+  DBT key;
+  time_t lo, hi;
+  size_t i, n;
+  int fam, include;
+
+  fam = plan->fam;
+
+  cur->idx = idx;
+  cur->plan = *plan;
+  cur->opts = *opts;
+  cur->fam = fam;
+  cur->filter = 0;
+  cur->prs = NULL;
+  cur->heap = NULL;
+  cur->nheap = 0;
+  cur->skipto = 0;
+  cur->include = 0;
+
+  switch (fam) {
+  case 'F':
+    end_window(idx, opts, &lo, &hi);
+    if (frange_start(&key, cur->min, sizeof cur->min, lo) != 0)
+      errx(1, "%s: frange_start", __func__);
+    cur->minsize = key.size;
+    if (frange_end(&key, cur->max, sizeof cur->max, hi) != 0)
+      errx(1, "%s: frange_end", __func__);
+    cur->maxsize = key.size;
+    cur->filter = 1;
+    break;
+  case 'P':
+    if (prange_start(&key, cur->min, sizeof cur->min, opts->proj, strlen(opts->proj), opts->minstart) != 0)
+      errx(1, "%s: prange_start", __func__);
+    cur->minsize = key.size;
+    if (prange_end(&key, cur->max, sizeof cur->max, opts->proj, strlen(opts->proj), opts->maxstart) != 0)
+      errx(1, "%s: prange_end", __func__);
+    cur->maxsize = key.size;
+    break;
+  case 'D':
+    start_window(idx, opts, &lo, &hi);
+    if (drange_start(&key, cur->min, sizeof cur->min, lo) != 0)
+      errx(1, "%s: drange_start", __func__);
+    cur->minsize = key.size;
+    if (drange_end(&key, cur->max, sizeof cur->max, hi) != 0)
+      errx(1, "%s: drange_end", __func__);
+    cur->maxsize = key.size;
+    cur->filter = opts->at || opts->minend || opts->maxend || opts->projs || (opts->proj && opts->proj[0]);
+    break;
+  case 'M':
+    /* bound by the P ranges */
+    cur->minsize = 0;
+    cur->maxsize = 0;
+    break;
+  default:
+    log_warnx("%s: illegal index: %d", __func__, fam);
+    return -1;
+  }
 
-  errx(1, "%s: illegal key", __func__);
+  /* the start time is bound by the range, which can be overruled by offset */
+  if (fam != 'F') {
+    cur->opts.minstart = 0;
+    cur->opts.maxstart = 0;
+  }
 
-  return NULL;
-}
+  /* set the initial position */
+  include = opts->reverse ? opts->includemax : opts->includemin;
+  if (opts->offset) {
+    if (cursor_key(&key, cur->pos, sizeof cur->pos, fam, idx_key_proj(opts->offset), idx_key_start(opts->offset), idx_key_end(opts->offset)) != 0)
+      return -1;
+    cur->possize = key.size;
+
+    /* right after the offset */
+    if (fam != 'M' && opts->reverse == include)
+      cur->pos[cur->possize++] = '\0';
+  } else if (opts->reverse) {
+    memcpy(cur->pos, cur->max, cur->maxsize);
+    cur->possize = cur->maxsize;
+  } else {
+    memcpy(cur->pos, cur->min, cur->minsize);
+    cur->possize = cur->minsize;
+  }
 
-/* return start date */
-time_t
-idx_key_start(const DBT *key)
-{
-  if (is_d(key))
-    return dkey_start(key);
-  else if (is_p(key))
-    return pkey_start(key);
+  if (fam != 'M')
+    return 0;
 
-  errx(1, "%s: illegal key", __func__);
+  /* read the first batch of each project and order the projects */
+  for (n = 0; opts->projs[n]; n++)
+    ;
+
+  if ((cur->prs = calloc(n + 1, sizeof(*cur->prs))) == NULL)
+    err(1, "%s: calloc", __func__);
+  if ((cur->heap = calloc(n + 1, sizeof(*cur->heap))) == NULL)
+    err(1, "%s: calloc", __func__);
+
+  for (i = 0; i < n; i++) {
+    cur->prs[i].proj = opts->projs[i];
+    cur->prs[i].projlen = strlen(opts->projs[i]);
+    cur->prs[i].lo = opts->minstart;
+    cur->prs[i].hi = opts->maxstart;
+    cur->prs[i].reverse = opts->reverse;
+
+    /* offset overrules a min value or, in case reverse is true, a max value */
+    if (opts->offset) {
+      if (opts->reverse)
+        cur->prs[i].hi = idx_key_start(opts->offset) + 1;
+      else
+        cur->prs[i].lo = idx_key_start(opts->offset);
+    }
 
-  return 0;
-}
+    if (prange_fill(cur, &cur->prs[i]) > 0)
+      cur->heap[cur->nheap++] = &cur->prs[i];
+  }
 
-/* return end date */
-time_t
-idx_key_end(const DBT *key)
-{
-  if (is_d(key))
-    return dkey_end(key);
-  else if (is_p(key))
-    return pkey_end(key);
+  for (i = cur->nheap / 2; i > 0; i--)
+    heap_down(cur->heap, cur->nheap, i - 1);
 
-  errx(1, "%s: illegal key", __func__);
+  /* skip all entries up to the offset */
+  if (opts->offset) {
+    cur->skipto = 1;
+    cur->include = include;
+  }
 
   return 0;
 }
 
-/* return pointer to project name in dkey */
-static char *
-pkey_proj(const DBT *key)
+/*
+ * Create a key for the given index, a merging cursor uses dkeys.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+cursor_key(DBT *key, char *data, size_t datasize, int fam, const char *proj, time_t start, time_t end)
 {
-  return &((char *)key->data)[1];
+  switch (fam) {
+  case 'F':
+    return fkey_make(key, data, datasize, proj, strlen(proj), start, end);
+  case 'P':
+    return pkey_make(key, data, datasize, proj, strlen(proj), start, end);
+  default:
+    return dkey_make(key, data, datasize, proj, strlen(proj), start, end);
+  }
 }
 
-/* return start date */
-static time_t
-pkey_start(const DBT *key)
+/*
+ * Copy a key into the batch storage of a cursor and decode it.
+ */
+static void
+cursor_entry(idx_cursor_t *cur, size_t i, const DBT *key, idx_entry_t *ent)
 {
-  uint32_t t;
+  DBT copy;
 
-  memcpy(&t, key->data + key->size - 2 * sizeof(t), sizeof(t));
+  memcpy(cur->keys[i], key->data, key->size);
+  copy.data = cur->keys[i];
+  copy.size = key->size;
 
-  return (time_t)ntohl(t);
+  ent->proj = idx_key_proj(&copy);
+  ent->start = idx_key_start(&copy);
+  ent->end = idx_key_end(&copy);
 }
 
-/* return end date */
-static time_t
-pkey_end(const DBT *key)
+/*
+ * Read keys in ascending order, starting at the position of the cursor.
+ *
+ * NOTE: should only be used via idx_cursor_next() and idx_cursor_prev().
+ *
+ * Return the number of entries read, 0 if there are no more, or -1 on error.
+ */
+static int
+cursor_asc(idx_cursor_t *cur, idx_entry_t *ents, size_t n)
 {
-  uint32_t t;
-
-  memcpy(&t, key->data + key->size - sizeof(t), sizeof(t));
+  idx_t *idx = cur->idx;
+  DBT key;
+  size_t i;
+  int r;
 
-  return (time_t)ntohl(t);
-}
+  n = min(n, IDXBATCH);
 
-/* return pointer to project name in dkey */
-static char *
-dkey_proj(const DBT *key)
-{
-  return &((char *)key->data)[1 + sizeof(uint32_t) + sizeof(uint32_t)];
-}
+  key.data = cur->pos;
+  key.size = cur->possize;
 
-/* return start date */
-static time_t
-dkey_start(const DBT *key)
-{
-  uint32_t t;
+  i = 0;
+  for (r = idx->db->seq(idx->db, &key, NULL, R_CURSOR); r == 0 && i < n; r = idx->db->seq(idx->db, &key, NULL, R_NEXT)) {
+    cur->plan.visited++;
 
-  memcpy(&t, key->data + 1, sizeof(t));
+    if (lexcmp(key.data, key.size, cur->max, cur->maxsize) >= 0)
+      break;
 
-  return (time_t)ntohl(t);
-}
+    /* move right after this key */
+    memcpy(cur->pos, key.data, key.size);
+    cur->pos[key.size] = '\0';
+    cur->possize = key.size + 1;
 
-/* return end date */
-static time_t
-dkey_end(const DBT *key)
-{
-  uint32_t t;
+    if (cur->filter && !key_matches(&key, &cur->opts))
+      continue;
 
-  memcpy(&t, key->data + 1 + sizeof(t), sizeof(t));
+    cursor_entry(cur, i, &key, &ents[i]);
+    i++;
+  }
+  if (r == -1)
+    err(1, "%s: idx->seq", __func__);
 
-  return (time_t)ntohl(t);
+  return i;
 }
 
 /*
- * Determine the number of characters that precede the terminating null byte of
- * the project name.
+ * Read keys in descending order, starting right before the position of the
+ * cursor.
+ *
+ * NOTE: should only be used via idx_cursor_next() and idx_cursor_prev().
+ *
+ * Return the number of entries read, 0 if there are no more, or -1 on error.
  */
-static size_t
-proj_len(const DBT *key)
-{
-  return key->size - sizeof(uint32_t) - sizeof(uint32_t) - 1;
-}
-
-/* recalculate all project names in a static buffer */
-char **
-idx_uniq_proj(void)
+static int
+cursor_desc(idx_cursor_t *cur, idx_entry_t *ents, size_t n)
 {
-  int r;
+  idx_t *idx = cur->idx;
   DBT key;
-  char keydata[MAXKEYSIZE];
-  char *name;
-
-  free_uniq_proj();
+  size_t i;
+  int r;
 
-  if (prange_start(&key, keydata, sizeof keydata, "", 0, 0) != 0)
-    errx(1, "%s: prange_start", __func__);
+  n = min(n, IDXBATCH);
 
-  while ((r = idx->seq(idx, &key, NULL, R_CURSOR)) == 0) {
-    proj_names = realloc(proj_names, (proj_name_next + 1) * sizeof(char *));
-    name = pkey_proj(&key);
-    proj_names[proj_name_next++] = strdup(name);
+  key.data = cur->pos;
+  key.size = cur->possize;
 
-    if (prange_end(&key, keydata, sizeof keydata, name, strlen(name), 0) != 0)
-      errx(1, "%s: prange_end", __func__);
-  }
-  if (r == -1)
-    err(1, "%s: idx->seq set cursor", __func__);
+  /* setting the cursor always ascends, so step back once */
+  r = idx->db->seq(idx->db, &key, NULL, R_CURSOR);
+  if (r == 0)
+    r = idx->db->seq(idx->db, &key, NULL, R_PREV);
+  else if (r == 1)
+    r = idx->db->seq(idx->db, &key, NULL, R_LAST);
 
-  proj_names = realloc(proj_names, (proj_name_next + 1) * sizeof(char *));
-  proj_names[proj_name_next] = NULL;
+  i = 0;
+  for (; r == 0 && i < n; r = idx->db->seq(idx->db, &key, NULL, R_PREV)) {
+    cur->plan.visited++;
 
-  return proj_names;
-}
+    if (lexcmp(key.data, key.size, cur->min, cur->minsize) < 0)
+      break;
 
-/* free proj_names and reset proj_name_next */
-static void
-free_uniq_proj(void)
-{
-  int i;
+    /* move right before this key */
+    memcpy(cur->pos, key.data, key.size);
+    cur->possize = key.size;
 
-  if (proj_names == NULL)
-    return;
+    if (cur->filter && !key_matches(&key, &cur->opts))
+      continue;
 
-  for (i = 0; proj_names[i]; i++) {
-    free(proj_names[i]);
-    proj_names[i] = NULL;
+    cursor_entry(cur, i, &key, &ents[i]);
+    i++;
   }
+  if (r == -1)
+    err(1, "%s: idx->seq", __func__);
 
-  free(proj_names);
-  proj_names = NULL;
-  proj_name_next = 0;
+  return i;
 }
 
 /*
- * Three functions to calculate the total number of minutes in the index.
+ * Read the next keys of the merged P ranges, in the direction of the cursor.
+ * Only the keys of the given projects are read, in batches of MERGEBUF keys per
+ * project, while a binary heap holds the project with the next key on top.
  *
- * uses GLOBALS: mtotal and ecount;
- */
-
-/*
- * calculate the number of minutes a dkey spans
+ * NOTE: should only be used via idx_cursor_next().
  *
- * NOTE: should only be used via idx_count().
+ * Return the number of entries read, 0 if there are no more, or -1 on error.
  */
 static int
-summcount_d(DBT *dkey)
+cursor_merged(idx_cursor_t *cur, idx_entry_t *ents, size_t n)
 {
-  if (!is_d(dkey))
-    return 0;
+  struct prange *pr;
+  DBT key, pos;
+  size_t i;
+  int c;
+
+  n = min(n, IDXBATCH);
+
+  pos.data = cur->pos;
+  pos.size = cur->possize;
+
+  i = 0;
+  while (cur->nheap && i < n) {
+    pr = cur->heap[0];
+    key.data = pr->keys[pr->next];
+    key.size = pr->sizes[pr->next];
+
+    /* skip keys up to the position, once passed all keys are beyond it */
+    if (cur->skipto) {
+      c = entrycmp(&key, &pos);
+      if (cur->opts.reverse)
+        c = -c;
+      if (c > 0 || (c == 0 && cur->include))
+        cur->skipto = 0;
+    }
 
-  mtotal += difftime(dkey_end(dkey), dkey_start(dkey)) / 60;
-  ecount++;
+    if (!cur->skipto) {
+      cursor_entry(cur, i, &key, &ents[i]);
+      i++;
+    }
 
-  return 1;
+    /* advance the project of this key, drop it if there are no more keys */
+    if (++pr->next == pr->nkeys && prange_fill(cur, pr) == 0)
+      cur->heap[0] = cur->heap[--cur->nheap];
+    heap_down(cur->heap, cur->nheap, 0);
+  }
+
+  return i;
 }
 
 /*
- * calculate the number of minutes a pkey spans
+ * Compare two byte strings like the btree does.
  *
- * NOTE: should only be used via idx_count().
+ * Return < 0 if a comes first, > 0 if b comes first, 0 if equal.
  */
 static int
-summcount_p(DBT *pkey)
+lexcmp(const void *a, size_t asize, const void *b, size_t bsize)
 {
-  if (!is_p(pkey))
-    return 0;
+  int c;
 
-  mtotal += difftime(pkey_end(pkey), pkey_start(pkey)) / 60;
-  ecount++;
+  if ((c = memcmp(a, b, min(asize, bsize))) != 0)
+    return c;
 
-  return 1;
+  if (asize == bsize)
+    return 0;
+
+  return asize < bsize ? -1 : 1;
 }
 
 /*
- * Calculate the total number of minutes and number of entries, optionally
- * filtered by project name, and/or minimum and/or maximum start time.
+ * Read the next batch of keys of a P range that lie within its bounds. The
+ * batch continues after the last key of the previous batch, if any.
  *
- * count will contain the number of entries found
- * summ will contain the total number of minutes in all entries
+ * NOTE: should only be used via a merging cursor.
  *
- * Return 0 on success, -1 on error.
+ * Return the number of keys read.
  */
-int
-idx_count(const idx_itopts_t *opts, int *count, int *summ)
+static size_t
+prange_fill(idx_cursor_t *cur, struct prange *pr)
 {
-  mtotal = 0.0;
-  ecount = 0;
+  idx_t *idx = cur->idx;
+  DBT key;
+  char keydata[MAXKEYSIZE + 1];
+  time_t start;
+  int r, dir;
 
-  /* set default options */
-  idx_itopts_t opt = {
-    NULL, /* char *proj; */
-    0, /* time_t minstart; */
-    0, /* time_t maxstart; */
-    0, /* int includemin; */
-    0, /* int includemax; */
-    0, /* size_t limit; */
-    0, /* size_t skip; */
-    0, /* int reverse; */
-    NULL /* DBT *offset; */
-  };
+  if (pr->done) {
+    pr->nkeys = 0;
+    pr->next = 0;
+    return 0;
+  }
 
-  if (!opts)
-    opts = &opt;
+  if (pr->nkeys) {
+    memcpy(keydata, pr->keys[pr->nkeys - 1], pr->sizes[pr->nkeys - 1]);
+    key.data = keydata;
+    key.size = pr->sizes[pr->nkeys - 1];
 
-  if (opts->proj && strlen(opts->proj))
-    idx_iterate(opts, summcount_p, NULL);
-  else
-    idx_iterate(opts, summcount_d, NULL);
+    /* a trailing null byte yields the first possible key after the last one */
+    if (!pr->reverse)
+      keydata[key.size++] = '\0';
+  } else if (pr->reverse) {
+    if (prange_end(&key, keydata, sizeof keydata, pr->proj, pr->projlen, pr->hi) != 0)
+      errx(1, "%s: prange_end", __func__);
+  } else {
+    if (prange_start(&key, keydata, sizeof keydata, pr->proj, pr->projlen, pr->lo) != 0)
+      errx(1, "%s: prange_start", __func__);
+  }
 
-  *summ = mtotal;
-  *count = ecount;
+  pr->nkeys = 0;
+  pr->next = 0;
 
-  return 0;
+  /* setting the cursor always ascends, so step back once if descending */
+  r = idx->db->seq(idx->db, &key, NULL, R_CURSOR);
+  if (pr->reverse) {
+    dir = R_PREV;
+    if (r == 0)
+      r = idx->db->seq(idx->db, &key, NULL, R_PREV);
+    else if (r == 1)
+      r = idx->db->seq(idx->db, &key, NULL, R_LAST);
+  } else {
+    dir = R_NEXT;
+  }
+
+  for (; r == 0; r = idx->db->seq(idx->db, &key, NULL, dir)) {
+    cur->plan.visited++;
+
+    if (!is_p(&key) || strcmp(pkey_proj(&key), pr->proj) != 0)
+      break;
+
+    start = pkey_start(&key);
+    if (start < pr->lo || (pr->hi && start >= pr->hi))
+      break;
+
+    memcpy(pr->keys[pr->nkeys], key.data, key.size);
+    pr->sizes[pr->nkeys] = key.size;
+
+    if (++pr->nkeys == MERGEBUF)
+      return pr->nkeys;
+  }
+  if (r == -1)
+    err(1, "%s: idx->seq", __func__);
+
+  pr->done = 1;
+
+  return pr->nkeys;
 }
 
 /*
- * Return pointer to string on success, or the empty string on error or if key
- * is NULL
+ * Compare the next keys of two P ranges in the order of the merge.
+ *
+ * NOTE: should only be used via a merging cursor.
+ *
+ * Return < 0 if pr1 comes first, > 0 if pr2 comes first, 0 if equal.
  */
-char *
-idx_key_info(const DBT *key)
+static int
+prange_cmp(const struct prange *pr1, const struct prange *pr2)
 {
-  static char dst[100];
-  static char start[15];
-
-  dst[0] = '\0';
+  DBT key1, key2;
+  int c;
 
-  if (key == NULL)
-    return dst;
+  key1.data = (void *)pr1->keys[pr1->next];
+  key1.size = pr1->sizes[pr1->next];
+  key2.data = (void *)pr2->keys[pr2->next];
+  key2.size = pr2->sizes[pr2->next];
 
-  if (timetostr(start, idx_key_start(key), sizeof start) != 0)
-    return dst;
+  c = entrycmp(&key1, &key2);
 
-  if (snprintf(dst, sizeof dst, "%c%c len: %zu, %s, %s", is_d(key) ? 'D' : ' ', is_p(key) ? 'P' : ' ', key->size, idx_key_proj(key), start) < 0)
-    return dst;
+  return pr1->reverse ? -c : c;
+}
 
-  return dst;
+/*
+ * Restore the heap property of the subtree rooted at i by moving it down.
+ *
+ * NOTE: should only be used via a merging cursor.
+ */
+static void
+heap_down(struct prange **heap, size_t n, size_t i)
+{
+  struct prange *tmp;
+  size_t c;
+
+  while ((c = 2 * i + 1) < n) {
+    if (c + 1 < n && prange_cmp(heap[c + 1], heap[c]) < 0)
+      c++;
+    if (prange_cmp(heap[c], heap[i]) >= 0)
+      break;
+
+    tmp = heap[i];
+    heap[i] = heap[c];
+    heap[c] = tmp;
+    i = c;
+  }
 }
 
 /*
- * Iterate, optionally filtered by project name, and/or minimum and/or maximum
- * start time. Furthermore an offset can be used. See idx_itopts_t for options.
- *
- * NOTE: offset always overrules a min value or, in case reverse is true, a max
- * value.
+ * Compare two keys of any index in the order of the D index, that is by start
+ * time, end time and project name.
  *
- * last_seen is optional and can be null.
- *
- * Return 0 on success, -1 on error.
+ * Return < 0 if key1 comes first, > 0 if key2 comes first, 0 if equal.
  */
-int
-idx_iterate(const idx_itopts_t *opts, int (*cb)(DBT *), DBT **last_seen)
+static int
+entrycmp(const DBT *key1, const DBT *key2)
 {
-  DBT skey, ekey;
-  const DBT *skeyp, *ekeyp;
-  size_t l;
-  char sdata[MAXKEYSIZE], edata[MAXKEYSIZE];
-
-  /* set default options */
-  idx_itopts_t opt = {
-    NULL, /* char *proj; */
-    0, /* time_t minstart; */
-    0, /* time_t maxstart; */
-    0, /* int includemin; */
-    0, /* int includemax; */
-    0, /* size_t limit; */
-    0, /* size_t skip; */
-    0, /* int reverse; */
-    NULL /* DBT *offset; */
-  };
-
-  if (!opts)
-    opts = &opt;
-
-  /*
-   * Check and set upper and lower bounds. If proj is set, use the P index,
-   * otherwise use the D index.
-   */
-  if (opts->proj && (l = strlen(opts->proj))) {
-    /* create a min key */
-    if (!opts->reverse && opts->offset) {
-      skeyp = opts->offset;
-    } else {
-      skeyp = &skey;
-      if (prange_start(&skey, sdata, sizeof sdata, opts->proj, l, opts->minstart) != 0)
-        errx(1, "%s: prange_start", __func__);
-    }
-
-    /* create a max key */
-    if (opts->reverse && opts->offset) {
-      ekeyp = opts->offset;
-    } else {
-      ekeyp = &ekey;
-      if (prange_end(&ekey, edata, sizeof edata, opts->proj, l, opts->maxstart) != 0)
-        errx(1, "%s: prange_end", __func__);
-    }
-  } else {
-    /* create a min key */
-    if (!opts->reverse && opts->offset) {
-      skeyp = opts->offset;
-    } else {
-      skeyp = &skey;
-      if (drange_start(&skey, sdata, sizeof sdata, opts->minstart) != 0)
-        errx(1, "%s: drange_start", __func__);
-    }
+  time_t t1, t2;
 
-    /* create a max key */
-    if (opts->reverse && opts->offset) {
-      ekeyp = opts->offset;
-    } else {
-      ekeyp = &ekey;
-      if (drange_end(&ekey, edata, sizeof edata, opts->maxstart) != 0)
-        errx(1, "%s: drange_end", __func__);
-    }
-  }
+  if ((t1 = idx_key_start(key1)) != (t2 = idx_key_start(key2)))
+    return t1 < t2 ? -1 : 1;
 
-  iterate(skeyp, opts->includemin, ekeyp, opts->includemax, opts->limit, opts->skip, opts->reverse, cb, last_seen);
+  if ((t1 = idx_key_end(key1)) != (t2 = idx_key_end(key2)))
+    return t1 < t2 ? -1 : 1;
 
-  return 0;
+  return strcmp(idx_key_proj(key1), idx_key_proj(key2));
 }
 
 /*
@@ -1045,7 +4547,7 @@ idx_keycmp(const DBT *key1, const DBT *key2)
 }
 
 /*
- * Iterate over all entries, yielding the key. Works for both D and P indices.
+ * Iterate over all entries, yielding the key. Works for the D, F and P indices.
  *
  * If no min and max are given, defaults to the D index. If a min and max are
  * given, they should be bound to the same index. If only min or max are given
@@ -1058,46 +4560,53 @@ idx_keycmp(const DBT *key1, const DBT *key2)
  * limit: the maximum number of yielded results
  * skip: skip the first number of results
  * reverse: emit in reverse
+ * match: optional, only keys that match these options are skipped or yielded
+ * pkeys: whether keys are converted to pkeys before they are yielded
  * cb is called with each key that is within range
- * last_seen is set to the last seen key
+ * last_seen is set to the last seen key, a pkey if pkeys is set
+ *
+ * NOTE: the handle must be locked.
  */
 static void
-iterate(const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t skip, int reverse, int (*cb)(DBT *), DBT **last_seen)
+iterate(idx_t *idx, const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t skip, int reverse, const idx_itopts_t *match, int pkeys, int (*cb)(DBT *), DBT **last_seen)
 {
-  DBT key, keymin, keymax;
+  DBT key, keymin, keymax, pkey, last;
   const DBT *bound;
-  char keydata[MAXKEYSIZE], mindata[MAXKEYSIZE], maxdata[MAXKEYSIZE];
+  char keydata[MAXKEYSIZE], mindata[MAXKEYSIZE], maxdata[MAXKEYSIZE], pkeydata[MAXKEYSIZE], lastdata[MAXKEYSIZE];
   int r, r2, proceed = 1, includebound;
   int linr; /* Last found key in range, needed for last_seen.
              * Keys that are either passed to the callback or skipped because of
              * "skip".
              */
-  int d_range; /* whether this is a range on D or on P */
+  int fam; /* index of the range, either 'D', 'F' or 'P' */
   int dir; /* direction, either R_NEXT or R_PREV */
 
   int cb_called = 0;
 
-  /* do some range checking */
-  d_range = 1;
-
   /* ensure the same range is used if any */
   if (min && max && min->size && max->size)
-    if (in_drange(min) != in_drange(max))
+    if (key_family(min) != key_family(max))
       errx(1, "%s: min and max are not bound to the same index", __func__);
 
-  /* determine which range */
-  if (min && in_prange(min))
-    d_range = 0;
+  /* determine which range, default to D */
+  fam = 'D';
+  if (min && min->size)
+    fam = key_family(min);
+  else if (max && max->size)
+    fam = key_family(max);
 
-  if (max && in_prange(max))
-    d_range = 0;
+  if (fam == 0)
+    errx(1, "%s: min or max is not bound to an index", __func__);
 
   /* ensure a default range */
   if (!min || !min->size) {
     gte = 1;
-    if (d_range) {
+    if (fam == 'D') {
       if (drange_start(&keymin, mindata, sizeof mindata, 0) != 0)
         errx(1, "%s: drange_start", __func__);
+    } else if (fam == 'F') {
+      if (frange_start(&keymin, mindata, sizeof mindata, 0) != 0)
+        errx(1, "%s: frange_start", __func__);
     } else {
       if (prange_start(&keymin, mindata, sizeof mindata, "", 0, 0) != 0)
         errx(1, "%s: prange_start", __func__);
@@ -1107,9 +4616,12 @@ iterate(const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t s
 
   if (!max || !max->size) {
     lte = 1;
-    if (d_range) {
+    if (fam == 'D') {
       if (drange_end(&keymax, maxdata, sizeof maxdata, 0) != 0)
         errx(1, "%s: drange_start", __func__);
+    } else if (fam == 'F') {
+      if (frange_end(&keymax, maxdata, sizeof maxdata, 0) != 0)
+        errx(1, "%s: frange_end", __func__);
     } else {
       if (prange_end(&keymax, maxdata, sizeof maxdata, "", 0, 0) != 0)
         errx(1, "%s: prange_end", __func__);
@@ -1132,7 +4644,7 @@ iterate(const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t s
   }
 
   /* setting the cursor always ascends to the first match on prefix */
-  if ((r2 = idx->seq(idx, &key, NULL, R_CURSOR)) == -1)
+  if ((r2 = idx->db->seq(idx->db, &key, NULL, R_CURSOR)) == -1)
     err(1, "%s: idx->seq set cursor", __func__);
 
   /* set cursor to the first valid item, if any */
@@ -1155,7 +4667,7 @@ iterate(const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t s
       /* key matches exactly with max and lte is set */
     } else {
       /* in all other cases find next */
-      if ((r2 = idx->seq(idx, &key, NULL, dir)) == -1) {
+      if ((r2 = idx->db->seq(idx->db, &key, NULL, dir)) == -1) {
         err(1, "%s: idx-> prev before max log_error", __func__);
       } else if (r2 == 1) {
         log_warnx("%s: idx->seq prev before max not found", __func__);
@@ -1186,7 +4698,7 @@ iterate(const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t s
     }
     if (!includebound && bound->size == key.size && memcmp(bound->data, key.data, key.size) == 0) {
       /* key matches exactly with min, fetch next */
-      if ((r2 = idx->seq(idx, &key, NULL, dir)) == -1) {
+      if ((r2 = idx->db->seq(idx->db, &key, NULL, dir)) == -1) {
         err(1, "%s: min next log_error", __func__);
       } else if (r2 == 1) {
         log_warnx("%s: idx->seq next after min not found", __func__);
@@ -1200,6 +4712,8 @@ iterate(const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t s
 
   linr = 0;
   do {
+    idx->plan.visited++;
+
     /* see if we are already at or past the bound */
     /* first compare prefixes */
     if (bound->size < key.size) {
@@ -1227,24 +4741,40 @@ iterate(const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t s
         break;
     }
 
+    /* skip keys in range that don't match any other criteria */
+    if (match && !key_matches(&key, match))
+      continue;
+
     linr = 1; /* the key is valid */
 
+    /* the key that ends the loop may be out of range */
+    if (last_seen != NULL) {
+      memcpy(lastdata, key.data, key.size);
+      last.data = lastdata;
+      last.size = key.size;
+    }
+
     if (skip > 0) {
       skip--;
     } else {
-      proceed = cb(&key);
+      if (pkeys && topkey(&pkey, pkeydata, &key, sizeof pkeydata) != 0)
+        errx(1, "%s: topkey", __func__);
+      proceed = cb(pkeys ? &pkey : &key);
       cb_called++;
       if (limit == cb_called)
         break;
     }
-  } while (proceed == 1 && (r = idx->seq(idx, &key, NULL, dir)) == 0);
+  } while (proceed == 1 && (r = idx->db->seq(idx->db, &key, NULL, dir)) == 0);
   if (r == -1)
     err(1, "%s: idx->seq log_error", __func__);
   if (proceed == -1)
     err(1, "%s: cb log_error", __func__);
 
-  if (linr && last_seen != NULL)
-    *last_seen = idx_copy_key(&key);
+  if (linr && last_seen != NULL) {
+    if (pkeys && topkey(&pkey, pkeydata, &last, sizeof pkeydata) != 0)
+      errx(1, "%s: topkey", __func__);
+    *last_seen = idx_copy_key(pkeys ? &pkey : &last);
+  }
 }
 
 /*
@@ -1253,7 +4783,7 @@ iterate(const DBT *min, int gte, const DBT *max, int lte, size_t limit, size_t s
  * Return 0 on success, 1 if the project does not exist, or -1 on error.
  */
 static int
-project_exists(const char *name)
+project_exists(idx_t *idx, const char *name)
 {
   int r;
   DBT key, val;
@@ -1262,10 +4792,10 @@ project_exists(const char *name)
   if (pkey_make(&key, data, sizeof data, name, strlen(name), 0, 0) != 0)
     errx(1, "%s: pkey_make", __func__);
 
-  if ((r = idx->seq(idx, &key, &val, R_CURSOR)) == -1)
+  if ((r = idx->db->seq(idx->db, &key, &val, R_CURSOR)) == -1)
     err(1, "%s: idx->seq set cursor", __func__);
 
-  if (r == 1)
+  if (r == 1 || !is_p(&key))
     return 1;
 
   if (strcmp(dkey_proj(&key), name) == 0)
@@ -1276,18 +4806,18 @@ project_exists(const char *name)
 
 /* return 0 on success, -1 on error */
 static int
-ensure_project_exists(const char name[MAXPROJ])
+ensure_project_exists(idx_t *idx, const char name[MAXPROJ])
 {
   if (strchr(name, '/') != NULL) {
     log_warnx("%s: project name may not contain a '/'", __func__);
     return -1;
   }
 
-  if (project_exists(name) == 0)
+  if (project_exists(idx, name) == 0)
     return 0;
 
   // create directory
-  if (mkdirat(datapath.fd, name, 0755) == -1)
+  if (mkdirat(idx->dpfd, name, 0755) == -1)
     if (errno != EEXIST)
       err(1, "%s: mkdirat", __func__);
 
@@ -1321,27 +4851,63 @@ make_filename(char *dst, const time_t start, const time_t end, size_t dstlen)
 }
 
 /*
- * Convert a pkey to a dkey.
+ * Convert a dkey to a pkey.
  *
  * Return 0 on success, -1 on error.
  */
 static int
-ptodkey(DBT *dkey, char *dkeydata, const DBT *pkey, size_t dkeydatalen)
+dtopkey(DBT *pkey, char *pkeydata, const DBT *dkey, size_t pkeydatalen)
 {
-  char *proj = pkey_proj(pkey);
-  return dkey_make(dkey, dkeydata, dkeydatalen, proj, strlen(proj), pkey_start(pkey), pkey_end(pkey));
+  char *proj = dkey_proj(dkey);
+  return pkey_make(pkey, pkeydata, pkeydatalen, proj, strlen(proj), dkey_start(dkey), dkey_end(dkey));
 }
 
 /*
- * Convert a dkey to a pkey.
+ * Convert a key of any index to a dkey.
  *
  * Return 0 on success, -1 on error.
  */
 static int
-dtopkey(DBT *pkey, char *pkeydata, const DBT *dkey, size_t pkeydatalen)
+todkey(DBT *dkey, char *dkeydata, const DBT *key, size_t dkeydatalen)
+{
+  char *proj = idx_key_proj(key);
+  return dkey_make(dkey, dkeydata, dkeydatalen, proj, strlen(proj), idx_key_start(key), idx_key_end(key));
+}
+
+/*
+ * Convert a key of any index to a pkey.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+topkey(DBT *pkey, char *pkeydata, const DBT *key, size_t pkeydatalen)
+{
+  char *proj = idx_key_proj(key);
+  return pkey_make(pkey, pkeydata, pkeydatalen, proj, strlen(proj), idx_key_start(key), idx_key_end(key));
+}
+
+/*
+ * Convert a key of any index to a fkey.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+tofkey(DBT *fkey, char *fkeydata, const DBT *key, size_t fkeydatalen)
+{
+  char *proj = idx_key_proj(key);
+  return fkey_make(fkey, fkeydata, fkeydatalen, proj, strlen(proj), idx_key_start(key), idx_key_end(key));
+}
+
+/*
+ * Convert a dkey to a fkey.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+dtofkey(DBT *fkey, char *fkeydata, const DBT *dkey, size_t fkeydatalen)
 {
   char *proj = dkey_proj(dkey);
-  return pkey_make(pkey, pkeydata, pkeydatalen, proj, strlen(proj), dkey_start(dkey), dkey_end(dkey));
+  return fkey_make(fkey, fkeydata, fkeydatalen, proj, strlen(proj), dkey_start(dkey), dkey_end(dkey));
 }
 
 /*
@@ -1350,11 +4916,151 @@ dtopkey(DBT *pkey, char *pkeydata, const DBT *dkey, size_t pkeydatalen)
  * Return 0 on success, -1 on error.
  */
 int
-idx_del_by_key(const DBT *key)
+idx_del_by_key(idx_t *idx, const DBT *key)
 {
-  DBT okey; /* other key, depending on the parameter "key" */
-  int fd;
-  char fname[30], *proj, okeydata[MAXKEYSIZE];
+  int r;
+
+  if (idx->readonly) {
+    log_warnx("%s: read-only index", __func__);
+    return -1;
+  }
+
+  begin_change(idx);
+  r = del_by_key(idx, key);
+  end_change(idx);
+
+  return r;
+}
+
+/*
+ * Move every project file that starts before the given time into the pack of
+ * its project and year, see pack_add(). The index does not change, a file that
+ * is not found is read from its pack.
+ *
+ * Return the number of files that are packed, or -1 on error.
+ */
+ssize_t
+idx_archive(idx_t *idx, time_t before)
+{
+  struct dscan dir, dir2;
+  char (*files)[PACKFILELEN + 1], name[PACKNAMESIZE];
+  const char *proj, *file;
+  size_t nfiles, filesize, total, i, j;
+  time_t start;
+  int fd1, fd2, type;
+
+  if (idx->readonly) {
+    log_warnx("%s: read-only index", __func__);
+    return -1;
+  }
+
+  begin_change(idx);
+
+  if ((fd1 = open(idx->datapath, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1)
+    err(1, "%s: open", __func__);
+
+  files = NULL;
+  filesize = 0;
+  total = 0;
+
+  dscan_open(&dir, fd1);
+  while (dscan_next(&dir, &proj, &type)) {
+    if (proj[0] == '.' || (type != DT_DIR && type != DT_LNK && type != DT_UNKNOWN))
+      continue;
+
+    if ((fd2 = openat(fd1, proj, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+      if (errno != ENOTDIR)
+        err(1, "%s: openat %s", __func__, proj);
+      continue;
+    }
+
+    nfiles = 0;
+    dscan_open(&dir2, fd2);
+    while (dscan_next(&dir2, &file, &type)) {
+      if (type == DT_DIR || !is_entry_name(file))
+        continue;
+      if (strtotime(file, &start) == -1 || start >= before)
+        continue;
+
+      if (nfiles == filesize) {
+        filesize = filesize ? filesize * 2 : 1024;
+        if ((files = reallocarray(files, filesize, sizeof(*files))) == NULL)
+          err(1, "%s: reallocarray", __func__);
+      }
+      memcpy(files[nfiles++], file, sizeof(*files));
+    }
+    dscan_close(&dir2);
+
+    /* the files of one year are adjacent once sorted */
+    qsort(files, nfiles, sizeof(*files), filecmp);
+
+    for (i = 0; i < nfiles; i = j) {
+      for (j = i + 1; j < nfiles && memcmp(files[i], files[j], 4) == 0; j++)
+        ;
+      pack_name(name, files[i]);
+      total += pack_add(fd2, name, files + i, j - i);
+    }
+
+    if (close(fd2) == -1)
+      err(1, "%s: close", __func__);
+  }
+  dscan_close(&dir);
+
+  if (close(fd1) == -1)
+    err(1, "%s: close", __func__);
+
+  free(files);
+  drop_pack(idx);
+
+  end_change(idx);
+
+  return total;
+}
+
+/* compare two file names for qsort(3) */
+static int
+filecmp(const void *a, const void *b)
+{
+  return strcmp(a, b);
+}
+
+/*
+ * Lock the handle and the data for a change, readers in other processes are
+ * waited for.
+ */
+static void
+begin_change(idx_t *idx)
+{
+  mtx_lock(idx);
+  lock_byte(idx, F_WRLCK, DATALOCK);
+}
+
+/*
+ * Write the change to disk before other processes can read it, and unlock.
+ */
+static void
+end_change(idx_t *idx)
+{
+  if (idx->db->sync(idx->db, 0) == -1)
+    err(1, "%s: idx->sync", __func__);
+
+  lock_byte(idx, F_UNLCK, DATALOCK);
+  mtx_unlock(idx);
+}
+
+/*
+ * Delete a project file, the handle must be locked for a change.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+del_by_key(idx_t *idx, const DBT *key)
+{
+  DBT dkey, pkey, val;
+  const char *s;
+  size_t n;
+  int fd, r;
+  char fname[30], *proj, dkeydata[MAXKEYSIZE], pkeydata[MAXKEYSIZE], desc[MAXDESC + 1];
 
   if (make_filename(fname, idx_key_start(key), idx_key_end(key), sizeof fname) == -1) {
     log_warnx("%s: make_filename", __func__);
@@ -1363,37 +5069,48 @@ idx_del_by_key(const DBT *key)
 
   proj = idx_key_proj(key);
 
-  // remove the file
-  if ((fd = openat(datapath.fd, proj, O_RDONLY)) == -1)
+  /* derive the dkey and pkey from any key */
+  if (!is_d(key) && !is_p(key) && !is_f(key))
+    errx(1, "%s: illegal key", __func__);
+
+  if (todkey(&dkey, dkeydata, key, sizeof dkeydata) == -1)
+    errx(1, "%s: todkey", __func__);
+  if (dtopkey(&pkey, pkeydata, &dkey, sizeof pkeydata) == -1)
+    errx(1, "%s: dtopkey", __func__);
+
+  /* the words are in the description in the store */
+  if ((r = idx->db->get(idx->db, &dkey, &val, 0)) == -1)
+    err(1, "%s: get dkey", __func__);
+  if (r == 1) {
+    log_warnx("%s: dkey not found %s", __func__, proj);
+    return -1;
+  }
+  s = store_get(idx, &val, &n);
+  memcpy(desc, s, n);
+  desc[n] = '\0';
+  store_dead(idx, n);
+
+  words_update(idx, desc, &dkey, 0);
+  grams_update(idx, desc, &dkey, 0);
+
+  // remove the file, or take it out of its pack
+  if ((fd = openat(idx->dpfd, proj, O_RDONLY)) == -1)
     err(1, "%s: openat", __func__);
-  if (unlinkat(fd, fname, 0) == -1)
-    err(1, "%s: unlinkat: %s/%s", __func__, proj, fname);
+  if (unlinkat(fd, fname, 0) == -1) {
+    if (errno != ENOENT || pack_del(fd, fname) == -1)
+      err(1, "%s: unlinkat: %s/%s", __func__, proj, fname);
+    drop_pack(idx);
+  }
   if (close(fd) == -1)
     err(1, "%s: close", __func__);
-  if (unlinkat(datapath.fd, proj, AT_REMOVEDIR) == -1)
+  if (unlinkat(idx->dpfd, proj, AT_REMOVEDIR) == -1)
     if (errno != ENOTEMPTY)
       err(1, "%s: unlinkat: %s", __func__, proj);
 
-  if (is_d(key)) {
-    if (dtopkey(&okey, okeydata, key, sizeof okeydata) == -1)
-      errx(1, "%s: dtopkey", __func__);
-
-    if (idx_del(key, &okey) != 0) {
-      log_warnx("%s: idx_del", __func__);
-      return -1;
-    }
-  } else if (is_p(key)) {
-    if (ptodkey(&okey, okeydata, key, sizeof okeydata) == -1)
-      errx(1, "%s: dtopkey", __func__);
-
-    if (idx_del(&okey, key) != 0) {
-      log_warnx("%s: idx_del", __func__);
-      return -1;
-    }
-  } else {
-    errx(1, "%s: illegal key", __func__);
+  if (idx_del(idx, &dkey, &pkey) != 0) {
+    log_warnx("%s: idx_del", __func__);
+    return -1;
   }
-  idx->sync(idx, 0);
 
   return 0;
 }
@@ -1408,40 +5125,56 @@ idx_del_by_key(const DBT *key)
  * Return 0 on success, -1 on error.
  */
 int
-idx_save_project_file(const entryl_t *el, const DBT *key, DBT **pkey, DBT **dkey)
+idx_save_project_file(idx_t *idx, const entryl_t *el, const DBT *key, DBT **pkey, DBT **dkey)
 {
-  int fd;
+  int fd, r;
   char fname[30];
 
+  if (idx->readonly) {
+    log_warnx("%s: read-only index", __func__);
+    return -1;
+  }
+
+  begin_change(idx);
+
   if (key != NULL) {
-    if (idx_del_by_key(key) == -1) {
-      log_warnx("%s: idx_del_by_key", __func__);
+    if (del_by_key(idx, key) == -1) {
+      log_warnx("%s: del_by_key", __func__);
+      end_change(idx);
       return -1;
     }
   }
 
-  if (el->proj[0] == '\0' || el->fname[0] == '\0')
+  if (el->proj[0] == '\0' || el->fname[0] == '\0') {
+    end_change(idx);
     return -1;
+  }
 
-  if (ensure_project_exists(el->proj) != 0) {
+  if (ensure_project_exists(idx, el->proj) != 0) {
     log_warnx("%s: ensure_project_exists", __func__);
+    end_change(idx);
     return -1;
   }
 
   if (make_filename(fname, el->start, el->end, sizeof fname) == -1) {
     log_warnx("%s: make_filename", __func__);
+    end_change(idx);
     return -1;
   }
 
   // move the file
-  if ((fd = openat(datapath.fd, el->proj, O_RDONLY)) == -1)
+  if ((fd = openat(idx->dpfd, el->proj, O_RDONLY)) == -1)
     err(1, "%s: openat", __func__);
-  if (renameat(datapath.fd, el->fname, fd, fname) == -1)
+  if (renameat(idx->dpfd, el->fname, fd, fname) == -1)
     err(1, "%s: renameat: %s", __func__, el->fname);
   if (close(fd) == -1)
     err(1, "%s: close", __func__);
 
-  if (idx_put(el->proj, fname, pkey, dkey) != 0) {
+  r = idx_put(idx, el->proj, fname, NULL, pkey, dkey);
+
+  end_change(idx);
+
+  if (r != 0) {
     log_warnx("%s: idx_put", __func__);
     return -1;
   }
@@ -1451,12 +5184,12 @@ idx_save_project_file(const entryl_t *el, const DBT *key, DBT **pkey, DBT **dkey
 
 /* read a file into dst and ensure null termination */
 void
-idx_read_project_file(char *dst, size_t dstsize, const DBT *key)
+idx_read_project_file(idx_t *idx, char *dst, size_t dstsize, const DBT *key)
 {
   FILE *pf;
   size_t n;
 
-  if ((pf = idx_open_project_file(key)) == NULL)
+  if ((pf = idx_open_project_file(idx, key)) == NULL)
     err(1, "%s: idx_open_project_file", __func__);
 
   if ((n = fread(dst, 1, dstsize, pf)) == 0)
@@ -1476,24 +5209,68 @@ idx_read_project_file(char *dst, size_t dstsize, const DBT *key)
 }
 
 /*
- * Open a project file by key.
+ * Copy the first line of the description of an entry from the store to dst,
+ * without the newline and shortened to fit dst, which is null terminated.
+ *
+ * Return the length of the line in dst.
+ */
+size_t
+idx_first_line(idx_t *idx, const DBT *key, char *dst, size_t dstsize)
+{
+  DBT dkey, val;
+  char dkeydata[MAXKEYSIZE];
+  const char *s, *nl;
+  size_t n;
+  int r;
+
+  if (dstsize == 0)
+    errx(1, "%s: no room for a null", __func__);
+
+  if (todkey(&dkey, dkeydata, key, sizeof dkeydata) == -1)
+    errx(1, "%s: todkey", __func__);
+
+  mtx_lock(idx);
+
+  if ((r = idx->db->get(idx->db, &dkey, &val, 0)) == -1)
+    err(1, "%s: get dkey", __func__);
+  if (r == 1)
+    errx(1, "%s: dkey not found %s", __func__, dkey_proj(&dkey));
+
+  s = store_get(idx, &val, &n);
+  if ((nl = memchr(s, '\n', n)) != NULL)
+    n = nl - s;
+  if (n > dstsize - 1)
+    n = dstsize - 1;
+  memcpy(dst, s, n);
+  dst[n] = '\0';
+
+  mtx_unlock(idx);
+
+  return n;
+}
+
+/*
+ * Open a project file by key. A packed file is copied to a stream in memory.
  *
  * FILE * on success, NULL on error
  */
 FILE *
-idx_open_project_file(const DBT *key)
+idx_open_project_file(idx_t *idx, const DBT *key)
 {
-  int projlen, offset;
+  FILE *fp;
+  const char *data;
+  int projlen, offset, pfd;
+  size_t size;
   char pname[PATH_MAX], *pp;
 
   if (key_within_bounds(key) != 0)
     err(1, "%s: key out of bounds", __func__);
 
-  if (datapath.len + key->size + (29 - 2 * sizeof(uint32_t)) >= sizeof pname)
+  if (idx->dplen + key->size + (29 - 2 * sizeof(uint32_t)) >= sizeof pname)
     errx(1, "%s: path does not fit", __func__);
 
   pp = pname;
-  if ((offset = strlcpy(pp, datapath.str, sizeof pname)) > sizeof pname)
+  if ((offset = strlcpy(pp, idx->datapath, sizeof pname)) > sizeof pname)
     err(1, "%s: can't copy path", __func__);
   pp += offset;
 
@@ -1508,11 +5285,35 @@ idx_open_project_file(const DBT *key)
     errx(1, "%s: timetostr failed", __func__);
 
   // open the file
-  return fopen(pname, "r");
+  if ((fp = fopen(pname, "r")) != NULL || errno != ENOENT)
+    return fp;
+
+  mtx_lock(idx);
+
+  if ((pfd = openat(idx->dpfd, idx_key_proj(key), O_RDONLY)) == -1)
+    err(1, "%s: openat: %s", __func__, idx_key_proj(key));
+
+  if ((data = packed_get(idx, pfd, idx_key_proj(key), pp, &size)) != NULL) {
+    if ((fp = fmemopen(NULL, size + 1, "w+")) == NULL)
+      err(1, "%s: fmemopen", __func__);
+    if (fwrite(data, 1, size, fp) != size)
+      err(1, "%s: fwrite", __func__);
+    rewind(fp);
+  }
+
+  if (close(pfd) == -1)
+    err(1, "%s: close", __func__);
+
+  mtx_unlock(idx);
+
+  if (fp == NULL)
+    errno = ENOENT;
+
+  return fp;
 }
 
 /*
- * Create the index with both pkey and dkeys based on the directory and
+ * Create the index with a pkey, dkey and fkey based on the directory and
  * filename.
  *
  * Both proj and file must be null terminated.
@@ -1520,19 +5321,20 @@ idx_open_project_file(const DBT *key)
  * proj is the name of the project, at most 255 characters, at least 1
  * file is the start and end date + time in ISO8601 format, UTC time and
  *   separated by an '_'. Thus must be exactly 29 characters.
+ * desc is the description in the file, if NULL it is read from the file.
  *
- * Both keys are added to the idx external variable and copied to pkey and dkey
- * if the pointers are not NULL.
+ * All keys are added to the db of the handle and the pkey and dkey are
+ * copied to pkey and dkey if the pointers are not NULL.
  *
  * Return 0 on success, -1 on error.
  */
 static int
-idx_put(const char proj[MAXPROJ], char *file, DBT **pkey, DBT **dkey)
+idx_put(idx_t *idx, const char proj[MAXPROJ], char *file, const char *desc, DBT **pkey, DBT **dkey)
 {
   DBT pk, dk;
-  char keydata[MAXKEYSIZE];
+  char keydata[MAXKEYSIZE], descdata[MAXDESC + 1], valdata[2 * sizeof(uint32_t)];
+  size_t desclen;
   int projlen, filelen, r;
-  struct tm dt;
   time_t start, end;
 
   projlen = strlen(proj);
@@ -1545,28 +5347,13 @@ idx_put(const char proj[MAXPROJ], char *file, DBT **pkey, DBT **dkey)
   if (filelen != 29)
     errx(1, "%s: illegal filename: %s", __func__, file);
 
-  // determine start time
-  if (strptime(file, "%Y%m%dT%H%MZ", &dt) == NULL)
+  // determine start and end time
+  if (strtotime(file, &start) == -1)
     errx(1, "%s: could not parse start calendar time from filename: %s", __func__, file);
 
-  // clear values that are not in the above time spec
-  dt.tm_sec = 0;
-  dt.tm_isdst = -1;
-
-  // ensure the right week and year day are set
-  start = timegm(&dt);
-
-  // determine end time
-  if (strptime(file + 14 + 1, "%Y%m%dT%H%MZ", &dt) == NULL)
+  if (file[14] != '_' || strtotime(file + 14 + 1, &end) == -1)
     errx(1, "%s: could not parse end calendar time from filename: %s", __func__, file);
 
-  // clear values that are not in the above time spec
-  dt.tm_sec = 0;
-  dt.tm_isdst = -1;
-
-  // ensure the right week and year day are set
-  end = timegm(&dt);
-
   /* P. project key */
   ////////////////////
 
@@ -1577,10 +5364,12 @@ idx_put(const char proj[MAXPROJ], char *file, DBT **pkey, DBT **dkey)
   dk.data = NULL;
   dk.size = 0;
 
-  if ((r = idx->put(idx, &pk, &dk, R_NOOVERWRITE)) == -1)
+  if ((r = idx->db->put(idx->db, &pk, &dk, R_NOOVERWRITE)) == -1)
     err(1, "%s: put pk", __func__);
   if (r == 1)
     log_warnx("%s: duplicate pk %s/%s", __func__, proj, file);
+  else
+    stats_add(idx, proj, projlen, start, 1);
 
   if (pkey != NULL)
     *pkey = idx_copy_key(&pk);
@@ -1591,18 +5380,55 @@ idx_put(const char proj[MAXPROJ], char *file, DBT **pkey, DBT **dkey)
   if (dkey_make(&dk, keydata, sizeof keydata, proj, projlen, start, end) == -1)
     errx(1, "%s: dkey_make", __func__);
 
-  /* D. value */
-  pk.data = NULL;
-  pk.size = 0;
+  /* D. value, the place of the description in the store */
+  if (desc == NULL) {
+    desc_read(idx, proj, file, descdata);
+    desc = descdata;
+  }
+  desclen = strnlen(desc, MAXDESC);
+  store_put(idx, desc, desclen, &pk, valdata);
 
-  if ((r = idx->put(idx, &dk, &pk, R_NOOVERWRITE)) == -1)
+  if ((r = idx->db->put(idx->db, &dk, &pk, R_NOOVERWRITE)) == -1)
     err(1, "%s: put dk", __func__);
-  if (r == 1)
+  if (r == 1) {
     log_warnx("%s: duplicate dk %s/%s", __func__, proj, file);
+    store_dead(idx, desclen);
+  }
 
   if (dkey != NULL)
     *dkey = idx_copy_key(&dk);
 
+  /* T. term keys and G. trigram keys */
+  ///////////////////////////////////////
+
+  /* a duplicate is already in the posting lists */
+  if (r == 0) {
+    words_update(idx, desc, &dk, 1);
+    grams_update(idx, desc, &dk, 1);
+  }
+
+  /* F. finish key */
+  //////////////////
+
+  if (fkey_make(&dk, keydata, sizeof keydata, proj, projlen, start, end) == -1)
+    errx(1, "%s: fkey_make", __func__);
+
+  /* F. value */
+  pk.data = NULL;
+  pk.size = 0;
+
+  if ((r = idx->db->put(idx->db, &dk, &pk, R_NOOVERWRITE)) == -1)
+    err(1, "%s: put fk", __func__);
+  if (r == 1)
+    log_warnx("%s: duplicate fk %s/%s", __func__, proj, file);
+
+  /* keep track of the longest entry */
+  if (end > start && end - start > idx->maxdur) {
+    idx->maxdur = end - start;
+    if (meta_put(idx, 'W', idx->maxdur) != 0)
+      errx(1, "%s: meta_put", __func__);
+  }
+
   return 0;
 }
 
@@ -1614,23 +5440,37 @@ idx_put(const char proj[MAXPROJ], char *file, DBT **pkey, DBT **dkey)
  * Return 0 on success, -1 on error.
  */
 static int
-idx_del(const DBT *dkey, const DBT *pkey)
+idx_del(idx_t *idx, const DBT *dkey, const DBT *pkey)
 {
+  DBT fkey;
+  char fkeydata[MAXKEYSIZE];
   int r;
 
-  if ((r = idx->del(idx, dkey, 0)) == -1)
+  if (dtofkey(&fkey, fkeydata, dkey, sizeof fkeydata) == -1)
+    errx(1, "%s: dtofkey", __func__);
+
+  if ((r = idx->db->del(idx->db, dkey, 0)) == -1)
     err(1, "%s: del dkey", __func__);
   if (r == 1) {
     log_warnx("%s: dkey not found %s", __func__, dkey_proj(dkey));
     return -1;
   }
 
-  if ((r = idx->del(idx, pkey, 0)) == -1)
+  if ((r = idx->db->del(idx->db, pkey, 0)) == -1)
     err(1, "%s: del pkey", __func__);
   if (r == 1) {
     log_warnx("%s: pkey not found %s", __func__, dkey_proj(dkey));
     return -1;
   }
 
+  if ((r = idx->db->del(idx->db, &fkey, 0)) == -1)
+    err(1, "%s: del fkey", __func__);
+  if (r == 1) {
+    log_warnx("%s: fkey not found %s", __func__, dkey_proj(dkey));
+    return -1;
+  }
+
+  stats_add(idx, dkey_proj(dkey), strlen(dkey_proj(dkey)), dkey_start(dkey), -1);
+
   return 0;
 }
@@ -1,12 +1,20 @@
 #ifndef INDEX_H
 #define INDEX_H
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+#include <arpa/inet.h>
+#include <ctype.h>
 #include <dirent.h>
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,11 +22,70 @@
 #include <unistd.h>
 
 #include "compat/bdb.h"
+#include "descread.h"
 #include "entryl.h"
+#include "pack.h"
 #include "shared.h"
 
 #define MAXKEYSIZE (1 + MAXPROJ + 1 + sizeof(uint32_t) + sizeof(uint32_t))
 
+/* version of the index format, the index is rebuilt on mismatch */
+#define IDXVERSION 5
+
+/* number of keys that are read ahead per project when merging P ranges */
+#define MERGEBUF 32
+
+/* the cost of setting the cursor, expressed in a number of visited keys */
+#define SEEKCOST 4
+
+#define SECSPERDAY (24 * 60 * 60)
+
+/* maximum length of an indexed word including the null, longer words are cut */
+#define MAXWORD 32
+
+/* size of a key of the word index, a "T" and a word followed by a dkey */
+#define MAXTKEYSIZE (1 + MAXWORD + MAXKEYSIZE)
+
+/* number of bytes of a description that are indexed */
+#define MAXDESC 4096
+
+/* maximum number of terms in a search query */
+#define MAXQUERY 8
+
+/* number of start times in a block of the posting list of a trigram */
+#define GRAMBLOCK 64
+
+/* number of descriptions that are read at once while the index is built */
+#define READBATCH 256
+
+/* size of the path of a project file relative to the data dir */
+#define FILEPATH (MAXPROJ + 1 + 30)
+
+/* number of bytes of directory entries that are read at once */
+#define SCANBUF (256 * 1024)
+
+/* the lock file is named after the index with this suffix */
+#define LOCKSUFFIX ".lock"
+
+/* the description store is named after the index with this suffix */
+#define STORESUFFIX ".desc"
+
+/* number of bytes of removed descriptions before the store is compacted */
+#define STORECOMPACT (1024 * 1024)
+
+/* size of the buffer of descriptions that are appended while building */
+#define STOREBUF (1024 * 1024)
+
+/* bytes of the lock file, see idx_open() */
+#define WRITERLOCK 0
+#define DATALOCK 1
+
+/* maximum number of entries that is read by one call on a cursor */
+#define IDXBATCH 64
+
+/* an open index of one data dir, see idx_open() */
+typedef struct idx idx_t;
+
 /* iterator options */
 typedef struct {
   char *proj;
@@ -30,10 +97,52 @@ typedef struct {
   size_t skip;
   int reverse;
   const DBT *offset; /* optional offset by key, bounded by minstart and maxstart */
+  time_t minend; /* optional minimum end time, uses the F index */
+  time_t maxend; /* optional maximum end time, uses the F index */
+  time_t at; /* only entries that are active at this time, uses the F index */
+  char **projs; /* optional null terminated list of projects, overrules proj */
 } idx_itopts_t;
 
-int idx_open(char *dp, char *idxpath, int ensure_new);
-void idx_close(void);
+/* an entry, decoded from a key of any index */
+typedef struct {
+  const char *proj; /* only valid until the next call on the cursor */
+  time_t start;
+  time_t end;
+} idx_entry_t;
+
+/* the access path of an iteration, see idx_last_plan() */
+typedef struct {
+  int fam; /* 'D', 'F', 'P' or 'M' for merged P ranges */
+  size_t est; /* estimated number of keys to visit, 0 if not estimated */
+  size_t statkeys; /* number of statistics keys read while planning */
+  size_t visited; /* number of keys visited */
+} idx_plan_t;
+
+struct prange;
+
+/* pull based iterator, see idx_cursor_open() */
+typedef struct {
+  idx_t *idx;
+  idx_plan_t plan;
+  idx_itopts_t opts; /* options that are not bound by the range */
+  int fam; /* scanned index, 'D', 'F', 'P' or 'M' for merged P ranges */
+  int filter; /* whether keys must be matched against opts */
+  char min[MAXKEYSIZE]; /* start of the range */
+  size_t minsize;
+  char max[MAXKEYSIZE]; /* end of the range */
+  size_t maxsize;
+  char pos[MAXKEYSIZE + 1]; /* the cursor is right before this key */
+  size_t possize;
+  char keys[IDXBATCH][MAXKEYSIZE]; /* keys of the last read batch */
+  struct prange *prs; /* merged P ranges */
+  struct prange **heap; /* merged P ranges that are not exhausted */
+  size_t nheap;
+  int skipto; /* skip merged keys up to pos */
+  int include; /* whether a merged key equal to pos is included */
+} idx_cursor_t;
+
+idx_t *idx_open(const char *dp, const char *idxpath, int ensure_new, int readonly);
+void idx_close(idx_t *idx);
 DBT *idx_copy_key(const DBT *key);
 int idx_free_key(const DBT **key);
 time_t idx_pkey_start(const DBT *key);
@@ -42,14 +151,26 @@ char *idx_key_proj(const DBT *key);
 time_t idx_key_start(const DBT *key);
 time_t idx_key_end(const DBT *key);
 int idx_keycmp(const DBT *key1, const DBT *key2);
-int idx_iterate(const idx_itopts_t *opts, int (*cb)(DBT *), DBT **last_seen);
+int idx_iterate(idx_t *idx, const idx_itopts_t *opts, int (*cb)(DBT *), DBT **last_seen);
+char *idx_last_plan(idx_t *idx);
+char *idx_last_rebuild(idx_t *idx);
+int idx_cursor_open(idx_t *idx, idx_cursor_t *cur, const idx_itopts_t *opts);
+int idx_cursor_next(idx_cursor_t *cur, idx_entry_t *ents, size_t n);
+int idx_cursor_prev(idx_cursor_t *cur, idx_entry_t *ents, size_t n);
+int idx_cursor_seek(idx_cursor_t *cur, const idx_entry_t *ent);
+DBT *idx_cursor_key(const idx_cursor_t *cur, const idx_entry_t *ent);
+void idx_cursor_close(idx_cursor_t *cur);
 char *idx_key_info(const DBT *key);
 
-char **idx_uniq_proj(void);
-int idx_count(const idx_itopts_t *opts, int *count, int *summ);
-int idx_del_by_key(const DBT *key);
-FILE *idx_open_project_file(const DBT *key);
-void idx_read_project_file(char *dst, size_t dstsize, const DBT *key);
-int idx_save_project_file(const entryl_t *el, const DBT *key, DBT **pkey, DBT **dkey);
+char **idx_uniq_proj(idx_t *idx);
+int idx_count(idx_t *idx, const idx_itopts_t *opts, int *count, int *summ);
+int idx_overlaps(idx_t *idx, time_t start, time_t end, const DBT *skip);
+int idx_search(idx_t *idx, const char *query, const DBT *from, int reverse, const idx_itopts_t *opts, DBT **found);
+int idx_del_by_key(idx_t *idx, const DBT *key);
+ssize_t idx_archive(idx_t *idx, time_t before);
+FILE *idx_open_project_file(idx_t *idx, const DBT *key);
+void idx_read_project_file(idx_t *idx, char *dst, size_t dstsize, const DBT *key);
+size_t idx_first_line(idx_t *idx, const DBT *key, char *dst, size_t dstsize);
+int idx_save_project_file(idx_t *idx, const entryl_t *el, const DBT *key, DBT **pkey, DBT **dkey);
 
 #endif
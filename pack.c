@@ -0,0 +1,421 @@
+#include "pack.h"
+
+/*
+ * A pack holds the entry files of one project that start in the same UTC year,
+ * so that old entries do not each cost an inode and a directory entry. A pack
+ * is named after the year, like "2019.pack", lives in the project directory
+ * and is read in memory at once.
+ *
+ * pack  ::= magic count item* data
+ * magic ::= "UPK1"
+ * count ::= uint32be                 the number of items
+ * item  ::= file offset size         file is the name of the entry file
+ *                                    without a null, followed by the offset in
+ *                                    the pack and the size of its contents,
+ *                                    both uint32be. Items are sorted by file.
+ *
+ * A pack is never changed in place. A new version is written to a hidden file
+ * next to it which replaces the pack once it is on disk.
+ */
+struct pack {
+  char *buf; /* the whole pack */
+  size_t size;
+  size_t count;
+};
+
+/* an entry file that is written to a pack */
+struct pitem {
+  char file[PACKFILELEN + 1];
+  const char *data;
+  size_t size;
+  int loose; /* whether data is read from a file, which replaces an item */
+};
+
+static void pack_write(int pfd, const char *name, const struct pitem *items, size_t n);
+static int pitemcmp(const void *a, const void *b);
+static size_t read_all(int fd, char *buf, size_t size);
+static void write_all(int fd, const char *buf, size_t size);
+
+/*
+ * Store the name of the pack of the entry file in dst, which must be
+ * PACKNAMESIZE bytes.
+ */
+void
+pack_name(char *dst, const char *file)
+{
+  memcpy(dst, file, 4);
+  memcpy(dst + 4, ".pack", sizeof(".pack"));
+}
+
+/*
+ * Check if name is the name of a pack, a year followed by ".pack".
+ *
+ * Return 1 if it is, 0 if not.
+ */
+int
+is_pack_name(const char *name)
+{
+  int i;
+
+  for (i = 0; i < 4; i++)
+    if (name[i] < '0' || name[i] > '9')
+      return 0;
+
+  return strcmp(name + 4, ".pack") == 0;
+}
+
+/*
+ * Read the pack with name in the project directory pfd. Exit if it is corrupt.
+ *
+ * Return a pointer to the pack, or NULL if it does not exist.
+ */
+pack_t *
+pack_open(int pfd, const char *name)
+{
+  pack_t *pk;
+  struct stat st;
+  uint32_t v;
+  size_t i, tabend, off, size;
+  int fd;
+
+  if ((fd = openat(pfd, name, O_RDONLY | O_CLOEXEC)) == -1) {
+    if (errno != ENOENT)
+      err(1, "%s: openat: %s", __func__, name);
+    return NULL;
+  }
+
+  if (fstat(fd, &st) == -1)
+    err(1, "%s: fstat: %s", __func__, name);
+
+  if ((pk = calloc(1, sizeof(*pk))) == NULL)
+    err(1, "%s: calloc", __func__);
+
+  pk->size = st.st_size;
+  if ((pk->buf = malloc(pk->size + 1)) == NULL)
+    err(1, "%s: malloc", __func__);
+  if (read_all(fd, pk->buf, pk->size) != pk->size)
+    errx(1, "%s: short read: %s", __func__, name);
+  if (close(fd) == -1)
+    err(1, "%s: close", __func__);
+
+  if (pk->size < 4 + sizeof v || memcmp(pk->buf, PACKMAGIC, 4) != 0)
+    errx(1, "%s: not a pack: %s", __func__, name);
+
+  memcpy(&v, pk->buf + 4, sizeof v);
+  pk->count = ntohl(v);
+
+  tabend = 4 + sizeof v + pk->count * PACKITEM;
+  if (pk->count > pk->size / PACKITEM || tabend > pk->size)
+    errx(1, "%s: table exceeds pack: %s", __func__, name);
+
+  /* every item must be within the data and follow the previous one */
+  for (i = 0; i < pk->count; i++) {
+    if (i > 0 && memcmp(pk->buf + 4 + sizeof v + (i - 1) * PACKITEM, pk->buf + 4 + sizeof v + i * PACKITEM, PACKFILELEN) >= 0)
+      errx(1, "%s: items out of order: %s", __func__, name);
+    if (pack_item(pk, i, NULL, &size) == NULL)
+      errx(1, "%s: item %zu exceeds pack: %s", __func__, i, name);
+    memcpy(&v, pk->buf + 4 + sizeof v + i * PACKITEM + PACKFILELEN, sizeof v);
+    off = ntohl(v);
+    if (off < tabend)
+      errx(1, "%s: item %zu overlaps table: %s", __func__, i, name);
+  }
+
+  return pk;
+}
+
+/*
+ * Find an entry file in a pack by binary search.
+ *
+ * Return a pointer to the contents and store its size in size, or NULL if the
+ * file is not in the pack.
+ */
+const char *
+pack_get(const pack_t *pk, const char *file, size_t *size)
+{
+  size_t lo, hi, mid;
+  int cmp;
+
+  lo = 0;
+  hi = pk->count;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    cmp = memcmp(file, pk->buf + 4 + sizeof(uint32_t) + mid * PACKITEM, PACKFILELEN);
+    if (cmp == 0)
+      return pack_item(pk, mid, NULL, size);
+    if (cmp < 0)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return NULL;
+}
+
+/* return the number of entry files in a pack */
+size_t
+pack_count(const pack_t *pk)
+{
+  return pk->count;
+}
+
+/*
+ * Get the entry file with index i. If file is not NULL, the null terminated
+ * name is copied to it, which must be PACKFILELEN + 1 bytes.
+ *
+ * Return a pointer to the contents and store its size in size, or NULL if the
+ * item exceeds the pack.
+ */
+const char *
+pack_item(const pack_t *pk, size_t i, char *file, size_t *size)
+{
+  const char *item;
+  uint32_t off, len;
+
+  item = pk->buf + 4 + sizeof(uint32_t) + i * PACKITEM;
+
+  memcpy(&off, item + PACKFILELEN, sizeof off);
+  memcpy(&len, item + PACKFILELEN + sizeof off, sizeof len);
+  off = ntohl(off);
+  len = ntohl(len);
+
+  if (off > pk->size || len > pk->size - off)
+    return NULL;
+
+  if (file != NULL) {
+    memcpy(file, item, PACKFILELEN);
+    file[PACKFILELEN] = '\0';
+  }
+
+  *size = len;
+  return pk->buf + off;
+}
+
+void
+pack_close(pack_t *pk)
+{
+  if (pk == NULL)
+    return;
+
+  free(pk->buf);
+  free(pk);
+}
+
+/*
+ * Move n entry files of the project directory pfd into the pack with name. The
+ * pack is created if it does not exist yet, and a file that is already in the
+ * pack replaces it. The files are removed once the new pack is on disk.
+ *
+ * Return the number of files that are moved.
+ */
+size_t
+pack_add(int pfd, const char *name, char (*files)[PACKFILELEN + 1], size_t n)
+{
+  pack_t *pk;
+  struct pitem *items;
+  struct stat st;
+  char *data;
+  size_t i, j, count;
+  int fd;
+
+  if (n == 0)
+    return 0;
+
+  pk = pack_open(pfd, name);
+  count = pk ? pk->count : 0;
+
+  if ((items = reallocarray(NULL, count + n, sizeof(*items))) == NULL)
+    err(1, "%s: reallocarray", __func__);
+
+  for (i = 0; i < count; i++) {
+    items[i].data = pack_item(pk, i, items[i].file, &items[i].size);
+    items[i].loose = 0;
+  }
+
+  for (i = 0; i < n; i++) {
+    if ((fd = openat(pfd, files[i], O_RDONLY | O_CLOEXEC)) == -1)
+      err(1, "%s: openat: %s", __func__, files[i]);
+    if (fstat(fd, &st) == -1)
+      err(1, "%s: fstat: %s", __func__, files[i]);
+    if ((data = malloc(st.st_size + 1)) == NULL)
+      err(1, "%s: malloc", __func__);
+    if (read_all(fd, data, st.st_size) != (size_t)st.st_size)
+      errx(1, "%s: short read: %s", __func__, files[i]);
+    if (close(fd) == -1)
+      err(1, "%s: close", __func__);
+
+    memcpy(items[count + i].file, files[i], sizeof(items[count + i].file));
+    items[count + i].data = data;
+    items[count + i].size = st.st_size;
+    items[count + i].loose = 1;
+  }
+
+  /* sort by file with a loose file before the packed one it replaces */
+  qsort(items, count + n, sizeof(*items), pitemcmp);
+  for (i = 0, j = 0; i < count + n; i++)
+    if (j == 0 || strcmp(items[i].file, items[j - 1].file) != 0)
+      items[j++] = items[i];
+    else if (items[i].loose)
+      errx(1, "%s: duplicate file: %s", __func__, items[i].file);
+
+  pack_write(pfd, name, items, j);
+
+  for (i = 0; i < n; i++)
+    if (unlinkat(pfd, files[i], 0) == -1)
+      err(1, "%s: unlinkat: %s", __func__, files[i]);
+
+  for (i = 0; i < j; i++)
+    if (items[i].loose)
+      free((char *)items[i].data);
+  free(items);
+  pack_close(pk);
+
+  return n;
+}
+
+/*
+ * Remove an entry file from its pack in the project directory pfd. The pack is
+ * removed once it is empty.
+ *
+ * Return 0 on success, -1 if the file is not packed.
+ */
+int
+pack_del(int pfd, const char *file)
+{
+  pack_t *pk;
+  struct pitem *items;
+  char name[PACKNAMESIZE];
+  size_t i, n;
+  int found;
+
+  pack_name(name, file);
+
+  if ((pk = pack_open(pfd, name)) == NULL)
+    return -1;
+
+  if ((items = reallocarray(NULL, pk->count + 1, sizeof(*items))) == NULL)
+    err(1, "%s: reallocarray", __func__);
+
+  found = 0;
+  for (i = 0, n = 0; i < pk->count; i++) {
+    items[n].data = pack_item(pk, i, items[n].file, &items[n].size);
+    items[n].loose = 0;
+    if (strcmp(items[n].file, file) == 0)
+      found = 1;
+    else
+      n++;
+  }
+
+  if (found)
+    pack_write(pfd, name, items, n);
+
+  free(items);
+  pack_close(pk);
+
+  return found ? 0 : -1;
+}
+
+/*
+ * Replace the pack with name by a pack of n sorted items, or remove it if n is
+ * 0. The new pack is synced to disk before it replaces the old one.
+ */
+static void
+pack_write(int pfd, const char *name, const struct pitem *items, size_t n)
+{
+  char tmp[1 + PACKNAMESIZE], *hdr, *item;
+  size_t i, hdrsize, off;
+  uint32_t v;
+  int fd;
+
+  if (n == 0) {
+    if (unlinkat(pfd, name, 0) == -1 && errno != ENOENT)
+      err(1, "%s: unlinkat: %s", __func__, name);
+    return;
+  }
+
+  hdrsize = 4 + sizeof v + n * PACKITEM;
+  if ((hdr = malloc(hdrsize)) == NULL)
+    err(1, "%s: malloc", __func__);
+
+  memcpy(hdr, PACKMAGIC, 4);
+  v = htonl(n);
+  memcpy(hdr + 4, &v, sizeof v);
+
+  off = hdrsize;
+  for (i = 0; i < n; i++) {
+    if (off > UINT32_MAX || items[i].size > UINT32_MAX - off)
+      errx(1, "%s: pack too large: %s", __func__, name);
+
+    item = hdr + 4 + sizeof v + i * PACKITEM;
+    memcpy(item, items[i].file, PACKFILELEN);
+    v = htonl(off);
+    memcpy(item + PACKFILELEN, &v, sizeof v);
+    v = htonl(items[i].size);
+    memcpy(item + PACKFILELEN + sizeof v, &v, sizeof v);
+    off += items[i].size;
+  }
+
+  /* a hidden file is skipped when the data dir is read */
+  tmp[0] = '.';
+  memcpy(tmp + 1, name, PACKNAMESIZE);
+
+  if ((fd = openat(pfd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+    err(1, "%s: openat: %s", __func__, tmp);
+  write_all(fd, hdr, hdrsize);
+  for (i = 0; i < n; i++)
+    write_all(fd, items[i].data, items[i].size);
+  if (fsync(fd) == -1)
+    err(1, "%s: fsync: %s", __func__, tmp);
+  if (close(fd) == -1)
+    err(1, "%s: close", __func__);
+
+  if (renameat(pfd, tmp, pfd, name) == -1)
+    err(1, "%s: renameat: %s", __func__, tmp);
+
+  free(hdr);
+}
+
+/* order items by file name and let a loose file precede a packed one */
+static int
+pitemcmp(const void *a, const void *b)
+{
+  const struct pitem *ia = a, *ib = b;
+  int cmp;
+
+  if ((cmp = strcmp(ia->file, ib->file)) != 0)
+    return cmp;
+
+  return ib->loose - ia->loose;
+}
+
+/*
+ * Read at most size bytes from fd into buf.
+ *
+ * Return the number of bytes read, less than size only at the end of the file.
+ */
+static size_t
+read_all(int fd, char *buf, size_t size)
+{
+  ssize_t n;
+  size_t off;
+
+  for (off = 0; off < size; off += n) {
+    if ((n = read(fd, buf + off, size - off)) == -1)
+      err(1, "%s: read", __func__);
+    if (n == 0)
+      break;
+  }
+
+  return off;
+}
+
+/* write size bytes of buf to fd */
+static void
+write_all(int fd, const char *buf, size_t size)
+{
+  ssize_t n;
+  size_t off;
+
+  for (off = 0; off < size; off += n)
+    if ((n = write(fd, buf + off, size - off)) == -1)
+      err(1, "%s: write", __func__);
+}
@@ -0,0 +1,45 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <arpa/inet.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "compat/compat.h"
+#include "log.h"
+
+/* first bytes of every pack */
+#define PACKMAGIC "UPK1"
+
+/* length of the name of an entry file, two times and an '_' */
+#define PACKFILELEN 29
+
+/* size of the name of a pack, "YYYY.pack" and a null */
+#define PACKNAMESIZE 10
+
+/* size of an item in the table of a pack, a file name, offset and size */
+#define PACKITEM (PACKFILELEN + 2 * sizeof(uint32_t))
+
+/* an open pack, see pack_open() */
+typedef struct pack pack_t;
+
+void pack_name(char *dst, const char *file);
+int is_pack_name(const char *name);
+pack_t *pack_open(int pfd, const char *name);
+const char *pack_get(const pack_t *pk, const char *file, size_t *size);
+size_t pack_count(const pack_t *pk);
+const char *pack_item(const pack_t *pk, size_t i, char *file, size_t *size);
+void pack_close(pack_t *pk);
+size_t pack_add(int pfd, const char *name, char (*files)[PACKFILELEN + 1], size_t n);
+int pack_del(int pfd, const char *file);
+
+#endif
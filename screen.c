@@ -2,32 +2,60 @@
 
 static int calc_status_line(int *count, int *summ);
 static void update_status_line(int count, int summ);
+static void update_status_file(void);
+static int wait_key(void);
 static int filter_form(void);
 static void enable_filter(char *proj, time_t start, time_t end);
 static void disable_filter(void);
+static size_t resolve_filter(const char *spec);
+static void free_fprojs(void);
 static int filter_enabled(void);
-static int timer_started(void);
-static int timer_start(void);
-static int timer_stop(void);
-static int timer_toggle(void);
+static int load_timers(void);
+static int timer_start(const char *proj);
+static time_t timer_stop(const char *proj);
+static int timer_toggle(size_t num);
 static int ensure_key_storage(void);
 static int get_idx(const DBT *key);
 static const DBT *cur_get_key(void);
+static const char *cur_get_proj(void);
 static int proj_filter_active(void);
 static int add_entry_before(const DBT *ckey);
 static int add_entry_after(const DBT *ckey);
 static int ch_entry(const DBT *key);
 static int rm_entry(const DBT *key);
+static void warn_overlap(const entryl_t *el, const DBT *key);
+static int next_gap(const DBT *key);
+static int goto_date(void);
+static int search_form(int reverse);
+static int search_move(const char *q, const DBT *from, int reverse);
 static int reload_scr(const DBT *first);
+static void toggle_groups(void);
+static time_t group_start(time_t t);
+static void sum_groups(void);
+static int entry_row(int n);
+static int entries_above(int row);
 static void cur_mv_down(uint32_t mv_lines);
 static void cur_mv_up(uint32_t mv_lines);
+static void cur_mv_entries(int n);
 static void cur_mv_line(uint32_t line);
+static void cur_set_row(int row);
 static void cur_mv_key(const DBT *key);
 static int move_lines(int mv_lines);
+static int motion_lines(int key, size_t count, int *scroll);
+static void move_key(int key, size_t count);
 static void vp_mv_top(void);
 static void vp_mv_bottom(void);
+static void vp_show_last(const DBT *key);
 static int fetch_nkey(DBT *key);
+static int ignore_key(DBT *key);
 static int print_key(int idx);
+static void print_head(int idx);
+static void render_key(const DBT *key, char *dst, size_t dstsize);
+static void prefetch(void);
+static int fetch_pre(DBT *key);
+static int find_prefetched(const DBT *key);
+static void free_prefetch(void);
+static int key_pending(void);
 static int duration_in_hours(const time_t *start, const time_t *end, int *hours, int *minutes);
 static void free_keys(int i);
 int copy_file(const char *dataroot, const char *fname, FILE *src);
@@ -35,11 +63,21 @@ int copy_file(const char *dataroot, const char *fname, FILE *src);
 /* keep track of the total number of entries and the total number of minutes */
 static int ecount, mtotal;
 
-static const char tfile[] = ".timer";
+/* running timers in order of start, only reread when twatch reports a change */
+static timer_entry_t timers[MAXTIMERS];
+static size_t ntimers;
+static int twatch = -1;
+
+/* the last search query, repeated by n and N */
+static char query[MAXLINE];
+static int qreverse;
 
 /* use gfilter->fname[0] as an active flag */
 static entryl_t gfilter;
 
+/* null terminated list of project names that match gfilter.proj */
+static char **fprojs = NULL;
+
 // track collection of keys on the screen
 static struct {
   const DBT **coll;
@@ -49,6 +87,23 @@ static struct {
   0
 };
 
+/*
+ * Group headers on the screen, one element per line like keys. A line is a
+ * header if there is no key on it and start is set to the start of the day or
+ * week of the group. mins is the total of all entries in the group.
+ */
+static struct {
+  time_t *start;
+  int *mins;
+} heads = {
+  NULL,
+  NULL
+};
+
+/* the entries on the screen are not grouped, grouped by day or by week */
+enum { GNONE, GDAY, GWEEK };
+static int groups = GNONE;
+
 // temp storage of newly fetched keys used by fetch and print_key
 static struct {
   const DBT **coll;
@@ -71,10 +126,40 @@ static struct {
 static int vp_lines, vp_cols, e_lines, s_lines = 2;
 static char *datapath;
 
-/* init the viewport, fill with entries */
+/*
+ * The keys in and around the viewport with their rendered lines, fetched while
+ * idle by prefetch() so that paging needs neither the index nor the project
+ * files. Only used if ready is set, freed on every change of the entries, the
+ * filter or the screen size.
+ */
+static struct {
+  const DBT **coll;
+  char **lines;
+  size_t size;
+  size_t n;
+  int ready;
+  int atstart; /* there are no keys before coll[0] */
+  int atend; /* there are no keys after coll[n - 1] */
+  int cols; /* screen width the lines are rendered for */
+} pre = {
+  NULL,
+  NULL,
+  0,
+  0,
+  0,
+  0,
+  0,
+  0
+};
+
+/* the index that is shown in the viewport */
+static idx_t *vp_idx;
+
+/* init the viewport on an open index, fill with entries */
 void
-vp_init(char *dp)
+vp_init(idx_t *idx, char *dp)
 {
+  vp_idx = idx;
   datapath = dp;
 
   initscr();
@@ -84,6 +169,13 @@ vp_init(char *dp)
   noecho();
 
   ensure_key_storage();
+
+  /* start watching before the timers are read so that no change is missed */
+  twatch = timer_watch(datapath);
+  if (timer_read(datapath, timers, &ntimers) == -1)
+    err(1, "%s: timer_read", __func__);
+
+  update_status_file();
   if (calc_status_line(&ecount, &mtotal) != 0)
     errx(1, "%s: calc_status_line", __func__);
 
@@ -95,15 +187,31 @@ vp_init(char *dp)
 int
 vp_start(void)
 {
-  int i, prevkey, resetprev, key, proceed;
+  int i, prevkey, resetprev, key, proceed, ready;
   size_t count;
   char countstr[7];
 
   prevkey = 0;
   resetprev = 0;
   proceed = 1;
+  ready = 0;
   countstr[0] = '\0';
-  while(proceed && (key = getch()) != ERR) {
+
+  /* don't block in getch(), wait_key() sleeps until there is something to do */
+  if (nodelay(stdscr, TRUE) == ERR)
+    errx(1, "%s: nodelay", __func__);
+
+  while (proceed) {
+    if ((key = getch()) == ERR) {
+      /* stdin is readable but there is no key, end of input */
+      if (ready)
+        break;
+      prefetch();
+      ready = wait_key();
+      continue;
+    }
+    ready = 0;
+
     //mvprintw(e_lines, 0, "%d %c ", key, key);
 
     // redetermine screen size and resize keys and nkeys if needed
@@ -130,46 +238,16 @@ vp_start(void)
       countstr[i + 1] = '\0';
       break;
     case 2: // ctrl-B, scroll a full screen up minus two items
-      if ((i = use_count(&count, countstr)) == -1)
-        errx(1, "%s: ^B use_count", __func__);
-      if (i == 1)
-        count = 1;
-      move_lines(-1 * count * e_lines - 2);
-      break;
+    case 4: // ctrl-D, scroll half the screen down
     case 5: // ctrl-E
-      if ((i = use_count(&count, countstr)) == -1)
-        errx(1, "%s: ^E use_count", __func__);
-      if (i == 1)
-        count = 1;
-      move_lines(count);
-      break;
     case 6: // ctrl-F, scroll a full screen down minus two items
-      if ((i = use_count(&count, countstr)) == -1)
-        errx(1, "%s: ^F use_count", __func__);
-      if (i == 1)
-        count = 1;
-      move_lines(count * e_lines - 2);
-      break;
-    case 4: // ctrl-D, scroll half the screen down
-      if ((i = use_count(&count, countstr)) == -1)
-        errx(1, "%s: ^D use_count", __func__);
-      if (i == 1)
-        count = 1;
-      move_lines(count * e_lines / 2);
-      break;
     case 21: // ctrl-U, scroll half the screen up
-      if ((i = use_count(&count, countstr)) == -1)
-        errx(1, "%s: ^U use_count", __func__);
-      if (i == 1)
-        count = 1;
-      move_lines(-1 * count * e_lines / 2);
-      break;
     case 25: // ctrl-Y
+    case 'j':
+    case 'k':
       if ((i = use_count(&count, countstr)) == -1)
-        errx(1, "%s: ^Y use_count", __func__);
-      if (i == 1)
-        count = 1;
-      move_lines(-1 * count);
+        errx(1, "%s: motion use_count", __func__);
+      move_key(key, i == 1 ? 0 : count);
       break;
     case 'd':
       if (prevkey == 'd') {
@@ -183,20 +261,6 @@ vp_start(void)
       else
         filter_form();
       break;
-    case 'k':
-      if ((i = use_count(&count, countstr)) == -1)
-        errx(1, "%s: j use_count", __func__);
-      if (i == 1)
-        count = 1;
-      cur_mv_up(count);
-      break;
-    case 'j':
-      if ((i = use_count(&count, countstr)) == -1)
-        errx(1, "%s: j use_count", __func__);
-      if (i == 1)
-        count = 1;
-      cur_mv_down(count);
-      break;
     case 'g':
       if (prevkey == 'g') {
         vp_mv_top();
@@ -241,7 +305,32 @@ vp_start(void)
         errx(1, "%s: calc_status_line", __func__);
       break;
     case 's':
-      timer_toggle();
+      if ((i = use_count(&count, countstr)) == -1)
+        errx(1, "%s: s use_count", __func__);
+      timer_toggle(i == 1 ? 0 : count);
+      break;
+    case 't':
+      timer_start(cur_get_proj());
+      break;
+    case ']':
+      next_gap(cur_get_key());
+      break;
+    case ':':
+      goto_date();
+      break;
+    case 'v':
+      toggle_groups();
+      break;
+    case '/':
+      search_form(0);
+      break;
+    case '?':
+      search_form(1);
+      break;
+    case 'n':
+    case 'N':
+      if (search_move(query, cur_get_key(), key == 'n' ? qreverse : !qreverse) == 1)
+        info_prompt("no match");
       break;
     case 'S':
       ch_entry(cur_get_key());
@@ -277,7 +366,7 @@ filter_form(void)
   if (el.end == 0)
     el.end = time(NULL);
 
-  switch (entryl(&el, vp_lines - 1, gfilter.proj, (const char **)idx_uniq_proj(), el.start, el.end, NULL, NULL, 1)) {
+  switch (entryl(&el, vp_lines - 1, gfilter.proj, (const char **)idx_uniq_proj(vp_idx), el.start, el.end, NULL, NULL, 1)) {
   case LERROR:
     info_prompt("form error");
     break;
@@ -297,10 +386,12 @@ enable_filter(char *proj, time_t start, time_t end)
 {
   if (strlcpy(gfilter.proj, proj, sizeof gfilter.proj) > sizeof gfilter.proj)
     errx(1, "%s: strlcpy", __func__);
+  resolve_filter(gfilter.proj);
   gfilter.start = start;
   gfilter.end = end;
   gfilter.fname[0] = 1;
 
+  free_prefetch();
   reload_scr(NULL);
   if (calc_status_line(&ecount, &mtotal) != 0)
     errx(1, "%s: calc_status_line", __func__);
@@ -311,12 +402,79 @@ disable_filter(void)
 {
   gfilter.proj[0] = '\0';
   gfilter.fname[0] = 0;
+  free_fprojs();
 
+  free_prefetch();
   reload_scr(NULL);
   if (calc_status_line(&ecount, &mtotal) != 0)
     errx(1, "%s: calc_status_line", __func__);
 }
 
+/*
+ * Resolve a project filter into the list of all known project names that match
+ * it and store it in fprojs. The filter consists of one or more project names
+ * or shell patterns, separated by commas or blanks, like "acme-*,internal".
+ *
+ * Return the number of matching projects.
+ */
+static size_t
+resolve_filter(const char *spec)
+{
+  char pats[MAXPROJ], *patv[MAXPROJ], *pat, *sp;
+  char **names;
+  size_t i, j, n, npat;
+
+  free_fprojs();
+
+  if (strlcpy(pats, spec, sizeof pats) >= sizeof pats)
+    errx(1, "%s: strlcpy", __func__);
+
+  npat = 0;
+  sp = pats;
+  while ((pat = strsep(&sp, ", \t")) != NULL)
+    if (*pat != '\0')
+      patv[npat++] = pat;
+
+  if ((fprojs = calloc(1, sizeof(char *))) == NULL)
+    err(1, "%s: calloc", __func__);
+
+  /* the project names are unique and sorted, so is the result */
+  n = 0;
+  names = idx_uniq_proj(vp_idx);
+  for (i = 0; names[i]; i++) {
+    for (j = 0; j < npat; j++)
+      if (fnmatch(patv[j], names[i], 0) == 0)
+        break;
+
+    if (j == npat)
+      continue;
+
+    if ((fprojs = reallocarray(fprojs, n + 2, sizeof(char *))) == NULL)
+      err(1, "%s: reallocarray", __func__);
+    if ((fprojs[n++] = strdup(names[i])) == NULL)
+      err(1, "%s: strdup", __func__);
+    fprojs[n] = NULL;
+  }
+
+  return n;
+}
+
+/* free fprojs */
+static void
+free_fprojs(void)
+{
+  size_t i;
+
+  if (fprojs == NULL)
+    return;
+
+  for (i = 0; fprojs[i]; i++)
+    free(fprojs[i]);
+
+  free(fprojs);
+  fprojs = NULL;
+}
+
 /* return 1 if filter is active, 0 if not */
 static int
 filter_enabled(void)
@@ -324,118 +482,134 @@ filter_enabled(void)
   return gfilter.fname[0];
 }
 
-/* return number of seconds since epoch if timer is started, 0 if not, -1 on error */
+/* reread the timers if another process might have changed them. 0 on success, -1 on error */
 static int
-timer_started(void)
+load_timers(void)
 {
-  struct stat st;
-  char pname[PATH_MAX];
-
-  if (snprintf(pname, sizeof pname, "%s/%s", datapath, tfile) >= sizeof pname)
-    errx(1, "%s: snprintf", __func__);
+  if (timer_changed(twatch))
+    return timer_read(datapath, timers, &ntimers);
 
-  if (stat(pname, &st) == -1) {
-    if (errno == ENOENT)
-      return 0;
-    else
-      return -1;
-  }
-
-  if (st.st_ctime > time(NULL))
-    errx(1, "%s: time is in the future %ld", __func__, st.st_ctime);
-
-  return st.st_ctime;
+  return 0;
 }
 
-/* start running a timer. 0 on success, -1 on error */
+/*
+ * Start running a timer for proj, which may be empty.
+ *
+ * Return 0 on success, -1 if a timer for proj is running already or if too many
+ * timers are running.
+ */
 static int
-timer_start(void)
+timer_start(const char *proj)
 {
-  int fd;
-
-  char pname[PATH_MAX];
+  size_t i;
 
-  if (snprintf(pname, sizeof pname, "%s/%s", datapath, tfile) >= sizeof pname)
-    errx(1, "%s: snprintf", __func__);
+  if (load_timers() == -1)
+    err(1, "%s: load_timers", __func__);
 
-  if ((fd = open(pname, O_CREAT | O_EXCL, 0600)) == -1) {
-    if (errno != EEXIST)
-      err(1, "%s: open", __func__);
-    else {
-      /* timer already running */
+  for (i = 0; i < ntimers; i++) {
+    if (strcmp(timers[i].proj, proj) == 0) {
+      info_prompt("stopwatch already running");
       return -1;
     }
   }
-  if (close(fd) == -1)
-    err(1, "%s: close", __func__);
+
+  if (ntimers == MAXTIMERS) {
+    info_prompt("too many stopwatches");
+    return -1;
+  }
+
+  if (strlcpy(timers[ntimers].proj, proj, MAXPROJ) >= MAXPROJ)
+    errx(1, "%s: project name too long", __func__);
+  timers[ntimers].start = time(NULL);
+  ntimers++;
+
+  if (timer_write(datapath, timers, ntimers) == -1)
+    err(1, "%s: timer_write", __func__);
+
+  update_status_file();
 
   return 0;
 }
 
 /*
- * stop a running timer.
+ * stop the running timer of proj.
  *
  * returns the number of seconds since the epoch when the timer was started
  * 0 if no timer was running
- * -1 on error
  */
-static int
-timer_stop(void)
+static time_t
+timer_stop(const char *proj)
 {
-  int s;
-  char pname[PATH_MAX];
+  time_t s;
+  size_t i;
 
-  if (snprintf(pname, sizeof pname, "%s/%s", datapath, tfile) >= sizeof pname)
-    errx(1, "%s: snprintf", __func__);
+  if (load_timers() == -1)
+    err(1, "%s: load_timers", __func__);
 
-  s = timer_started();
+  for (i = 0; i < ntimers; i++)
+    if (strcmp(timers[i].proj, proj) == 0)
+      break;
 
-  if (unlink(pname) == -1) {
-    if (errno == ENOENT && s == 0)
-      return 0;
-    else
-      err(1, "%s: unlink", __func__);
-  }
+  if (i == ntimers)
+    return 0;
+
+  s = timers[i].start;
+  memmove(&timers[i], &timers[i + 1], (ntimers - i - 1) * sizeof *timers);
+  ntimers--;
+
+  if (timer_write(datapath, timers, ntimers) == -1)
+    err(1, "%s: timer_write", __func__);
+
+  update_status_file();
 
   return s;
 }
 
 /*
- * Either starts or stops a timer. If a timer was running, asks the user for
- * input with defaults set to the recorded time.
+ * Either starts or stops a timer. If num is not 0 timer number num on the
+ * status line is stopped. Otherwise the most recently started timer is stopped,
+ * or if no timer is running, a timer for the project of the current entry is
+ * started. Stopping asks the user for input with defaults set to the project
+ * and the recorded time of the timer.
  *
  * Returns 0 on success, -1 on failure.
  */
 static int
-timer_toggle(void)
+timer_toggle(size_t num)
 {
-  int s;
+  timer_entry_t t;
   DBT *pkey, *dkey;
   entryl_t el;
 
-  s = timer_started();
+  if (load_timers() == -1)
+    err(1, "%s: load_timers", __func__);
 
-  if (s < 0)
-    err(1, "%s: timer_started", __func__);
+  if (num > ntimers)
+    return -1;
+
+  if (ntimers == 0)
+    return timer_start(cur_get_proj());
 
-  if (!s)
-    return timer_start();
+  t = timers[num ? num - 1 : ntimers - 1];
 
   /* first update displayed timer */
   if (calc_status_line(&ecount, &mtotal) != 0)
     errx(1, "%s: calc_status_line", __func__);
   update_status_line(ecount, mtotal);
 
-  switch (entryl(&el, vp_lines - 1, NULL, (const char **)idx_uniq_proj(), s, time(NULL), datapath, ".add", 0)) {
+  switch (entryl(&el, vp_lines - 1, t.proj[0] ? t.proj : NULL, (const char **)idx_uniq_proj(vp_idx), t.start, time(NULL), datapath, ".add", 0)) {
   case LERROR:
     log_warnx("form error");
     return -1;
   case LSAVE:
-    if (idx_save_project_file(&el, NULL, &pkey, &dkey) == -1)
+    warn_overlap(&el, NULL);
+    if (idx_save_project_file(vp_idx, &el, NULL, &pkey, &dkey) == -1)
       errx(1, "%s: idx_save_project_file", __func__);
+    free_prefetch();
+    update_status_file();
 
-    if (timer_stop() <= 0)
-      err(1, "%s: timer_stop", __func__);
+    if (timer_stop(t.proj) == 0)
+      errx(1, "%s: timer_stop", __func__);
 
     /* reload and center around the added entry */
     reload_scr(proj_filter_active() ? pkey : dkey);
@@ -481,13 +655,16 @@ add_entry_before(const DBT *ckey)
     start = idx_key_start(ckey);
     end = start;
   }
-  switch (entryl(&el, vp_lines - 1, proj, (const char **)idx_uniq_proj(), start, end, datapath, ".add", 0)) {
+  switch (entryl(&el, vp_lines - 1, proj, (const char **)idx_uniq_proj(vp_idx), start, end, datapath, ".add", 0)) {
   case LERROR:
     info_prompt("form error");
     break;
   case LSAVE:
-    if (idx_save_project_file(&el, NULL, &pkey, &dkey) == -1)
+    warn_overlap(&el, NULL);
+    if (idx_save_project_file(vp_idx, &el, NULL, &pkey, &dkey) == -1)
       errx(1, "%s: idx_save_project_file", __func__);
+    free_prefetch();
+    update_status_file();
 
     /* reload and center around the added entry */
     reload_scr(proj_filter_active() ? pkey : dkey);
@@ -525,13 +702,16 @@ add_entry_after(const DBT *ckey)
     proj = idx_key_proj(ckey);
     start = idx_key_end(ckey);
   }
-  switch (entryl(&el, vp_lines - 1, proj, (const char **)idx_uniq_proj(), start, 0, datapath, ".add", 0)) {
+  switch (entryl(&el, vp_lines - 1, proj, (const char **)idx_uniq_proj(vp_idx), start, 0, datapath, ".add", 0)) {
   case LERROR:
     info_prompt("form error");
     break;
   case LSAVE:
-    if (idx_save_project_file(&el, NULL, &pkey, &dkey) == -1)
+    warn_overlap(&el, NULL);
+    if (idx_save_project_file(vp_idx, &el, NULL, &pkey, &dkey) == -1)
       errx(1, "%s: idx_save_project_file", __func__);
+    free_prefetch();
+    update_status_file();
 
     /* reload and center around the added entry */
     reload_scr(proj_filter_active() ? pkey : dkey);
@@ -569,20 +749,23 @@ ch_entry(const DBT *key)
   start = idx_key_start(key);
   end = idx_key_end(key);
 
-  if ((fp = idx_open_project_file(key)) == NULL)
+  if ((fp = idx_open_project_file(vp_idx, key)) == NULL)
     errx(1, "%s: idx_open_project_file", __func__);
   if (copy_file(datapath, ".edit", fp) == -1)
     errx(1, "%s: copy_file", __func__);
   if (fclose(fp) == EOF)
     err(1, "%s: fclose", __func__);
 
-  switch (entryl(&el, vp_lines - 1, proj, (const char **)idx_uniq_proj(), start, end, datapath, ".edit", 0)) {
+  switch (entryl(&el, vp_lines - 1, proj, (const char **)idx_uniq_proj(vp_idx), start, end, datapath, ".edit", 0)) {
   case LERROR:
     info_prompt("Form error");
     break;
   case LSAVE:
-    if (idx_save_project_file(&el, key, NULL, NULL) == -1)
+    warn_overlap(&el, key);
+    if (idx_save_project_file(vp_idx, &el, key, NULL, NULL) == -1)
       errx(1, "%s: idx_save_project_file", __func__);
+    free_prefetch();
+    update_status_file();
 
     /* reload and center around the changed entry */
     reload_scr(key);
@@ -597,6 +780,22 @@ ch_entry(const DBT *key)
   return 0;
 }
 
+/* warn if the entry in el overlaps with any other entry than key */
+static void
+warn_overlap(const entryl_t *el, const DBT *key)
+{
+  int n;
+  char msg[64];
+
+  if ((n = idx_overlaps(vp_idx, el->start, el->end, key)) == 0)
+    return;
+
+  if (snprintf(msg, sizeof msg, "overlaps with %d other entr%s", n, n == 1 ? "y" : "ies") >= sizeof msg)
+    errx(1, "%s: snprintf", __func__);
+
+  info_prompt(msg);
+}
+
 static int
 rm_entry(const DBT *key)
 {
@@ -604,8 +803,10 @@ rm_entry(const DBT *key)
   if (key == NULL)
     return -1;
 
-  if (idx_del_by_key(key) == -1)
+  if (idx_del_by_key(vp_idx, key) == -1)
     errx(1, "%s: idx_del_by_key", __func__);
+  free_prefetch();
+  update_status_file();
 
   /* reload and center around the deleted entry */
   reload_scr(key);
@@ -619,20 +820,18 @@ rm_entry(const DBT *key)
 }
 
 /*
- * Reload all keys on the screen, optionally starting at the given key.
+ * Move to the first entry after the given key that is preceded by untracked
+ * time within working hours.
  *
  * Return 0 on success, -1 on error.
  */
 static int
-reload_scr(const DBT *first)
+next_gap(const DBT *key)
 {
-  const DBT *offset;
-  int i;
+  DBT *found;
 
-  if (first)
-    offset = idx_copy_key(first);
-  else
-    offset = NULL;
+  if (key == NULL)
+    return -1;
 
   /* set iterator options */
   idx_itopts_t opts = {
@@ -641,140 +840,615 @@ reload_scr(const DBT *first)
     0, /* time_t maxstart; */
     1, /* int includemin; */
     0, /* int includemax; */
-    keys.size, /* size_t limit; */
+    0, /* size_t limit; */
     0, /* size_t skip; */
     0, /* int reverse; */
-    (DBT *)offset /* DBT *offset; */
+    (DBT *)key, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
   };
   if (filter_enabled()) {
     if (proj_filter_active())
-      opts.proj = gfilter.proj;
+      opts.projs = fprojs;
     opts.minstart = gfilter.start;
     opts.maxstart = gfilter.end;
   }
 
-  /* now free and fetch all keys */
-  free_keys(0);
-  idx_iterate(&opts, fetch_nkey, NULL);
-
-  /* and free the copied offset */
-  if (offset)
-    idx_free_key(&offset);
-
-  /* move newly found keys */
-  for (i = 0; i < nkeys.nextw; i++) {
-    assert(nkeys.coll[i]);
-    assert(!keys.coll[i]);
-    keys.coll[i] = nkeys.coll[i];
-    nkeys.coll[i] = NULL;
+  if ((found = gap_next(vp_idx, &opts)) == NULL) {
+    info_prompt("no gap found");
+    return 0;
   }
-  nkeys.nextw = 0;
 
-  /* and redraw the whole screen */
-  for (int i = 0; i < keys.size; i++)
-    print_key(i);
+  /* reload and center around the entry after the gap */
+  reload_scr(found);
+  move_lines(-1 * e_lines / 2);
+  cur_mv_key(found);
+  idx_free_key((const DBT **)&found);
 
   return 0;
 }
 
-/* calculate number of entries and total number of minutes */
+/*
+ * Ask for a date and move to the first entry that starts at or after it. This
+ * takes a single seek in the index, no matter how far away the entry is. If
+ * there is no such entry, move to the bottom.
+ *
+ * Return 0 on success, -1 on error.
+ */
 static int
-calc_status_line(int *count, int *summ)
+goto_date(void)
 {
+  WINDOW *w;
+  DBT *found;
+  const DBT *key;
+  time_t t;
+  int r;
+
+  /* default to the entry under the cursor */
+  if ((key = cur_get_key()) != NULL)
+    t = idx_key_start(key);
+  else
+    t = time(NULL);
+
+  if ((w = newwin(1, 0, vp_lines - 1, 0)) == NULL)
+    errx(1, "%s: newwin", __func__);
+  r = entryl_date(w, &t, "Go to:", t);
+  if (delwin(w) == ERR)
+    errx(1, "%s: delwin", __func__);
+
+  switch (r) {
+  case -1:
+    info_prompt("illegal date");
+    return -1;
+  case 1:
+    return 0;
+  }
+
   /* set iterator options */
   idx_itopts_t opts = {
     NULL, /* char *proj; */
-    0, /* time_t minstart; */
+    t, /* time_t minstart; */
     0, /* time_t maxstart; */
     1, /* int includemin; */
-    1, /* int includemax; */
-    0, /* size_t limit; */
+    0, /* int includemax; */
+    1, /* size_t limit; */
     0, /* size_t skip; */
     0, /* int reverse; */
-    NULL /* DBT *offset; */
+    NULL, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
   };
   if (filter_enabled()) {
     if (proj_filter_active())
-      opts.proj = gfilter.proj;
-    opts.minstart = gfilter.start;
+      opts.projs = fprojs;
+    opts.minstart = max(t, gfilter.start);
     opts.maxstart = gfilter.end;
   }
 
-  return idx_count(&opts, count, summ);
-}
-
-/* use the status lines at the bottom of the screen */
-static void
-update_status_line(int count, int summ)
-{
-  int s, y;
-  char sdout[64];
-
-  getyx(stdscr, y, s);
-  if ((s = timer_started()) == -1)
-    errx(1, "%s: timer_started", __func__);
+  found = NULL;
+  if (idx_iterate(vp_idx, &opts, ignore_key, &found) == -1)
+    errx(1, "%s: idx_iterate", __func__);
 
-  if (s) {
-    s = time(NULL) - s;
-    if (mvprintw(e_lines, 0, " %d                            %2d:%02d    timer: %2d:%02d", count, summ / 60, summ % 60, s / 60, s % 60) == ERR)
-      errx(1, "%s: mvprintw", __func__);
-  } else {
-    if (mvprintw(e_lines, 0, " %d                            %2d:%02d", count, summ / 60, summ % 60) == ERR)
-      errx(1, "%s: mvprintw", __func__);
+  if (found == NULL) {
+    vp_mv_bottom();
+    return 0;
   }
 
-  if (filter_enabled()) {
-    if (printw("\t\t%s\t", gfilter.proj) == ERR)
-      errx(1, "%s: printw project", __func__);
-
-    if (strftime(sdout, sizeof sdout, "%R %d-%m-%Y", localtime(&gfilter.start)) == 0)
-      err(1, "%s: could not format broken-down start time", __func__);
-    if (printw("   %s", sdout) == ERR)
-      errx(1, "%s: printw start", __func__);
+  /* reload and center around the found entry */
+  reload_scr(found);
+  move_lines(-1 * e_lines / 2);
+  cur_mv_key(found);
+  idx_free_key((const DBT **)&found);
 
-    if (strftime(sdout, sizeof sdout, "%R %d-%m-%Y", localtime(&gfilter.end)) == 0)
-      err(1, "%s: could not format broken-down end time", __func__);
-    if (printw(" - %s", sdout) == ERR)
-      errx(1, "%s: printw end", __func__);
-  }
-  clrtoeol();
-  if (mvchgat(e_lines, 0, -1, A_REVERSE, 0, NULL) == ERR)
-    errx(1, "%s: mvchgat ON", __func__);
-  /* clear last line, expect two status lines */
-  assert(s_lines == 2);
-  move(e_lines + 1, 0);
-  clrtoeol();
-  move(y, 0);
+  return 0;
 }
 
 /*
- * Determine viewport size, number of entry lines and status lines and ensure
- * key and nkeys are big enough for the current number of entry lines
- * (e_lines).
+ * Read a search query on the last line and move to the next entry with a
+ * matching description while it is typed. Enter keeps the match, escape moves
+ * back to where the search started. An empty query repeats the last one.
+ *
+ * Return 0 on success, -1 on error.
  */
 static int
-ensure_key_storage(void)
+search_form(int reverse)
 {
-  int i, diff;
+  const DBT *start, *top;
+  char buf[sizeof query];
+  size_t len;
+  int key, y, i, cancel;
+
+  if ((start = cur_get_key()) != NULL)
+    start = idx_copy_key(start);
+  top = NULL;
+  if ((i = entry_row(0)) != -1)
+    top = idx_copy_key(keys.coll[i]);
+
+  /* block while the query is typed */
+  if (nodelay(stdscr, FALSE) == ERR)
+    errx(1, "%s: nodelay", __func__);
+
+  len = 0;
+  buf[0] = '\0';
+  cancel = 0;
+  for (;;) {
+    /* show the query but keep the cursor on the current entry */
+    y = getcury(stdscr);
+    mvprintw(vp_lines - 1, 0, "%c%s", reverse ? '?' : '/', buf);
+    clrtoeol();
+    move(y, 0);
 
-  /* check for curruption first: keys.size == nkeys.size == e_lines, */
-  assert(keys.size == e_lines);
-  assert(keys.size == nkeys.size);
+    key = getch();
+    if (key == '\n' || key == '\r')
+      break;
+    if (key == 27 || key == ERR) {
+      cancel = 1;
+      break;
+    }
 
-  /* determine screen size and init keys and nkeys */
-  getmaxyx(stdscr, vp_lines, vp_cols);
+    if (key == 127 || key == 8 || key == KEY_BACKSPACE) {
+      if (len == 0) {
+        cancel = 1;
+        break;
+      }
+      buf[--len] = '\0';
+    } else if (isprint(key) && len < sizeof buf - 1) {
+      buf[len++] = key;
+      buf[len] = '\0';
+    } else {
+      continue;
+    }
 
-  /* keep the lines used for status info free */
-  e_lines = vp_lines - s_lines;
+    /* search from where the search started, or go back if nothing matches */
+    if (search_move(buf, start, reverse) != 0) {
+      reload_scr(top);
+      cur_mv_key(start);
+    }
+  }
 
-  diff = e_lines - keys.size;
+  if (nodelay(stdscr, TRUE) == ERR)
+    errx(1, "%s: nodelay", __func__);
 
-  if (diff == 0)
-    return 0;
+  if (cancel) {
+    reload_scr(top);
+    cur_mv_key(start);
+  } else if (len == 0) {
+    if (search_move(query, start, reverse) == 1)
+      info_prompt("no match");
+    qreverse = reverse;
+  } else {
+    if (strlcpy(query, buf, sizeof query) >= sizeof query)
+      errx(1, "%s: strlcpy", __func__);
+    qreverse = reverse;
+  }
 
-  /* free extraneous keys */
-  if (diff < 0) {
-    log_warnx("%s: free %d keys", __func__, diff);
+  if (start)
+    idx_free_key(&start);
+  if (top)
+    idx_free_key(&top);
+
+  return 0;
+}
+
+/*
+ * Move to the first entry after from, or before from if reverse is set, with a
+ * description that matches q, see idx_search(). Wraps around at the end.
+ *
+ * Return 0 if found, 1 if not, -1 on error.
+ */
+static int
+search_move(const char *q, const DBT *from, int reverse)
+{
+  DBT *found;
+  int r;
+
+  /* set iterator options */
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    0, /* time_t maxstart; */
+    0, /* int includemin; */
+    0, /* int includemax; */
+    0, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    NULL, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+  if (filter_enabled()) {
+    if (proj_filter_active())
+      opts.projs = fprojs;
+    opts.minstart = gfilter.start;
+    opts.maxstart = gfilter.end;
+  }
+
+  if ((r = idx_search(vp_idx, q, from, reverse, &opts, &found)) == 1 && from)
+    r = idx_search(vp_idx, q, NULL, reverse, &opts, &found);
+
+  if (r != 0)
+    return r;
+
+  /* reload and center around the found entry */
+  reload_scr(found);
+  move_lines(-1 * e_lines / 2);
+  cur_mv_key(found);
+  idx_free_key((const DBT **)&found);
+
+  return 0;
+}
+
+/*
+ * Reload all keys on the screen, optionally starting at the given key.
+ *
+ * Return 0 on success, -1 on error.
+ */
+static int
+reload_scr(const DBT *first)
+{
+  const DBT *offset;
+  int i, row, hrow;
+  time_t g;
+
+  if (first)
+    offset = idx_copy_key(first);
+  else
+    offset = NULL;
+
+  /* set iterator options */
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    0, /* time_t maxstart; */
+    1, /* int includemin; */
+    0, /* int includemax; */
+    keys.size, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    (DBT *)offset, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+  if (filter_enabled()) {
+    if (proj_filter_active())
+      opts.projs = fprojs;
+    opts.minstart = gfilter.start;
+    opts.maxstart = gfilter.end;
+  }
+
+  /* now free and fetch all keys, from the prefetched keys if they cover the screen */
+  free_keys(0);
+  if (offset && (i = find_prefetched(offset)) != -1 && (i + keys.size <= pre.n || pre.atend)) {
+    for (; i < pre.n && nkeys.nextw < nkeys.size; i++)
+      nkeys.coll[nkeys.nextw++] = idx_copy_key(pre.coll[i]);
+  } else {
+    idx_iterate(vp_idx, &opts, fetch_nkey, NULL);
+  }
+
+  /* and free the copied offset */
+  if (offset)
+    idx_free_key(&offset);
+
+  /* move newly found keys, if grouped start every group with a header */
+  row = 0;
+  hrow = 0;
+  for (i = 0; i < nkeys.nextw; i++) {
+    assert(nkeys.coll[i]);
+    if (groups != GNONE) {
+      g = group_start(idx_key_start(nkeys.coll[i]));
+      if (row == 0 || g != heads.start[hrow]) {
+        /* don't end the screen with a header */
+        if (row + 1 >= keys.size)
+          break;
+        heads.start[row] = g;
+        hrow = row++;
+      }
+      if (row >= keys.size)
+        break;
+    }
+    assert(!keys.coll[row]);
+    keys.coll[row++] = nkeys.coll[i];
+    nkeys.coll[i] = NULL;
+  }
+
+  /* free the keys that did not fit because of the headers */
+  for (; i < nkeys.nextw; i++)
+    idx_free_key(&nkeys.coll[i]);
+  nkeys.nextw = 0;
+
+  if (groups != GNONE)
+    sum_groups();
+
+  /* and redraw the whole screen */
+  for (int i = 0; i < keys.size; i++)
+    print_key(i);
+
+  return 0;
+}
+
+/*
+ * Switch between no grouping, grouping by day and grouping by week, while
+ * keeping the entry under the cursor on the screen.
+ */
+static void
+toggle_groups(void)
+{
+  const DBT *cur;
+  int i;
+
+  groups = (groups + 1) % (GWEEK + 1);
+
+  if ((cur = cur_get_key()) != NULL)
+    cur = idx_copy_key(cur);
+
+  i = entry_row(0);
+  reload_scr(i == -1 ? NULL : keys.coll[i]);
+
+  if (cur) {
+    cur_mv_key(cur);
+    idx_free_key(&cur);
+  }
+}
+
+/* return the start of the group that t is in */
+static time_t
+group_start(time_t t)
+{
+  if (groups == GWEEK)
+    return week_start(t);
+
+  return day_start(t, 0);
+}
+
+/*
+ * Set the total number of minutes of every group header on the screen. All
+ * groups are summed in one pass over their entries, so that the cost does not
+ * depend on the number of headers.
+ */
+static void
+sum_groups(void)
+{
+  idx_cursor_t cur;
+  idx_entry_t ents[IDXBATCH];
+  int first, last, row, next, i, n;
+
+  for (first = 0; first < keys.size && !heads.start[first]; first++)
+    continue;
+
+  if (first == keys.size)
+    return;
+
+  for (last = keys.size - 1; !heads.start[last]; last--)
+    continue;
+
+  for (row = first; row <= last; row++)
+    heads.mins[row] = 0;
+
+  /* set iterator options */
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    heads.start[first], /* time_t minstart; */
+    day_start(heads.start[last], groups == GWEEK ? 7 : 1), /* time_t maxstart; */
+    1, /* int includemin; */
+    0, /* int includemax; */
+    0, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    NULL, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+  if (filter_enabled()) {
+    if (proj_filter_active())
+      opts.projs = fprojs;
+    opts.minstart = max(opts.minstart, gfilter.start);
+    if (gfilter.end && gfilter.end < opts.maxstart)
+      opts.maxstart = gfilter.end;
+  }
+
+  if (idx_cursor_open(vp_idx, &cur, &opts) != 0)
+    errx(1, "%s: idx_cursor_open", __func__);
+
+  /* the entries and the headers are both in order of start */
+  row = first;
+  for (next = row + 1; next <= last && !heads.start[next]; next++)
+    continue;
+
+  while ((n = idx_cursor_next(&cur, ents, IDXBATCH)) > 0) {
+    for (i = 0; i < n; i++) {
+      while (next <= last && ents[i].start >= heads.start[next]) {
+        row = next;
+        for (next = row + 1; next <= last && !heads.start[next]; next++)
+          continue;
+      }
+      heads.mins[row] += (ents[i].end - ents[i].start) / 60;
+    }
+  }
+  idx_cursor_close(&cur);
+
+  if (n == -1)
+    errx(1, "%s: idx_cursor_next", __func__);
+}
+
+/* calculate number of entries and total number of minutes */
+static int
+calc_status_line(int *count, int *summ)
+{
+  /* set iterator options */
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    0, /* time_t maxstart; */
+    1, /* int includemin; */
+    1, /* int includemax; */
+    0, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    NULL, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+  if (filter_enabled()) {
+    if (proj_filter_active())
+      opts.projs = fprojs;
+    opts.minstart = gfilter.start;
+    opts.maxstart = gfilter.end;
+  }
+
+  return idx_count(vp_idx, &opts, count, summ);
+}
+
+/*
+ * Rewrite the status summary that is read by the status command. Failure is
+ * not fatal, the summary is rebuilt by the next change.
+ */
+static void
+update_status_file(void)
+{
+  if (status_update(vp_idx, datapath) == -1)
+    log_warnx("%s: status_update", __func__);
+}
+
+/*
+ * Wait until a key can be read. Meanwhile the timer on the status line is
+ * redrawn every minute and when another process starts or stops a timer. If no
+ * timer is running this only wakes up on input.
+ *
+ * Return 1 if stdin is readable, 0 if not.
+ */
+static int
+wait_key(void)
+{
+  struct pollfd pfd[2];
+  struct timespec now;
+  size_t i;
+  int t, timeout;
+
+  pfd[0].fd = STDIN_FILENO;
+  pfd[0].events = POLLIN;
+  pfd[1].fd = twatch; /* ignored by poll() if -1 */
+  pfd[1].events = POLLIN;
+
+  if (load_timers() == -1)
+    err(1, "%s: load_timers", __func__);
+
+  /* wake up when the next minute of any timer starts */
+  timeout = -1;
+  if (ntimers > 0 && clock_gettime(CLOCK_REALTIME, &now) == -1)
+    err(1, "%s: clock_gettime", __func__);
+  for (i = 0; i < ntimers; i++) {
+    t = 60000 - ((long long)(now.tv_sec - timers[i].start) * 1000 + now.tv_nsec / 1000000) % 60000;
+    if (timeout == -1 || t < timeout)
+      timeout = t;
+  }
+
+  if (poll(pfd, 2, timeout) == -1) {
+    if (errno == EINTR)
+      return 0;
+    err(1, "%s: poll", __func__);
+  }
+
+  if (pfd[0].revents)
+    return 1;
+
+  /* only repaint the status line */
+  update_status_line(ecount, mtotal);
+  if (refresh() == ERR)
+    errx(1, "%s: refresh", __func__);
+
+  return 0;
+}
+
+/* use the status lines at the bottom of the screen */
+static void
+update_status_line(int count, int summ)
+{
+  size_t i;
+  int s, y;
+  char sdout[64];
+
+  getyx(stdscr, y, s);
+  if (load_timers() == -1)
+    errx(1, "%s: load_timers", __func__);
+
+  if (mvprintw(e_lines, 0, " %d                            %2d:%02d", count, summ / 60, summ % 60) == ERR)
+    errx(1, "%s: mvprintw", __func__);
+
+  /* number every timer so that it can be stopped with a count */
+  for (i = 0; i < ntimers; i++) {
+    s = (time(NULL) - timers[i].start) / 60;
+    if (printw("%s %zu %s %2d:%02d", i ? " " : "    timer:", i + 1, timers[i].proj, s / 60, s % 60) == ERR)
+      errx(1, "%s: printw timer", __func__);
+  }
+
+  if (filter_enabled()) {
+    if (printw("\t\t%s\t", gfilter.proj) == ERR)
+      errx(1, "%s: printw project", __func__);
+
+    if (strftime(sdout, sizeof sdout, "%R %d-%m-%Y", localtime(&gfilter.start)) == 0)
+      err(1, "%s: could not format broken-down start time", __func__);
+    if (printw("   %s", sdout) == ERR)
+      errx(1, "%s: printw start", __func__);
+
+    if (strftime(sdout, sizeof sdout, "%R %d-%m-%Y", localtime(&gfilter.end)) == 0)
+      err(1, "%s: could not format broken-down end time", __func__);
+    if (printw(" - %s", sdout) == ERR)
+      errx(1, "%s: printw end", __func__);
+  }
+  clrtoeol();
+  if (mvchgat(e_lines, 0, -1, A_REVERSE, 0, NULL) == ERR)
+    errx(1, "%s: mvchgat ON", __func__);
+  /* clear last line, expect two status lines */
+  assert(s_lines == 2);
+  move(e_lines + 1, 0);
+  clrtoeol();
+  move(y, 0);
+}
+
+/*
+ * Determine viewport size, number of entry lines and status lines and ensure
+ * key and nkeys are big enough for the current number of entry lines
+ * (e_lines).
+ */
+static int
+ensure_key_storage(void)
+{
+  int i, diff;
+
+  /* check for curruption first: keys.size == nkeys.size == e_lines, */
+  assert(keys.size == e_lines);
+  assert(keys.size == nkeys.size);
+
+  /* determine screen size and init keys and nkeys */
+  getmaxyx(stdscr, vp_lines, vp_cols);
+
+  /* keep the lines used for status info free */
+  e_lines = vp_lines - s_lines;
+
+  diff = e_lines - keys.size;
+
+  /* prefetched lines are rendered for one screen size */
+  if (diff != 0 || pre.cols != vp_cols)
+    free_prefetch();
+
+  if (diff == 0)
+    return 0;
+
+  /* free extraneous keys */
+  if (diff < 0) {
+    log_warnx("%s: free %d keys", __func__, diff);
     for (i = keys.size - 1; i >= e_lines; i--) {
       idx_free_key(&keys.coll[i]);
       idx_free_key(&nkeys.coll[i]);
@@ -783,7 +1457,9 @@ ensure_key_storage(void)
 
   keys.coll = realloc(keys.coll, sizeof(DBT *) * e_lines);
   nkeys.coll = realloc(nkeys.coll, sizeof(DBT *) * e_lines);
-  if (keys.coll == NULL || nkeys.coll == NULL)
+  heads.start = reallocarray(heads.start, e_lines, sizeof(time_t));
+  heads.mins = reallocarray(heads.mins, e_lines, sizeof(int));
+  if (keys.coll == NULL || nkeys.coll == NULL || heads.start == NULL || heads.mins == NULL)
     err(1, "%s: realloc", __func__);
 
   keys.size = e_lines;
@@ -796,6 +1472,7 @@ ensure_key_storage(void)
     for (i = e_lines - 1; i >= e_lines - diff; i--) {
       keys.coll[i] = NULL;
       nkeys.coll[i] = NULL;
+      heads.start[i] = 0;
     }
   }
 
@@ -837,12 +1514,56 @@ cur_get_key(void)
   return keys.coll[y];
 }
 
+/* return the project of the entry under the cursor, or "" if there is none */
+static const char *
+cur_get_proj(void)
+{
+  const DBT *key;
+
+  if ((key = cur_get_key()) == NULL)
+    return "";
+
+  return idx_key_proj(key);
+}
+
+/* return the line of the nth entry on the screen, or -1 if there is none */
+static int
+entry_row(int n)
+{
+  int row;
+
+  for (row = 0; row < keys.size; row++)
+    if (keys.coll[row] && n-- == 0)
+      return row;
+
+  return -1;
+}
+
+/* return the number of entries on the screen above the given line */
+static int
+entries_above(int row)
+{
+  int n;
+
+  for (n = 0; row > 0; row--)
+    if (keys.coll[row - 1])
+      n++;
+
+  return n;
+}
+
 /* move the cursor down, and the viewport if necessary */
 static void
 cur_mv_down(uint32_t mv_lines)
 {
   int x, y;
 
+  /* entries are not on consecutive lines if grouped */
+  if (groups != GNONE) {
+    cur_mv_entries(mv_lines);
+    return;
+  }
+
   getyx(stdscr, y, x);
 
   /* move viewport first if needed */
@@ -873,6 +1594,11 @@ cur_mv_up(uint32_t mv_lines)
 {
   int x, y;
 
+  if (groups != GNONE) {
+    cur_mv_entries(-1 * mv_lines);
+    return;
+  }
+
   getyx(stdscr, y, x);
 
   /* if the viewport needs to be moved, do that first */
@@ -897,6 +1623,64 @@ cur_mv_up(uint32_t mv_lines)
     errx(1, "%s: mvchgat ON", __func__);
 }
 
+/*
+ * Move the cursor n entries down, or up if n is negative, skipping the group
+ * headers. The viewport is moved if the entry is not on the screen.
+ */
+static void
+cur_mv_entries(int n)
+{
+  DBT *target;
+  int y, i, nents;
+
+  y = getcury(stdscr);
+
+  if ((nents = entries_above(keys.size)) == 0)
+    return;
+
+  i = entries_above(y) + n;
+
+  if (i < 0) {
+    /* the entry becomes the first one on the screen */
+    move_lines(i);
+    i = 0;
+  } else if (i >= nents) {
+    /* find the entry below the screen and make it the last one */
+    idx_itopts_t opts = {
+      NULL, /* char *proj; */
+      0, /* time_t minstart; */
+      0, /* time_t maxstart; */
+      0, /* int includemin; */
+      0, /* int includemax; */
+      1, /* size_t limit; */
+      i - nents, /* size_t skip; */
+      0, /* int reverse; */
+      (DBT *)keys.coll[entry_row(nents - 1)], /* DBT *offset; */
+      0, /* time_t minend; */
+      0, /* time_t maxend; */
+      0, /* time_t at; */
+      NULL /* char **projs; */
+    };
+    if (filter_enabled()) {
+      if (proj_filter_active())
+        opts.projs = fprojs;
+      opts.minstart = gfilter.start;
+      opts.maxstart = gfilter.end;
+    }
+
+    target = NULL;
+    idx_iterate(vp_idx, &opts, ignore_key, &target);
+
+    if (target) {
+      vp_show_last(target);
+      idx_free_key((const DBT **)&target);
+    }
+    i = entries_above(keys.size) - 1;
+  }
+
+  cur_set_row(entry_row(i));
+}
+
 /* move to a line relative to the current window */
 static void
 cur_mv_line(uint32_t line)
@@ -906,6 +1690,11 @@ cur_mv_line(uint32_t line)
   if (line > e_lines - 1)
     line = e_lines - 1;
 
+  if (groups != GNONE) {
+    cur_set_row(line);
+    return;
+  }
+
   getyx(stdscr, y, x);
 
   if (y < line)
@@ -914,15 +1703,125 @@ cur_mv_line(uint32_t line)
     cur_mv_up(y - line);
 }
 
-/* move to the line that represents the given key */
+/*
+ * Highlight the entry on the given line. If the line is a group header, use the
+ * first entry of the group, if the line is empty use the last entry above it.
+ */
+static void
+cur_set_row(int row)
+{
+  int y;
+
+  y = getcury(stdscr);
+
+  /* set current line to normal, but leave the headers alone */
+  if (y < keys.size && keys.coll[y])
+    if (chgat(-1, A_NORMAL, 0, NULL) == ERR)
+      errx(1, "%s: mvchgat OFF", __func__);
+
+  if (row < 0)
+    row = 0;
+
+  if (heads.start[row] && row + 1 < keys.size && keys.coll[row + 1])
+    row++;
+
+  while (row > 0 && !keys.coll[row])
+    row--;
+
+  if (mvchgat(row, 0, -1, A_REVERSE, 0, NULL) == ERR)
+    errx(1, "%s: mvchgat ON", __func__);
+}
+
+/*
+ * Move to the line that represents the given key. If grouped, the viewport is
+ * moved if the key is not on the screen, since fewer entries fit.
+ */
 static void
 cur_mv_key(const DBT *key)
 {
   int i;
-  if ((i = get_idx(key)) != -1)
+
+  if (key == NULL)
+    return;
+
+  if ((i = get_idx(key)) == -1 && groups != GNONE) {
+    vp_show_last(key);
+    i = get_idx(key);
+  }
+
+  if (i != -1)
     cur_mv_line(i);
 }
 
+/*
+ * Return the number of lines that a motion key moves with the given count, and
+ * set scroll if the viewport is moved instead of the cursor. Return 0 if key is
+ * not a motion key.
+ */
+static int
+motion_lines(int key, size_t count, int *scroll)
+{
+  int page;
+
+  *scroll = 1;
+
+  /* a page is the number of entries that fit on the screen */
+  page = groups == GNONE ? e_lines : entries_above(keys.size);
+
+  switch (key) {
+  case 2: // ctrl-B
+    return -1 * (int)count * page - 2;
+  case 4: // ctrl-D
+    return (int)count * page / 2;
+  case 5: // ctrl-E
+    return count;
+  case 6: // ctrl-F
+    return (int)count * page - 2;
+  case 21: // ctrl-U
+    return -1 * (int)count * page / 2;
+  case 25: // ctrl-Y
+    return -1 * (int)count;
+  case 'j':
+    *scroll = 0;
+    return count;
+  case 'k':
+    *scroll = 0;
+    return -1 * (int)count;
+  }
+
+  return 0;
+}
+
+/*
+ * Move the cursor or the viewport for a motion key, count is 0 if none is
+ * given. Motion keys without a count that are already queued up behind key and
+ * move the same thing are folded into one net movement, so key repeat does not
+ * redraw the screen once per key.
+ */
+static void
+move_key(int key, size_t count)
+{
+  int lines, n, next, scroll, nscroll;
+
+  lines = motion_lines(key, count ? count : 1, &scroll);
+
+  while (!count && (next = getch()) != ERR) {
+    if ((n = motion_lines(next, 1, &nscroll)) == 0 || nscroll != scroll) {
+      if (ungetch(next) == ERR)
+        errx(1, "%s: ungetch", __func__);
+      break;
+    }
+    lines += n;
+  }
+
+  if (scroll)
+    move_lines(lines);
+  else if (lines > 0)
+    cur_mv_down(lines);
+  else if (lines < 0)
+    cur_mv_up(-lines);
+}
+
 /* move to a new item relative to the current items on the screen */
 static int
 move_lines(int mv_lines)
@@ -956,11 +1855,22 @@ move_lines(int mv_lines)
     offset = NULL;
 
   /* if moving less than a screen down and the key is currently on the screen, move to it */
-  if (!neg && mv_lines <= i && offset) {
-    reload_scr(keys.coll[mv_lines]);
+  if (!neg && offset && (i = entry_row(mv_lines)) != -1) {
+    reload_scr(keys.coll[i]);
     return 0;
   }
 
+  /* if the key is prefetched, move to it without the index */
+  if (offset && (i = find_prefetched(offset)) != -1) {
+    i += neg ? -mv_lines : mv_lines;
+    if (i >= 0 && i < pre.n) {
+      getmaxyx(stdscr, y, x);
+      reload_scr(pre.coll[i]);
+      cur_mv_line(y);
+      return 0;
+    }
+  }
+
   /* set iterator options */
   idx_itopts_t opts = {
     NULL, /* char *proj; */
@@ -971,17 +1881,21 @@ move_lines(int mv_lines)
     1, /* size_t limit; */
     mv_lines - 1, /* size_t skip; */
     neg, /* int reverse; */
-    (DBT *)offset /* DBT *offset; */
+    (DBT *)offset, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
   };
   if (filter_enabled()) {
     if (proj_filter_active())
-      opts.proj = gfilter.proj;
+      opts.projs = fprojs;
     opts.minstart = gfilter.start;
     opts.maxstart = gfilter.end;
   }
 
   last_seen = NULL;
-  idx_iterate(&opts, fetch_nkey, &last_seen);
+  idx_iterate(vp_idx, &opts, fetch_nkey, &last_seen);
 
   log_warnx("%s: %u skip %zu, limit %zu, fetched: %u, neg: %d, offset: %s, last_seen: %s", __func__, mv_lines, opts.skip, opts.limit, nkeys.nextw, neg, idx_key_info(offset), idx_key_info(last_seen));
 
@@ -1014,10 +1928,81 @@ vp_mv_bottom(void)
   /* free all existing keys */
   free_keys(0);
 
+  if (groups != GNONE) {
+    vp_show_last(NULL);
+    cur_set_row(keys.size - 1);
+    return;
+  }
+
   /* use a reverse iterator without offset */
   move_lines(-1 * e_lines);
 }
 
+/*
+ * Move the viewport so that the given key is the last entry on the screen, or
+ * the very last entry if key is null. Only needed if grouped, the number of
+ * entries that fit above it depends on the number of groups they are in.
+ */
+static void
+vp_show_last(const DBT *key)
+{
+  const DBT *top;
+  time_t g, pg;
+  int i, rows;
+
+  /* set iterator options */
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    0, /* time_t maxstart; */
+    0, /* int includemin; */
+    0, /* int includemax; */
+    keys.size, /* size_t limit; */
+    0, /* size_t skip; */
+    1, /* int reverse; */
+    (DBT *)key, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+  if (filter_enabled()) {
+    if (proj_filter_active())
+      opts.projs = fprojs;
+    opts.minstart = gfilter.start;
+    opts.maxstart = gfilter.end;
+  }
+
+  assert(nkeys.nextw == 0);
+  idx_iterate(vp_idx, &opts, fetch_nkey, NULL);
+
+  /* without an offset the last entry itself is fetched first */
+  i = 0;
+  top = key;
+  if (top == NULL) {
+    if (nkeys.nextw == 0) {
+      reload_scr(NULL);
+      return;
+    }
+    top = nkeys.coll[i++];
+  }
+
+  /* the entry and the header of its group, and then up as long as it fits */
+  g = group_start(idx_key_start(top));
+  rows = 2;
+  for (; i < nkeys.nextw; i++) {
+    pg = group_start(idx_key_start(nkeys.coll[i]));
+    rows += pg == g ? 1 : 2;
+    if (rows > keys.size)
+      break;
+    top = nkeys.coll[i];
+    g = pg;
+  }
+
+  /* reload_scr copies top before the fetched keys are freed */
+  reload_scr(top);
+}
+
 /*
  * Fetch keys, and store in nkeys.
  *
@@ -1032,6 +2017,17 @@ fetch_nkey(DBT *key)
   return 1;
 }
 
+/*
+ * Skip a key, used if only the last seen key of an iteration is needed.
+ *
+ * Return 1 if more data is wanted, 0 if done, -1 on error.
+ */
+static int
+ignore_key(DBT *key)
+{
+  return 1;
+}
+
 /*
  * Print one line of project info, start and end time for the key at the given
  * index. If there is no key at the given index, print a blank line at the
@@ -1043,18 +2039,54 @@ static int
 print_key(int idx)
 {
   const DBT *key = keys.coll[idx];
-  FILE *pf;
-  char line[MAXLINE];
-  int linelen, i;
-  int hours, minutes;
-  char sdout[64], projcpy[11];
+  char line[MAXLINE + 64];
+  int i;
 
   if (key == NULL) {
     move(idx, 0);
     clrtoeol();
+    if (heads.start[idx])
+      print_head(idx);
     return 0;
   }
 
+  if ((i = find_prefetched(key)) != -1)
+    mvprintw(idx, 0, "%s", pre.lines[i]);
+  else {
+    render_key(key, line, sizeof line);
+    mvprintw(idx, 0, "%s", line);
+  }
+
+  // ready to get next entry if any
+  return 1;
+}
+
+/* print the header of the group that starts at the given index */
+static void
+print_head(int idx)
+{
+  char sdout[64];
+
+  if (strftime(sdout, sizeof sdout, groups == GWEEK ? "week %V %G" : "%a %e %b %Y", localtime(&heads.start[idx])) == 0)
+    err(1, "%s: could not format broken-down start time", __func__);
+
+  attron(A_BOLD);
+  mvprintw(idx, 0, "%10s   %-20s   %2d:%02d", "", sdout, heads.mins[idx] / 60, heads.mins[idx] % 60);
+  attroff(A_BOLD);
+}
+
+/*
+ * Render the line of a key with the project, start time, duration and the
+ * first line of the project file, shortened to fit the screen.
+ */
+static void
+render_key(const DBT *key, char *dst, size_t dstsize)
+{
+  char line[MAXLINE];
+  int linelen, i;
+  int hours, minutes;
+  char sdout[64], projcpy[11];
+
   char *proj = idx_key_proj(key);
   time_t start = idx_key_start(key);
   time_t end = idx_key_end(key);
@@ -1074,20 +2106,7 @@ print_key(int idx)
   line[0] = '\0';
   if (linelen >= 4) {
     /* fetch the first line of the project file */
-    if ((pf = idx_open_project_file(key)) == NULL)
-      err(1, "%s: idx_open_project_file", __func__);
-
-    if (fgets(line, sizeof line, pf) == NULL) {
-      if (ferror(pf))
-        err(1, "%s: fgets", __func__);
-      else
-        line[0] = '\0';
-    }
-    fclose(pf);
-
-    // strip newline if any
-    i = strcspn(line, "\n");
-    line[i] = '\0';
+    i = idx_first_line(vp_idx, key, line, sizeof line);
     i--; // exclude null in length
 
     if (linelen < i)
@@ -1098,12 +2117,173 @@ print_key(int idx)
     projcpy[sizeof projcpy - 3] = '.';
     projcpy[sizeof projcpy - 2] = '.';
   }
-  mvprintw(idx, 0, "%10s   %s   %2d:%02d   %s\n", projcpy, sdout, hours, minutes, line);
+  snprintf(dst, dstsize, "%10s   %s   %2d:%02d   %s\n", projcpy, sdout, hours, minutes, line);
+}
 
-  // ready to get next entry if any
+/*
+ * Fetch the keys of the viewport and of a page and two lines above and below it
+ * and render their lines, so that the next ^F or ^B is served from memory. Is
+ * a no-op if the prefetched keys still surround the viewport. Rendering stops
+ * and everything is discarded as soon as a key is pressed.
+ */
+static void
+prefetch(void)
+{
+  char line[MAXLINE + 64];
+  size_t want, nbefore, i;
+  int first, top, last, nents;
+
+  /* the first line is a header if grouped */
+  if (keys.size == 0 || (top = entry_row(0)) == -1)
+    return;
+
+  for (last = keys.size - 1; last > top && !keys.coll[last]; last--)
+    continue;
+
+  nents = entries_above(last + 1);
+  want = e_lines + 2;
+
+  if (pre.ready) {
+    first = find_prefetched(keys.coll[top]);
+    if (first != -1 && (first >= want || pre.atstart) && (first + nents + want <= pre.n || pre.atend))
+      return;
+  }
+
+  free_prefetch();
+
+  if (pre.size < 2 * want + keys.size) {
+    pre.size = 2 * want + keys.size;
+    pre.coll = reallocarray(pre.coll, pre.size, sizeof *pre.coll);
+    pre.lines = reallocarray(pre.lines, pre.size, sizeof *pre.lines);
+    if (pre.coll == NULL || pre.lines == NULL)
+      err(1, "%s: reallocarray", __func__);
+  }
+
+  /* set iterator options, starting with the keys above the viewport */
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    0, /* time_t maxstart; */
+    0, /* int includemin; */
+    0, /* int includemax; */
+    want, /* size_t limit; */
+    0, /* size_t skip; */
+    1, /* int reverse; */
+    keys.coll[top], /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+  if (filter_enabled()) {
+    if (proj_filter_active())
+      opts.projs = fprojs;
+    opts.minstart = gfilter.start;
+    opts.maxstart = gfilter.end;
+  }
+
+  idx_iterate(vp_idx, &opts, fetch_pre, NULL);
+  nbefore = pre.n;
+  pre.atstart = nbefore < want;
+
+  /* the keys above the viewport are fetched in reverse */
+  for (i = 0; i < nbefore / 2; i++) {
+    const DBT *tmp = pre.coll[i];
+    pre.coll[i] = pre.coll[nbefore - 1 - i];
+    pre.coll[nbefore - 1 - i] = tmp;
+  }
+
+  for (i = top; i <= last; i++)
+    if (keys.coll[i])
+      pre.coll[pre.n++] = idx_copy_key(keys.coll[i]);
+
+  /* and then the keys below the viewport */
+  opts.reverse = 0;
+  opts.offset = keys.coll[last];
+  idx_iterate(vp_idx, &opts, fetch_pre, NULL);
+  pre.atend = pre.n - nbefore - nents < want;
+
+  for (i = 0; i < pre.n; i++)
+    pre.lines[i] = NULL;
+
+  /* render, but give way to the user */
+  for (i = 0; i < pre.n; i++) {
+    if (key_pending()) {
+      free_prefetch();
+      return;
+    }
+    render_key(pre.coll[i], line, sizeof line);
+    if ((pre.lines[i] = strdup(line)) == NULL)
+      err(1, "%s: strdup", __func__);
+  }
+
+  pre.cols = vp_cols;
+  pre.ready = 1;
+}
+
+/*
+ * Store a copy of key in the prefetched keys.
+ *
+ * Return 1 if more data is wanted, 0 if done, -1 on error.
+ */
+static int
+fetch_pre(DBT *key)
+{
+  pre.coll[pre.n++] = idx_copy_key(key);
+
+  /* ready to get next entry if any */
   return 1;
 }
 
+/* return the index of key in the prefetched keys, -1 if not prefetched */
+static int
+find_prefetched(const DBT *key)
+{
+  int i;
+
+  if (!pre.ready || key == NULL)
+    return -1;
+
+  for (i = 0; i < pre.n; i++)
+    if (idx_keycmp(key, pre.coll[i]) == 0)
+      return i;
+
+  return -1;
+}
+
+/* discard all prefetched keys and lines */
+static void
+free_prefetch(void)
+{
+  size_t i;
+
+  for (i = 0; i < pre.n; i++) {
+    idx_free_key(&pre.coll[i]);
+    free(pre.lines[i]);
+  }
+
+  pre.n = 0;
+  pre.ready = 0;
+}
+
+/* return 1 if input is waiting on stdin, 0 if not */
+static int
+key_pending(void)
+{
+  struct pollfd pfd;
+
+  pfd.fd = STDIN_FILENO;
+  pfd.events = POLLIN;
+
+  if (poll(&pfd, 1, 0) == -1) {
+    if (errno == EINTR)
+      return 1;
+    err(1, "%s: poll", __func__);
+  }
+
+  return pfd.revents != 0;
+}
+
 /*
  * calculate hours and minutes given the start and end time
  *
@@ -1143,37 +2323,72 @@ free_keys(int i)
     idx_free_key(&nkeys.coll[i]);
     keys.coll[i] = NULL;
     nkeys.coll[i] = NULL;
+    heads.start[i] = 0;
     i++;
   }
   nkeys.nextw = 0;
   clear();
 }
 
-/* return 0 on success, -1 on failure */
+/*
+ * Copy src to fname in dataroot. If src is a file, it is cloned or copied by
+ * the kernel where possible, otherwise it is copied through a buffer.
+ *
+ * Return 0 on success, -1 on failure.
+ */
 int
 copy_file(const char *dataroot, const char *fname, FILE *src)
 {
-  int c, ret;
-  FILE *fp;
-  char pname[PATH_MAX];
+  char pname[PATH_MAX], *buf;
+  size_t n, off;
+  ssize_t w;
+  int fd, ret;
+#ifdef __linux__
+  int sfd;
+#endif
 
   ret = 0;
 
   if (snprintf(pname, sizeof pname, "%s/%s", dataroot, fname) >= sizeof pname)
     errx(1, "%s: snprintf", __func__);
 
-  if ((fp = fopen(pname, "w")) == NULL)
-    err(1, "%s: fopen", __func__);
+  if ((fd = open(pname, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666)) == -1)
+    err(1, "%s: open", __func__);
+
+#ifdef __linux__
+  /* a packed file is a stream in memory without a descriptor */
+  if ((sfd = fileno(src)) != -1) {
+    if (ioctl(fd, FICLONE, sfd) == 0)
+      goto done;
+
+    /* both offsets advance, so a partial copy is finished below */
+    while ((w = syscall(SYS_copy_file_range, sfd, NULL, fd, NULL, SSIZE_MAX, 0)) > 0)
+      ;
+    if (w == 0)
+      goto done;
+    if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP)
+      err(1, "%s: copy_file_range", __func__);
+  }
+#endif
+
+  if ((buf = malloc(COPYBUF)) == NULL)
+    err(1, "%s: malloc", __func__);
 
-  while ((c = getc(src)) != EOF)
-    if (putc(c, fp) == EOF)
-      err(1, "%s: putc", __func__);
+  while ((n = fread(buf, 1, COPYBUF, src)) > 0)
+    for (off = 0; off < n; off += w)
+      if ((w = write(fd, buf + off, n - off)) == -1)
+        err(1, "%s: write", __func__);
 
   if (ferror(src))
     ret = -1;
 
-  if (fclose(fp) == EOF)
-    err(1, "%s: fclose", __func__);
+  free(buf);
+
+#ifdef __linux__
+done:
+#endif
+  if (close(fd) == -1)
+    err(1, "%s: close", __func__);
 
   return ret;
 }
@@ -1,21 +1,33 @@
 #ifndef SCREEN_H
 #define SCREEN_H
 
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
 #include <assert.h>
 #include <err.h>
+#include <fnmatch.h>
 #include <ncurses.h>
+#include <poll.h>
 #include <stdint.h>
 #include <time.h>
 
+#include "gap.h"
 #include "index.h"
 #include "shorten.h"
+#include "status.h"
 #include "entryl.h"
 #include "compat/bdb.h"
 
 #define MAXLINE 1024
 #define MAXPROG 32
 
-void vp_init(char *datapath);
+/* size of the buffer of copy_file() if the kernel can't copy the file */
+#define COPYBUF (128 * 1024)
+
+void vp_init(idx_t *idx, char *datapath);
 int vp_start(void);
 
 #endif
@@ -171,6 +171,34 @@ parse_date_field(FIELD **field, time_t *t)
   return 0;
 }
 
+/*
+ * Parse a date in the form YYYY-MM-DD into local midnight of that day.
+ *
+ * Return 0 on success, -1 on error.
+ */
+int
+parse_day(const char *s, time_t *t)
+{
+  struct tm dt;
+  char c;
+
+  memset(&dt, 0, sizeof dt);
+  if (sscanf(s, "%4d-%2d-%2d%c", &dt.tm_year, &dt.tm_mon, &dt.tm_mday, &c) != 3)
+    return -1;
+
+  if (dt.tm_mon < 1 || dt.tm_mon > 12 || dt.tm_mday < 1 || dt.tm_mday > 31)
+    return -1;
+
+  dt.tm_year -= 1900;
+  dt.tm_mon--;
+  dt.tm_isdst = -1;
+
+  if ((*t = mktime(&dt)) == -1)
+    return -1;
+
+  return 0;
+}
+
 /*
  * Show info prompt at the bottom of the screen.
  */
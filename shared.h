@@ -25,6 +25,10 @@
   #define max(a, b) ((a) > (b) ? (a) : (b))
 #endif
 
+#ifndef min
+  #define min(a, b) ((a) < (b) ? (a) : (b))
+#endif
+
 /* generic form type, support at most 20 fields */
 typedef struct {
   WINDOW *w, *sw;
@@ -36,6 +40,7 @@ int use_count(size_t *count, char *countstr);
 int rtrim(char *s);
 FIELD **set_date_field(FIELD **field, const char *label, const int col, const int row, const time_t def);
 int parse_date_field(FIELD **field, time_t *t);
+int parse_day(const char *s, time_t *t);
 void info_prompt(const char *msg);
 
 #endif
@@ -0,0 +1,214 @@
+#include "status.h"
+
+/*
+ * Rewrite the status summary in the data dir dp. The summary holds the minutes
+ * of the entries that start today and this week, the most recent entry and the
+ * running timers, so that status_print() does not need the index.
+ * The summary is written to a temporary file that replaces the previous one, a
+ * reader never sees a partial summary.
+ *
+ * Should be called after every change of the entries or of the timer.
+ *
+ * Return 0 on success, -1 on error.
+ */
+int
+status_update(idx_t *idx, const char *dp)
+{
+  idx_cursor_t cur;
+  idx_entry_t ent;
+  timer_entry_t tv[MAXTIMERS];
+  char pname[PATH_MAX], tmpname[PATH_MAX], buf[MAXSTATUS];
+  time_t now, day, week;
+  size_t i, ntimers;
+  int count, daymin, weekmin, fd, len, n, r;
+
+  now = time(NULL);
+  day = day_start(now, 0);
+  week = week_start(now);
+
+  if (timer_read(dp, tv, &ntimers) == -1)
+    return -1;
+
+  /* entries that start today or this week */
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    day, /* time_t minstart; */
+    day_start(now, 1), /* time_t maxstart; */
+    1, /* int includemin; */
+    0, /* int includemax; */
+    0, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    NULL, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+
+  if (idx_count(idx, &opts, &count, &daymin) == -1)
+    return -1;
+
+  opts.minstart = week;
+  opts.maxstart = day_start(week, 7);
+  if (idx_count(idx, &opts, &count, &weekmin) == -1)
+    return -1;
+
+  /* the most recent entry */
+  opts.minstart = 0;
+  opts.maxstart = 0;
+  opts.includemax = 1;
+  opts.reverse = 1;
+
+  if (idx_cursor_open(idx, &cur, &opts) != 0)
+    return -1;
+  n = idx_cursor_next(&cur, &ent, 1);
+  if (n == 1)
+    len = snprintf(buf, sizeof buf, "%ld %ld %d %d %ld %ld %s\n", day, week, daymin, weekmin, ent.start, ent.end, ent.proj);
+  else
+    len = snprintf(buf, sizeof buf, "%ld %ld %d %d 0 0\n", day, week, daymin, weekmin);
+  idx_cursor_close(&cur);
+
+  if (n == -1)
+    return -1;
+  if (len < 0 || len >= sizeof buf)
+    errx(1, "%s: snprintf", __func__);
+
+  /* followed by one line per timer */
+  for (i = 0; i < ntimers; i++) {
+    r = snprintf(buf + len, sizeof buf - len, "%ld %s\n", tv[i].start, tv[i].proj);
+    if (r < 0 || r >= sizeof buf - len)
+      errx(1, "%s: snprintf", __func__);
+    len += r;
+  }
+
+  if (snprintf(pname, sizeof pname, "%s/%s", dp, STATUSFILE) >= sizeof pname)
+    errx(1, "%s: snprintf", __func__);
+  if (snprintf(tmpname, sizeof tmpname, "%s.XXXXXXXX", pname) >= sizeof tmpname)
+    errx(1, "%s: snprintf", __func__);
+
+  if ((fd = mkstemp(tmpname)) == -1)
+    return -1;
+
+  if (write(fd, buf, len) != len) {
+    close(fd);
+    unlink(tmpname);
+    return -1;
+  }
+  if (close(fd) == -1)
+    err(1, "%s: close", __func__);
+
+  if (rename(tmpname, pname) == -1) {
+    unlink(tmpname);
+    return -1;
+  }
+
+  return 0;
+}
+
+/*
+ * Print the tracked time of today and this week, the running timers and the most
+ * recent entry on one line, as recorded by status_update(). Only reads the
+ * status summary, the index is not opened.
+ *
+ * Return 0 on success, -1 if there is no valid summary.
+ */
+int
+status_print(const char *dp, FILE *fp)
+{
+  char pname[PATH_MAX], buf[MAXSTATUS + 1], proj[MAXSTATUS], *p, *ep;
+  char ssout[8], seout[8];
+  time_t now, day, week, start, end, timer;
+  int daymin, weekmin, fd, r;
+  ssize_t n;
+
+  if (snprintf(pname, sizeof pname, "%s/%s", dp, STATUSFILE) >= sizeof pname)
+    errx(1, "%s: snprintf", __func__);
+
+  if ((fd = open(pname, O_RDONLY)) == -1)
+    return -1;
+  n = read(fd, buf, MAXSTATUS);
+  if (close(fd) == -1)
+    err(1, "%s: close", __func__);
+  if (n <= 0)
+    return -1;
+  buf[n] = '\0';
+
+  proj[0] = '\0';
+  if (sscanf(buf, "%ld %ld %d %d %ld %ld %[^\n]", &day, &week, &daymin, &weekmin, &start, &end, proj) < 6)
+    return -1;
+  if ((p = strchr(buf, '\n')) == NULL)
+    return -1;
+
+  /* the summary might have been written on an earlier day or week */
+  now = time(NULL);
+  if (day != day_start(now, 0))
+    daymin = 0;
+  if (week != week_start(now))
+    weekmin = 0;
+
+  if (fprintf(fp, "today %2d:%02d  week %2d:%02d", daymin / 60, daymin % 60, weekmin / 60, weekmin % 60) < 0)
+    err(1, "%s: fprintf", __func__);
+
+  /* every following line is a timer with an optional project */
+  for (p++; *p; p = ep + 1) {
+    timer = strtol(p, &ep, 10);
+    if (ep == p || *ep != ' ')
+      return -1;
+    p = ep + 1;
+    if ((ep = strchr(p, '\n')) == NULL)
+      return -1;
+
+    timer = (now - timer) / 60;
+    if (p == ep)
+      r = fprintf(fp, "  timer %ld:%02ld", timer / 60, timer % 60);
+    else
+      r = fprintf(fp, "  timer %.*s %ld:%02ld", (int)(ep - p), p, timer / 60, timer % 60);
+    if (r < 0)
+      err(1, "%s: fprintf", __func__);
+  }
+
+  if (proj[0]) {
+    if (strftime(ssout, sizeof ssout, "%R", localtime(&start)) == 0)
+      errx(1, "%s: strftime start", __func__);
+    if (strftime(seout, sizeof seout, "%R", localtime(&end)) == 0)
+      errx(1, "%s: strftime end", __func__);
+    if (fprintf(fp, "  last %s %s - %s", proj, ssout, seout) < 0)
+      err(1, "%s: fprintf", __func__);
+  }
+
+  if (fprintf(fp, "\n") < 0)
+    err(1, "%s: fprintf", __func__);
+
+  return 0;
+}
+
+/* return local midnight of the day that is days days after the day t is in */
+time_t
+day_start(const time_t t, const int days)
+{
+  struct tm bd;
+
+  if (localtime_r(&t, &bd) == NULL)
+    errx(1, "%s: localtime_r", __func__);
+
+  bd.tm_mday += days;
+  bd.tm_hour = 0;
+  bd.tm_min = 0;
+  bd.tm_sec = 0;
+  bd.tm_isdst = -1;
+
+  return mktime(&bd);
+}
+
+/* return local midnight of the monday of the week t is in */
+time_t
+week_start(const time_t t)
+{
+  struct tm bd;
+
+  if (localtime_r(&t, &bd) == NULL)
+    errx(1, "%s: localtime_r", __func__);
+
+  return day_start(t, -((bd.tm_wday + 6) % 7));
+}
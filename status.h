@@ -0,0 +1,27 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "timer.h"
+
+/* name of the status summary within the data dir */
+#define STATUSFILE ".status"
+
+/* maximum size of the status summary */
+#define MAXSTATUS (6 * 21 + MAXPROJ + 1 + MAXTIMERFILE)
+
+int status_update(idx_t *idx, const char *dp);
+int status_print(const char *dp, FILE *fp);
+time_t day_start(const time_t t, const int days);
+time_t week_start(const time_t t);
+
+#endif
@@ -0,0 +1,210 @@
+#include "timer.h"
+
+/*
+ * Read all running timers in the data dir dp into tv, which must have room for
+ * MAXTIMERS timers, and set n to the number of timers. The timer file has one
+ * line per timer with the start as a number of seconds since the epoch,
+ * optionally followed by a space and the project. An empty timer file, as
+ * written by earlier versions, is one timer that started at its change time.
+ *
+ * Return 0 on success, -1 on error.
+ */
+int
+timer_read(const char *dp, timer_entry_t *tv, size_t *n)
+{
+  struct stat st;
+  char pname[PATH_MAX], buf[MAXTIMERFILE + 1], *p, *ep;
+  ssize_t len;
+  long long s;
+  size_t plen;
+  int fd;
+
+  *n = 0;
+
+  if (snprintf(pname, sizeof pname, "%s/%s", dp, TIMERFILE) >= sizeof pname)
+    errx(1, "%s: snprintf", __func__);
+
+  if ((fd = open(pname, O_RDONLY)) == -1) {
+    if (errno != ENOENT)
+      return -1;
+    return 0;
+  }
+
+  if ((len = read(fd, buf, MAXTIMERFILE)) == -1) {
+    close(fd);
+    return -1;
+  }
+
+  if (len == 0) {
+    if (fstat(fd, &st) == -1) {
+      close(fd);
+      return -1;
+    }
+    tv[0].start = st.st_ctime;
+    tv[0].proj[0] = '\0';
+    *n = 1;
+  }
+
+  if (close(fd) == -1)
+    err(1, "%s: close", __func__);
+
+  buf[len] = '\0';
+  for (p = buf; *p && *n < MAXTIMERS; p = ep + 1) {
+    s = strtoll(p, &ep, 10);
+    if (ep == p || s <= 0)
+      goto invalid;
+
+    plen = 0;
+    if (*ep == ' ') {
+      p = ep + 1;
+      if ((ep = strchr(p, '\n')) == NULL)
+        goto invalid;
+      plen = ep - p;
+      if (plen >= MAXPROJ)
+        goto invalid;
+      memcpy(tv[*n].proj, p, plen);
+    } else if (*ep != '\n') {
+      goto invalid;
+    }
+
+    tv[*n].proj[plen] = '\0';
+    tv[*n].start = s;
+    (*n)++;
+  }
+
+  return 0;
+
+invalid:
+  *n = 0;
+  errno = EINVAL;
+  return -1;
+}
+
+/*
+ * Replace all running timers in the data dir dp by the n timers in tv. The
+ * timers are written to a temporary file that replaces the timer file, so a
+ * reader never sees a partial list. If n is 0 the timer file is removed.
+ *
+ * Return 0 on success, -1 on error.
+ */
+int
+timer_write(const char *dp, const timer_entry_t *tv, size_t n)
+{
+  char pname[PATH_MAX], tmpname[PATH_MAX], buf[MAXTIMERFILE];
+  size_t i;
+  int fd, len, r, serrno;
+
+  if (n > MAXTIMERS)
+    errx(1, "%s: too many timers: %zu", __func__, n);
+
+  if (snprintf(pname, sizeof pname, "%s/%s", dp, TIMERFILE) >= sizeof pname)
+    errx(1, "%s: snprintf", __func__);
+
+  if (n == 0) {
+    if (unlink(pname) == -1 && errno != ENOENT)
+      return -1;
+    return 0;
+  }
+
+  len = 0;
+  for (i = 0; i < n; i++) {
+    if (tv[i].proj[0])
+      r = snprintf(buf + len, sizeof buf - len, "%lld %s\n", (long long)tv[i].start, tv[i].proj);
+    else
+      r = snprintf(buf + len, sizeof buf - len, "%lld\n", (long long)tv[i].start);
+    if (r < 0 || r >= sizeof buf - len)
+      errx(1, "%s: snprintf", __func__);
+    len += r;
+  }
+
+  if (snprintf(tmpname, sizeof tmpname, "%s.XXXXXXXX", pname) >= sizeof tmpname)
+    errx(1, "%s: snprintf", __func__);
+
+  if ((fd = mkstemp(tmpname)) == -1)
+    return -1;
+
+  r = 0;
+  if (write(fd, buf, len) != len)
+    r = -1;
+  if (close(fd) == -1)
+    err(1, "%s: close", __func__);
+  if (r == 0)
+    r = rename(tmpname, pname);
+
+  if (r == -1) {
+    serrno = errno;
+    unlink(tmpname);
+    errno = serrno;
+  }
+
+  return r;
+}
+
+/*
+ * Watch the data dir dp for timers that are started or stopped by other
+ * processes, see timer_changed().
+ *
+ * Return a non-blocking descriptor on success, -1 if changes can not be watched
+ * on this system.
+ */
+int
+timer_watch(const char *dp)
+{
+#ifdef __linux__
+  int fd;
+
+  if ((fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+    log_warn("%s: inotify_init1", __func__);
+    return -1;
+  }
+
+  if (inotify_add_watch(fd, dp, IN_CREATE | IN_DELETE | IN_MOVED_TO | IN_MOVED_FROM | IN_CLOSE_WRITE) == -1) {
+    log_warn("%s: inotify_add_watch", __func__);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+/*
+ * Read all pending events from a descriptor that is returned by timer_watch(),
+ * without blocking.
+ *
+ * Return 1 if the timer might have changed since the previous call, 0 if not.
+ */
+int
+timer_changed(int fd)
+{
+#ifdef __linux__
+  char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  const struct inotify_event *ev;
+  ssize_t n;
+  char *p;
+  int changed;
+
+  if (fd == -1)
+    return 0;
+
+  changed = 0;
+  while ((n = read(fd, buf, sizeof buf)) > 0) {
+    for (p = buf; p < buf + n; p += sizeof *ev + ev->len) {
+      ev = (const struct inotify_event *)p;
+      if (ev->mask & IN_Q_OVERFLOW)
+        changed = 1;
+      else if (ev->len && strcmp(ev->name, TIMERFILE) == 0)
+        changed = 1;
+    }
+  }
+
+  if (n == -1 && errno != EAGAIN)
+    err(1, "%s: read", __func__);
+
+  return changed;
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,48 @@
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "shared.h"
+
+#ifndef PATH_MAX
+  #error PATH_MAX must be defined
+#endif
+
+/* name of the file with all running timers within the data dir */
+#define TIMERFILE ".timer"
+
+/* maximum number of timers that can run at the same time */
+#define MAXTIMERS 9
+
+/* maximum size of the timer file, one line per timer */
+#define MAXTIMERFILE (MAXTIMERS * (21 + MAXPROJ + 1))
+
+/* a running timer, proj is empty for a timer without a project */
+typedef struct {
+  time_t start;
+  char proj[MAXPROJ];
+} timer_entry_t;
+
+int timer_read(const char *dp, timer_entry_t *tv, size_t *n);
+int timer_write(const char *dp, const timer_entry_t *tv, size_t n);
+int timer_watch(const char *dp);
+int timer_changed(int fd);
+
+#endif
@@ -4,26 +4,21 @@ static char progname[MAXPROG];
 static void usage(void);
 static user_t user;
 static int init_user(user_t *usr);
+static int gaps(int argc, char *argv[], char *datapath, char *idxpath);
+static int explain(int argc, char *argv[], char *datapath, char *idxpath);
+static int status(int argc, char *argv[], char *datapath, char *idxpath);
+static int archive(int argc, char *argv[], char *datapath, char *idxpath);
+static void close_idx(void);
+
+/* the index of the interactive screen, closed on exit */
+static idx_t *idx;
 
 int
 main(int argc, char *argv[])
 {
   char datapath[PATH_MAX + 1];
   char idxpath[PATH_MAX + 1];
-
-  if (isatty(STDIN_FILENO) == 0)
-    err(1, "%s: stdin is not connected to a terminal", __func__);
-
-#ifdef VDSUSP
-  struct termios term;
-
-  /* enable ^Y */
-  if (tcgetattr(STDIN_FILENO, &term) < 0)
-    err(1, "%s: tcgetattr", __func__);
-  term.c_cc[VDSUSP] = _POSIX_VDISABLE;
-  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &term) < 0)
-    err(1, "%s: tcsetattr", __func__);
-#endif
+  int ch;
 
   /* make sure MB_CUR_MAX is set */
   if (setlocale(LC_ALL, "") == NULL)
@@ -36,8 +31,19 @@ main(int argc, char *argv[])
   if (strlcpy(progname, basename(argv[0]), MAXPROG) > MAXPROG)
     errx(1, "%s: program name too long", __func__);
 
-  if (argc == 2)
-    usage();
+  while ((ch = getopt(argc, argv, "hw:")) != -1) {
+    switch (ch) {
+    case 'w':
+      if (gap_set_hours(optarg) == -1)
+        errx(1, "illegal working hours: %s", optarg);
+      break;
+    case 'h':
+    default:
+      usage();
+    }
+  }
+  argc -= optind;
+  argv += optind;
 
   if (init_user(&user) < 0)
     errx(1, "%s: can't initialize user", __func__);
@@ -58,20 +64,266 @@ main(int argc, char *argv[])
   if (strlcat(idxpath, IDXPATH, PATH_MAX) >= PATH_MAX)
     return -1;
 
+  /* run a command instead of the interactive screen */
+  if (argc > 0) {
+    if (strcmp(argv[0], "status") == 0)
+      return status(argc, argv, datapath, idxpath);
+    if (strcmp(argv[0], "gaps") == 0)
+      return gaps(argc, argv, datapath, idxpath);
+    if (strcmp(argv[0], "explain") == 0)
+      return explain(argc, argv, datapath, idxpath);
+    if (strcmp(argv[0], "archive") == 0)
+      return archive(argc, argv, datapath, idxpath);
+    usage();
+  }
+
+  if (isatty(STDIN_FILENO) == 0)
+    err(1, "%s: stdin is not connected to a terminal", __func__);
+
+#ifdef VDSUSP
+  struct termios term;
+
+  /* enable ^Y */
+  if (tcgetattr(STDIN_FILENO, &term) < 0)
+    err(1, "%s: tcgetattr", __func__);
+  term.c_cc[VDSUSP] = _POSIX_VDISABLE;
+  if (tcsetattr(STDIN_FILENO, TCSAFLUSH, &term) < 0)
+    err(1, "%s: tcsetattr", __func__);
+#endif
+
   /* ensure index */
-  if (idx_open(datapath, idxpath, 0) == -1)
+  if ((idx = idx_open(datapath, idxpath, 0, 0)) == NULL)
     errx(1, "%s: can't initialize indices", __func__);
-  if (atexit(idx_close) != 0)
-    errx(1, "%s: can't register idx_close", __func__);
+  if (atexit(close_idx) != 0)
+    errx(1, "%s: can't register close_idx", __func__);
 
-  vp_init(datapath);
+  vp_init(idx, datapath);
   return vp_start();
 }
 
+/*
+ * Print all untracked time within working hours for every day in the range
+ * from - to. Both are optional dates in the form YYYY-MM-DD and default to the
+ * last seven days including today.
+ *
+ * Return 0 on success, 1 on error.
+ */
+static int
+gaps(int argc, char *argv[], char *datapath, char *idxpath)
+{
+  idx_t *gidx;
+  struct tm bd;
+  time_t from, to, now;
+
+  if (argc > 3)
+    usage();
+
+  now = time(NULL);
+
+  if (argc > 1) {
+    if (parse_day(argv[1], &from) == -1)
+      errx(1, "illegal date: %s", argv[1]);
+  } else {
+    if (localtime_r(&now, &bd) == NULL)
+      errx(1, "%s: localtime_r", __func__);
+    bd.tm_mday -= 6;
+    bd.tm_hour = 0;
+    bd.tm_min = 0;
+    bd.tm_sec = 0;
+    bd.tm_isdst = -1;
+    from = mktime(&bd);
+  }
+
+  to = now;
+  if (argc > 2) {
+    if (parse_day(argv[2], &to) == -1)
+      errx(1, "illegal date: %s", argv[2]);
+
+    /* include the last day, but never report on the future */
+    if (localtime_r(&to, &bd) == NULL)
+      errx(1, "%s: localtime_r", __func__);
+    bd.tm_mday++;
+    bd.tm_isdst = -1;
+    to = min(mktime(&bd), now);
+  }
+
+  if (from >= to)
+    errx(1, "empty date range");
+
+  if ((gidx = idx_open(datapath, idxpath, 0, 1)) == NULL)
+    errx(1, "%s: can't initialize indices", __func__);
+
+  if (gap_report(gidx, stdout, from, to) == -1)
+    errx(1, "%s: gap_report", __func__);
+
+  idx_close(gidx);
+
+  return 0;
+}
+
+/*
+ * Print the number of entries and minutes that start in the range from - to and
+ * optionally belong to one of the given projects, followed by the index that
+ * was used and the number of keys that were visited. If the index had to be
+ * rebuilt first, describe the rebuild as well. from and to are optional dates in
+ * the form YYYY-MM-DD, or "-" for no bound.
+ *
+ * Return 0 on success, 1 on error.
+ */
+static int
+explain(int argc, char *argv[], char *datapath, char *idxpath)
+{
+  idx_t *eidx;
+  struct tm bd;
+  int count, summ;
+
+  idx_itopts_t opts = {
+    NULL, /* char *proj; */
+    0, /* time_t minstart; */
+    0, /* time_t maxstart; */
+    1, /* int includemin; */
+    1, /* int includemax; */
+    0, /* size_t limit; */
+    0, /* size_t skip; */
+    0, /* int reverse; */
+    NULL, /* DBT *offset; */
+    0, /* time_t minend; */
+    0, /* time_t maxend; */
+    0, /* time_t at; */
+    NULL /* char **projs; */
+  };
+
+  if (argc > 1 && strcmp(argv[1], "-") != 0)
+    if (parse_day(argv[1], &opts.minstart) == -1)
+      errx(1, "illegal date: %s", argv[1]);
+
+  if (argc > 2 && strcmp(argv[2], "-") != 0) {
+    if (parse_day(argv[2], &opts.maxstart) == -1)
+      errx(1, "illegal date: %s", argv[2]);
+
+    /* include the last day */
+    if (localtime_r(&opts.maxstart, &bd) == NULL)
+      errx(1, "%s: localtime_r", __func__);
+    bd.tm_mday++;
+    bd.tm_isdst = -1;
+    opts.maxstart = mktime(&bd);
+  }
+
+  /* the remaining arguments are project names, terminated by argv[argc] */
+  if (argc == 4)
+    opts.proj = argv[3];
+  else if (argc > 4)
+    opts.projs = argv + 3;
+
+  if ((eidx = idx_open(datapath, idxpath, 0, 1)) == NULL)
+    errx(1, "%s: can't initialize indices", __func__);
+
+  if (idx_count(eidx, &opts, &count, &summ) == -1)
+    errx(1, "%s: idx_count", __func__);
+
+  printf("%d entries, %d:%02d\n", count, summ / 60, summ % 60);
+  printf("%s\n", idx_last_plan(eidx));
+  if (*idx_last_rebuild(eidx) != '\0')
+    printf("%s\n", idx_last_rebuild(eidx));
+
+  idx_close(eidx);
+
+  return 0;
+}
+
+/*
+ * Print the running timer, the tracked time of today and this week and the most
+ * recent entry. Only the status summary is read, the index is opened only if
+ * there is no summary yet.
+ *
+ * Return 0 on success, 1 on error.
+ */
+static int
+status(int argc, char *argv[], char *datapath, char *idxpath)
+{
+  idx_t *sidx;
+
+  if (argc > 1)
+    usage();
+
+  if (status_print(datapath, stdout) == 0)
+    return 0;
+
+  if ((sidx = idx_open(datapath, idxpath, 0, 1)) == NULL)
+    errx(1, "%s: can't initialize indices", __func__);
+
+  if (status_update(sidx, datapath) == -1)
+    errx(1, "%s: status_update", __func__);
+
+  idx_close(sidx);
+
+  if (status_print(datapath, stdout) == -1)
+    errx(1, "%s: status_print", __func__);
+
+  return 0;
+}
+
+/*
+ * Move every entry that starts before a date into a pack per project and year.
+ * The date is optional in the form YYYY-MM-DD and defaults to the first day of
+ * the current year.
+ *
+ * Return 0 on success, 1 on error.
+ */
+static int
+archive(int argc, char *argv[], char *datapath, char *idxpath)
+{
+  idx_t *aidx;
+  struct tm bd;
+  time_t before, now;
+  ssize_t n;
+
+  if (argc > 2)
+    usage();
+
+  if (argc > 1) {
+    if (parse_day(argv[1], &before) == -1)
+      errx(1, "illegal date: %s", argv[1]);
+  } else {
+    now = time(NULL);
+    if (localtime_r(&now, &bd) == NULL)
+      errx(1, "%s: localtime_r", __func__);
+    bd.tm_mon = 0;
+    bd.tm_mday = 1;
+    bd.tm_hour = 0;
+    bd.tm_min = 0;
+    bd.tm_sec = 0;
+    bd.tm_isdst = -1;
+    before = mktime(&bd);
+  }
+
+  if ((aidx = idx_open(datapath, idxpath, 0, 0)) == NULL)
+    errx(1, "%s: can't initialize indices", __func__);
+
+  if ((n = idx_archive(aidx, before)) == -1)
+    errx(1, "%s: idx_archive", __func__);
+
+  printf("%zd entries packed\n", n);
+
+  idx_close(aidx);
+
+  return 0;
+}
+
+/* close the index of the interactive screen */
+static void
+close_idx(void)
+{
+  idx_close(idx);
+}
+
 static void
 usage(void)
 {
-  printf("usage: %s [-h] [project]\n", progname);
+  printf("usage: %s [-h] [-w hh:mm-hh:mm] [gaps [from [to]]]\n", progname);
+  printf("       %s explain [from [to [project ...]]]\n", progname);
+  printf("       %s status\n", progname);
+  printf("       %s archive [before]\n", progname);
   exit(0);
 }
 
@@ -11,6 +11,8 @@
 #include <unistd.h>
 #include "screen.h"
 #include "index.h"
+#include "gap.h"
+#include "status.h"
 
 #define DATADIR ".uren"
 #define IDXPATH ".cache"